@@ -0,0 +1,138 @@
+/* Copyright 2022 Keita Morisaki. All rights reserved. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "./jcc.h"
+
+// Blocks are carved by bumping a pointer. Bigger requests get their own block.
+#define ARENA_BLOCK_SIZE (256 * 1024)
+#define ARENA_ALIGN _Alignof(max_align_t)
+
+struct ArenaBlock {
+  ArenaBlock *next;
+  size_t used;
+  size_t cap;
+  _Alignas(max_align_t) char data[];
+};
+
+static const char *arena_kind_names[AR_NUM_KINDS] = {
+  "node",
+  "type",
+  "ident",
+  "function",
+  "cache",
+  "symbol",
+  "ir",
+};
+
+static ArenaBlock *NewArenaBlock(Compiler *cc, Arena *ar, size_t min_size) {
+  size_t cap = ARENA_BLOCK_SIZE;
+  if (cap < min_size) cap = min_size;
+
+  // Callers rely on objects being zero-initialized.
+  ArenaBlock *block = calloc(1, sizeof(ArenaBlock) + cap);
+  if (!block) {
+    ExitWithError(cc, "Out of memory.");
+  }
+  block->cap = cap;
+  block->next = ar->head;
+  ar->head = block;
+  ar->reserved_bytes += cap;
+  if (ar->peak_reserved_bytes < ar->reserved_bytes) {
+    ar->peak_reserved_bytes = ar->reserved_bytes;
+  }
+  return block;
+}
+
+/*
+ * Returns zero-initialized memory of `size` bytes.
+ * The memory is valid until `ArenaReset` or `ArenaRelease` is called
+ * for `ar`.
+ */
+void *ArenaAlloc(Compiler *cc, Arena *ar, ArenaKind kind, size_t size) {
+  size_t aligned = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+  ArenaBlock *block = ar->head;
+  if (!block || block->cap - block->used < aligned) {
+    block = NewArenaBlock(cc, ar, aligned);
+  }
+
+  void *ptr = block->data + block->used;
+  block->used += aligned;
+
+  ar->bytes[kind] += size;
+  ++(ar->objects[kind]);
+  return ptr;
+}
+
+/*
+ * Frees every object allocated from `ar` at once, but keeps one
+ * block so that the next round of allocations does not hit malloc.
+ * The statistics keep counting across resets.
+ */
+void ArenaReset(Arena *ar) {
+  ArenaBlock *kept = NULL;
+  ArenaBlock *block = ar->head;
+  while (block) {
+    ArenaBlock *next = block->next;
+    if (!kept && block->cap == ARENA_BLOCK_SIZE) {
+      kept = block;
+    } else {
+      ar->reserved_bytes -= block->cap;
+      free(block);
+    }
+    block = next;
+  }
+
+  if (kept) {
+    memset(kept->data, 0, kept->used);
+    kept->used = 0;
+    kept->next = NULL;
+  }
+  ar->head = kept;
+}
+
+// Frees every object allocated from `ar` at once.
+void ArenaRelease(Arena *ar) {
+  ArenaBlock *block = ar->head;
+  while (block) {
+    ArenaBlock *next = block->next;
+    free(block);
+    block = next;
+  }
+
+  *ar = (Arena){0};
+}
+
+/*
+ * Adds the statistics of `src` to `dst`. The peaks are added up too,
+ * as for arenas that are in use at the same time.
+ */
+void ArenaAddStats(Arena *dst, const Arena *src) {
+  dst->peak_reserved_bytes += src->peak_reserved_bytes;
+  for (int i = 0; i < AR_NUM_KINDS; ++i) {
+    dst->bytes[i] += src->bytes[i];
+    dst->objects[i] += src->objects[i];
+  }
+}
+
+const char *ArenaKindName(ArenaKind kind) {
+  return arena_kind_names[kind];
+}
+
+void PrintArenaStats(Arena *ar, FILE *out) {
+  size_t total_bytes = 0;
+  size_t total_objects = 0;
+
+  fprintf(out, "%-8s %12s %12s\n", "kind", "bytes", "objects");
+  for (int i = 0; i < AR_NUM_KINDS; ++i) {
+    fprintf(out, "%-8s %12zu %12zu\n",
+            arena_kind_names[i], ar->bytes[i], ar->objects[i]);
+    total_bytes += ar->bytes[i];
+    total_objects += ar->objects[i];
+  }
+  fprintf(out, "%-8s %12zu %12zu\n", "total", total_bytes, total_objects);
+  fprintf(out, "%-8s %12zu\n", "reserved", ar->peak_reserved_bytes);
+}
@@ -0,0 +1,387 @@
+/* Copyright 2022 Keita Morisaki. All rights reserved. */
+/*
+ * Generates the instructions of x86-64 from the IR of a function.
+ *
+ * Each virtual register has a location, a register or a slot in the
+ * stack frame, given by `AllocateRegisters`. An instruction loads its
+ * operands in memory into the scratch registers rax and r11, and
+ * stores its result if it's in memory. rdx is used by idiv only.
+ *
+ * A comparison used only by the branch right after it is not stored,
+ * but turned into "cmp" and a conditional jump.
+ */
+#include "./jcc.h"
+
+typedef struct {
+  Operand *locs;      // location of each virtual register
+  int *num_uses;      // of each virtual register
+  int first_label;    // label of the block 0. Blocks are labeled in order.
+  int epilogue_label;
+} Backend;
+
+static bool SameLocation(Operand a, Operand b) {
+  if (a.kind != b.kind) return false;
+  if (a.kind == OP_REG) return a.reg == b.reg;
+  return a.kind == OP_MEM && a.reg == b.reg && a.imm == b.imm;
+}
+
+static void Move(Compiler *cc, Operand dst, Operand src) {
+  if (SameLocation(dst, src)) return;
+  // Memory to memory, or an immediate of unknown size to memory
+  if (dst.kind == OP_MEM && src.kind != OP_REG) {
+    Insn2(cc, I_MOV, Reg(R11), src);
+    src = Reg(R11);
+  }
+  Insn2(cc, I_MOV, dst, src);
+}
+
+/*
+ * Returns the location of `v` to be read. A virtual register read but
+ * never defined has none, and is an error of the lowering.
+ */
+static Operand Location(Compiler *cc, Backend *be, int v) {
+  Operand loc = be->locs[v];
+  if (loc.kind == OP_NONE) {
+    ExitWithError(cc, "v%d is used but never defined.", v);
+  }
+  return loc;
+}
+
+// Returns the register holding `v`, loading it into `scratch` if needed.
+static Register Use(Compiler *cc, Backend *be, int v, Register scratch) {
+  Operand loc = Location(cc, be, v);
+  if (loc.kind == OP_REG) return loc.reg;
+  Insn2(cc, I_MOV, Reg(scratch), loc);
+  return scratch;
+}
+
+// Returns the register to compute `v` into. See `Define`.
+static Register Target(Backend *be, int v, Register scratch) {
+  Operand loc = be->locs[v];
+  return loc.kind == OP_REG ? loc.reg : scratch;
+}
+
+// Stores `v` computed into `reg` to its location.
+static void Define(Compiler *cc, Backend *be, int v, Register reg) {
+  Move(cc, be->locs[v], Reg(reg));
+}
+
+// The second operand of a binary operation
+static Operand Source(Compiler *cc, Backend *be, IRInsn *insn) {
+  return insn->b ? Location(cc, be, insn->b) : Imm(insn->imm);
+}
+
+static Operand BlockLabel(Backend *be, BasicBlock *block) {
+  return Label(be->first_label + block->id);
+}
+
+/*
+ * Moves each of `srcs` to the register or the memory in `dsts` at once,
+ * as if all of them were read before any is written. Used for the
+ * arguments, whose registers can hold the values being moved.
+ */
+static void MoveParallel(Compiler *cc, Operand *dsts, Operand *srcs, int n) {
+  bool done[6] = {0};
+  int remaining = n;
+  while (remaining) {
+    bool moved = false;
+    for (int i = 0; i < n; ++i) {
+      if (done[i]) continue;
+      // Not yet if the destination is still to be read.
+      bool blocked = false;
+      for (int j = 0; j < n; ++j) {
+        if (j != i && !done[j] && dsts[i].kind == OP_REG &&
+            SameLocation(srcs[j], dsts[i])) {
+          blocked = true;
+        }
+      }
+      if (blocked) continue;
+      Move(cc, dsts[i], srcs[i]);
+      done[i] = true;
+      --remaining;
+      moved = true;
+    }
+    if (moved || !remaining) continue;
+
+    // Registers moved in a cycle. One of them is read from r11 instead.
+    for (int i = 0; i < n; ++i) {
+      if (done[i]) continue;
+      Operand freed = dsts[i];
+      Insn2(cc, I_MOV, Reg(R11), freed);
+      for (int j = 0; j < n; ++j) {
+        if (!done[j] && SameLocation(srcs[j], freed)) srcs[j] = Reg(R11);
+      }
+      break;
+    }
+  }
+}
+
+// Stores the parameters from the IR_PARAMs starting at `insn`.
+static IRInsn *GenerateParams(Compiler *cc, Backend *be, IRInsn *insn) {
+  Operand dsts[6];
+  Operand srcs[6];
+  int n = 0;
+  for (;;) {
+    dsts[n] = be->locs[insn->dst];
+    srcs[n++] = Reg(registers[insn->imm]);
+    if (!insn->next || insn->next->op != IR_PARAM) break;
+    insn = insn->next;
+  }
+  MoveParallel(cc, dsts, srcs, n);
+  return insn;
+}
+
+static void GenerateCall(Compiler *cc, Backend *be, IRInsn *insn) {
+  // Arguments after the first 6 are pushed from the last one.
+  int num_on_stack = insn->num_args > 6 ? insn->num_args - 6 : 0;
+  // Keep rsp 16-byte aligned at the call.
+  int padding = num_on_stack % 2 ? 8 : 0;
+  if (padding) Insn2(cc, I_SUB, Reg(RSP), Imm(padding));
+  for (int i = insn->num_args - 1; i >= 6; --i) {
+    Insn1(cc, I_PUSH, Reg(Use(cc, be, insn->args[i], R11)));
+  }
+
+  Operand dsts[6];
+  Operand srcs[6];
+  int n = insn->num_args - num_on_stack;
+  for (int i = 0; i < n; ++i) {
+    dsts[i] = Reg(registers[i]);
+    srcs[i] = Location(cc, be, insn->args[i]);
+  }
+  MoveParallel(cc, dsts, srcs, n);
+
+  Insn1(cc, I_CALL, Sym(insn->sym));
+  if (num_on_stack) {
+    Insn2(cc, I_ADD, Reg(RSP), Imm(8 * num_on_stack + padding));
+  }
+  Define(cc, be, insn->dst, RAX);
+}
+
+static InsnKind SetOf(IROp op) {
+  switch (op) {
+    case IR_EQ:
+      return I_SETE;
+    case IR_NE:
+      return I_SETNE;
+    case IR_LT:
+      return I_SETL;
+    default:
+      return I_SETLE;
+  }
+}
+
+// Jump taken if the comparison `op` is true, or false if `negated`.
+static InsnKind JumpOf(IROp op, bool negated) {
+  switch (op) {
+    case IR_EQ:
+      return negated ? I_JNE : I_JE;
+    case IR_NE:
+      return negated ? I_JE : I_JNE;
+    case IR_LT:
+      return negated ? I_JGE : I_JL;
+    default:
+      return negated ? I_JG : I_JLE;
+  }
+}
+
+static bool IsComparison(IROp op) {
+  return op == IR_EQ || op == IR_NE || op == IR_LT || op == IR_LE;
+}
+
+// True if `insn` is a comparison only for the branch right after it.
+static bool IsFusedComparison(Backend *be, IRInsn *insn) {
+  return IsComparison(insn->op) && insn->next && insn->next->op == IR_BR &&
+         insn->next->a == insn->dst && be->num_uses[insn->dst] == 1;
+}
+
+static void GenerateBranch(Compiler *cc, Backend *be, BasicBlock *block,
+                           IRInsn *insn, IRInsn *comparison) {
+  IROp op = IR_NE;
+  if (comparison) {
+    op = comparison->op;
+    Register a = Use(cc, be, comparison->a, RAX);
+    Insn2(cc, I_CMP, Reg(a), Source(cc, be, comparison));
+  } else {
+    Insn2(cc, I_CMP, Reg(Use(cc, be, insn->a, RAX)), Imm(0));
+  }
+
+  if (insn->then_block == block->next) {
+    Insn1(cc, JumpOf(op, true), BlockLabel(be, insn->else_block));
+    return;
+  }
+  Insn1(cc, JumpOf(op, false), BlockLabel(be, insn->then_block));
+  if (insn->else_block != block->next) {
+    Insn1(cc, I_JMP, BlockLabel(be, insn->else_block));
+  }
+}
+
+static void GenerateBinary(Compiler *cc, Backend *be, IRInsn *insn) {
+  if (insn->op == IR_DIV || insn->op == IR_MOD) {
+    Move(cc, Reg(RAX), Location(cc, be, insn->a));
+    Insn0(cc, I_CQO);
+    Insn1(cc, I_IDIV, Reg(Use(cc, be, insn->b, R11)));
+    Define(cc, be, insn->dst, insn->op == IR_DIV ? RAX : RDX);
+    return;
+  }
+
+  Operand src = Source(cc, be, insn);
+  if (IsComparison(insn->op)) {
+    Insn2(cc, I_CMP, Reg(Use(cc, be, insn->a, RAX)), src);
+    Register dst = Target(be, insn->dst, RAX);
+    Insn1(cc, SetOf(insn->op), Reg(dst));
+    Insn2(cc, I_MOVZB, Reg(dst), Reg(dst));
+    Define(cc, be, insn->dst, dst);
+    return;
+  }
+
+  Register dst = Target(be, insn->dst, RAX);
+  // Computing into the register of `b` would overwrite it.
+  if (insn->b && insn->b != insn->a && SameLocation(src, Reg(dst))) {
+    dst = RAX;
+  }
+  Move(cc, Reg(dst), Location(cc, be, insn->a));
+  InsnKind kind = insn->op == IR_ADD ? I_ADD :
+                  insn->op == IR_SUB ? I_SUB : I_IMUL;
+  Insn2(cc, kind, Reg(dst), src);
+  Define(cc, be, insn->dst, dst);
+}
+
+static void GenerateBlock(Compiler *cc, Backend *be, BasicBlock *block) {
+  Insn1(cc, I_LABEL, BlockLabel(be, block));
+
+  IRInsn *comparison = NULL;  // fused into the branch
+  for (IRInsn *insn = block->first; insn; insn = insn->next) {
+    switch (insn->op) {
+      case IR_IMM:
+        Move(cc, be->locs[insn->dst], Imm(insn->imm));
+        break;
+      case IR_MOV:
+        Move(cc, be->locs[insn->dst], Location(cc, be, insn->a));
+        break;
+      case IR_EQ:
+      case IR_NE:
+      case IR_LT:
+      case IR_LE:
+        if (IsFusedComparison(be, insn)) {
+          comparison = insn;
+          break;
+        }
+        GenerateBinary(cc, be, insn);
+        break;
+      case IR_ADD:
+      case IR_SUB:
+      case IR_MUL:
+      case IR_DIV:
+      case IR_MOD:
+        GenerateBinary(cc, be, insn);
+        break;
+      case IR_PARAM:
+        insn = GenerateParams(cc, be, insn);
+        break;
+      case IR_LOCAL_ADDR: {
+        Register dst = Target(be, insn->dst, RAX);
+        Insn2(cc, I_LEA, Reg(dst), Mem(RBP, -insn->imm));
+        Define(cc, be, insn->dst, dst);
+        break;
+      }
+      case IR_GLOBAL_ADDR: {
+        Register dst = Target(be, insn->dst, RAX);
+        Insn2(cc, I_LEA, Reg(dst), Sym(insn->sym));
+        Define(cc, be, insn->dst, dst);
+        break;
+      }
+      case IR_LOAD: {
+        Register addr = Use(cc, be, insn->a, R11);
+        Register dst = Target(be, insn->dst, RAX);
+        Insn2(cc, I_MOV, Reg(dst), Mem(addr, 0));
+        Define(cc, be, insn->dst, dst);
+        break;
+      }
+      case IR_STORE: {
+        Register addr = Use(cc, be, insn->a, R11);
+        Register val = Use(cc, be, insn->b, RAX);
+        Insn2(cc, I_MOV, Mem(addr, 0), Reg(val));
+        break;
+      }
+      case IR_CALL:
+        GenerateCall(cc, be, insn);
+        break;
+      case IR_JMP:
+        if (insn->then_block != block->next) {
+          Insn1(cc, I_JMP, BlockLabel(be, insn->then_block));
+        }
+        break;
+      case IR_BR:
+        GenerateBranch(cc, be, block, insn, comparison);
+        break;
+      case IR_RET:
+        Move(cc, Reg(RAX), Location(cc, be, insn->a));
+        if (block->next) Insn1(cc, I_JMP, Label(be->epilogue_label));
+        break;
+      case IR_NUM_OPS:
+        break;
+    }
+  }
+}
+
+static void CountUses(IRFunction *fn, int *num_uses) {
+  for (BasicBlock *block = fn->blocks; block; block = block->next) {
+    for (IRInsn *insn = block->first; insn; insn = insn->next) {
+      if (insn->op == IR_CALL) {
+        for (int i = 0; i < insn->num_args; ++i) ++num_uses[insn->args[i]];
+      }
+      ++num_uses[insn->a];
+      ++num_uses[insn->b];
+    }
+  }
+}
+
+// Generates the instructions of `fn` into `cc->insns`.
+void GenerateFromIR(Compiler *cc, IRFunction *fn) {
+  Backend be = {0};
+  be.locs = ArenaAlloc(cc, &cc->func_arena, AR_IR,
+                       (fn->num_vregs + 1) * sizeof(Operand));
+  be.num_uses = ArenaAlloc(cc, &cc->func_arena, AR_IR,
+                           (fn->num_vregs + 1) * sizeof(int));
+  CountUses(fn, be.num_uses);
+
+  AllocateRegisters(cc, fn, be.locs);
+
+  // The callee-saved registers allocated are saved below the slots.
+  static const Register callee_saved[5] = {RBX, R12, R13, R14, R15};
+  Operand saved[5];
+  int num_saved = 0;
+  int frame_size = fn->frame_size;
+  for (int i = 0; i < 5; ++i) {
+    if (!(fn->used_registers & 1 << callee_saved[i])) continue;
+    frame_size += 8;
+    saved[num_saved++] = Reg(callee_saved[i]);
+  }
+
+  be.first_label = cc->label_num;
+  be.epilogue_label = be.first_label + fn->num_blocks;
+  cc->label_num = be.epilogue_label + 1;
+
+  DBGPRNT;
+  Insn1(cc, I_LABEL, Sym(fn->name));
+  Insn1(cc, I_PUSH, Reg(RBP));
+  Insn2(cc, I_MOV, Reg(RBP), Reg(RSP));
+  // Keep rsp 16-byte aligned.
+  frame_size = (frame_size + 15) / 16 * 16;
+  if (frame_size) Insn2(cc, I_SUB, Reg(RSP), Imm(frame_size));
+  for (int i = 0; i < num_saved; ++i) {
+    Insn2(cc, I_MOV, Mem(RBP, -fn->frame_size - 8 * (i + 1)), saved[i]);
+  }
+
+  for (BasicBlock *block = fn->blocks; block; block = block->next) {
+    GenerateBlock(cc, &be, block);
+  }
+
+  Insn1(cc, I_LABEL, Label(be.epilogue_label));
+  for (int i = 0; i < num_saved; ++i) {
+    Insn2(cc, I_MOV, saved[i], Mem(RBP, -fn->frame_size - 8 * (i + 1)));
+  }
+  Insn2(cc, I_MOV, Reg(RSP), Reg(RBP));
+  Insn1(cc, I_POP, Reg(RBP));
+  Insn0(cc, I_RET);
+}
@@ -0,0 +1,137 @@
+/* Copyright 2022 Keita Morisaki. All rights reserved. */
+/*
+ * Generator of large programs for the compiler benchmark.
+ *
+ * Usage: bench/gen <shape> <scale>
+ *
+ * Prints a program of the given shape to stdout. The size grows
+ * linearly with `scale`. Shapes:
+ *   funcs   many small functions calling each other
+ *   locals  huge functions with many local variables
+ *   expr    deeply nested expressions
+ *   loops   long chains of for/while loops
+ *   arrays  big local and global arrays accessed in loops
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void GenFuncs(int scale) {
+  for (int i = 0; i < scale; ++i) {
+    printf("int func_%d(int a, int b) {\n", i);
+    printf("  int c;\n");
+    printf("  c = a * %d + b;\n", i % 97);
+    printf("  if (c > %d) return c - b;\n", i);
+    if (i) {
+      printf("  return func_%d(c, a);\n", i - 1);
+    } else {
+      printf("  return c;\n");
+    }
+    printf("}\n");
+  }
+  printf("int main() {return func_%d(1, 2);}\n", scale - 1);
+}
+
+// Each function has 1000 locals, so `scale` is in thousands of locals.
+static void GenLocals(int scale) {
+  const int num_locals = 1000;
+  for (int f = 0; f < scale; ++f) {
+    printf("int locals_%d(int seed) {\n", f);
+    for (int i = 0; i < num_locals; ++i) {
+      printf("  int v%d;\n  v%d = seed + %d;\n", i, i, i);
+    }
+    printf("  int sum;\n  sum = 0;\n");
+    for (int i = 0; i < num_locals; ++i) {
+      printf("  sum = sum + v%d;\n", i);
+    }
+    printf("  return sum;\n}\n");
+  }
+  printf("int main() {return locals_0(1);}\n");
+}
+
+// Prints an expression nested `depth` levels deep.
+static void PrintNestedExpr(int depth, unsigned salt) {
+  if (!depth) {
+    printf("x");
+    return;
+  }
+  static const char *ops[] = {"+", "-", "*", "%", "==", "<"};
+  printf("(");
+  PrintNestedExpr(depth - 1, salt * 7u + 3u);
+  printf(" %s %u)", ops[salt % 6], salt % 89 + 1);
+}
+
+static void GenExpr(int scale) {
+  for (int i = 0; i < scale; ++i) {
+    printf("int expr_%d(int x) {\n", i);
+    for (int j = 0; j < 8; ++j) {
+      printf("  x = ");
+      PrintNestedExpr(64, i + j);
+      printf(";\n");
+    }
+    printf("  return x;\n}\n");
+  }
+  printf("int main() {return expr_0(3);}\n");
+}
+
+static void GenLoops(int scale) {
+  for (int i = 0; i < scale; ++i) {
+    printf("int loops_%d(int n) {\n", i);
+    printf("  int i; int j; int total;\n  total = 0;\n");
+    for (int j = 0; j < 20; ++j) {
+      if (j % 2) {
+        printf("  i = 0;\n  while (i < n) {total += i; ++i;}\n");
+      } else {
+        printf("  for (i = 0; i < n; ++i) {\n");
+        printf("    for (j = 0; j < %d; ++j) total = total + j;\n", j + 1);
+        printf("  }\n");
+      }
+    }
+    printf("  return total;\n}\n");
+  }
+  printf("int main() {return loops_0(3);}\n");
+}
+
+static void GenArrays(int scale) {
+  printf("int table[100000];\n");
+  for (int i = 0; i < scale; ++i) {
+    printf("int arrays_%d(int n) {\n", i);
+    printf("  int a[1000]; int i; int total;\n");
+    printf("  for (i = 0; i < 1000; ++i) a[i] = i * n;\n");
+    for (int j = 0; j < 20; ++j) {
+      printf("  table[%d] = a[%d] + a[%d] * table[%d];\n",
+             (i * 20 + j) % 100000, j, (j * 31) % 1000, j);
+    }
+    printf("  total = 0;\n");
+    printf("  for (i = 0; i < 1000; ++i) total += a[i] - table[i];\n");
+    printf("  return total;\n}\n");
+  }
+  printf("int main() {return arrays_0(3);}\n");
+}
+
+static const struct {
+  const char *name;
+  void (*gen)(int scale);
+} shapes[] = {
+  {"funcs", GenFuncs},
+  {"locals", GenLocals},
+  {"expr", GenExpr},
+  {"loops", GenLoops},
+  {"arrays", GenArrays},
+};
+
+int main(int argc, char **argv) {
+  if (argc != 3 || atoi(argv[2]) <= 0) {
+    fprintf(stderr, "Usage: bench/gen <shape> <scale>\n");
+    return 1;
+  }
+
+  for (size_t i = 0; i < sizeof(shapes) / sizeof(shapes[0]); ++i) {
+    if (!strcmp(shapes[i].name, argv[1])) {
+      shapes[i].gen(atoi(argv[2]));
+      return 0;
+    }
+  }
+  fprintf(stderr, "Unknown shape \"%s\".\n", argv[1]);
+  return 1;
+}
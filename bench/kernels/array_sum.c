@@ -0,0 +1,25 @@
+int a[10000];
+
+int total_a() {
+  int i;
+  int ret;
+  ret = 0;
+  for (i = 0; i < 10000; ++i) {
+    ret += a[i];
+  }
+  return ret;
+}
+
+int main() {
+  int i;
+  int round;
+  int checksum;
+  for (i = 0; i < 10000; ++i) {
+    a[i] = i % 17;
+  }
+  checksum = 0;
+  for (round = 0; round < 2000; ++round) {
+    checksum = (checksum + total_a()) % 65536;
+  }
+  return checksum % 256;
+}
@@ -0,0 +1,13 @@
+int mix(int a, int b, int c, int d, int e, int f, int g, int h) {
+  return (a + b * 2 + c * 3 + d * 4 + e * 5 + f * 6 + g * 7 + h * 8) % 1000;
+}
+
+int main() {
+  int i;
+  int acc;
+  acc = 0;
+  for (i = 0; i < 3000000; ++i) {
+    acc = mix(acc, i, i % 3, i % 5, i % 7, acc % 11, i % 13, acc % 17);
+  }
+  return acc % 256;
+}
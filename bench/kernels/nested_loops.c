@@ -0,0 +1,33 @@
+int x[4096];
+int y[4096];
+int z[4096];
+
+int main() {
+  int n;
+  int i;
+  int j;
+  int k;
+  int sum;
+  int round;
+  n = 64;
+  for (i = 0; i < n * n; ++i) {
+    x[i] = i % 7;
+    y[i] = i % 5;
+  }
+  for (round = 0; round < 20; ++round) {
+    for (i = 0; i < n; ++i) {
+      for (j = 0; j < n; ++j) {
+        sum = round;
+        for (k = 0; k < n; ++k) {
+          sum += x[i * n + k] * y[k * n + j];
+        }
+        z[i * n + j] = sum;
+      }
+    }
+  }
+  sum = 0;
+  for (i = 0; i < n * n; ++i) {
+    sum = (sum + z[i]) % 65536;
+  }
+  return sum % 256;
+}
@@ -0,0 +1,27 @@
+int data[8192];
+
+int walk(int *begin, int *end) {
+  int sum;
+  int *p;
+  sum = 0;
+  p = begin;
+  while (p < end) {
+    sum = sum + *p;
+    p = p + 1;
+  }
+  return sum;
+}
+
+int main() {
+  int i;
+  int round;
+  int checksum;
+  for (i = 0; i < 8192; ++i) {
+    data[i] = i % 13;
+  }
+  checksum = 0;
+  for (round = 0; round < 2000; ++round) {
+    checksum = (checksum + walk(data, &data[8192])) % 65536;
+  }
+  return checksum % 256;
+}
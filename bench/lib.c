@@ -0,0 +1,122 @@
+/* Copyright 2022 Keita Morisaki. All rights reserved. */
+/*
+ * Benchmark of compiling in-process with libjcc.
+ *
+ * Usage: bench/lib [iterations]
+ *
+ * Compiles small programs `iterations` times with one jcc_context,
+ * every 10th of them invalid, and checks every result. Then the same
+ * valid program is compiled by spawning ./jcc, for comparison.
+ * Fails if the memory used keeps growing, i.e. something leaks.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <spawn.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#include "../libjcc.h"
+
+static const char valid_snippet[] =
+  "int add(int a, int b) {return a + b;}\n"
+  "int main() {int i; int x; x = 0; for (i = 0; i < %d; ++i) x = add(x, i);"
+  " return x;}\n";
+
+// Undeclared variable in a nested block
+static const char invalid_snippet[] =
+  "int main() {int i; for (i = 0; i < %d; ++i) {{int y; y = i;} y = 1;}}\n";
+
+static double Now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long PeakRssKb() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+static int Fail(const char *msg, int iteration) {
+  fprintf(stderr, "bench/lib: %s at iteration %d\n", msg, iteration);
+  return 1;
+}
+
+// Runs ./jcc `iterations` times and returns the seconds taken.
+static double SpawnJcc(const char *src, int iterations) {
+  char *argv[] = {"./jcc", "-o", "/dev/null", (char *)src, NULL};
+  double start = Now();
+  for (int i = 0; i < iterations; ++i) {
+    pid_t pid;
+    int status;
+    if (posix_spawn(&pid, argv[0], NULL, NULL, argv, NULL) ||
+        waitpid(pid, &status, 0) < 0 || status) {
+      return -1;
+    }
+  }
+  return Now() - start;
+}
+
+int main(int argc, char **argv) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 100000;
+  if (iterations < 10) iterations = 10;
+
+  jcc_context *ctx = jcc_context_new();
+  char src[256];
+  char buf[16384];
+  long warm_rss = 0;
+
+  double start = Now();
+  for (int i = 0; i < iterations; ++i) {
+    bool invalid = i % 10 == 9;
+    int len = snprintf(src, sizeof(src),
+                       invalid ? invalid_snippet : valid_snippet, i);
+    jcc_output out = {buf, sizeof(buf)};
+    jcc_result result = jcc_compile(ctx, src, len, &out);
+
+    if (invalid) {
+      if (result != JCC_ERROR || !strstr(out.error, "<input>:1:")) {
+        return Fail("Didn't get expected error", i);
+      }
+    } else if (result != JCC_OK || strlen(buf) != out.len ||
+               !strstr(buf, "main:")) {
+      return Fail("Didn't get the assembly", i);
+    }
+
+    if (i == iterations / 10) warm_rss = PeakRssKb();
+  }
+  double elapsed = Now() - start;
+
+  jcc_output small = {buf, 16};
+  if (jcc_compile(ctx, "int main() {return 0;}", 22, &small) !=
+      JCC_ERROR_OUTPUT_TOO_SMALL || small.len <= 16) {
+    return Fail("Didn't get expected JCC_ERROR_OUTPUT_TOO_SMALL", 0);
+  }
+
+  long rss_growth = PeakRssKb() - warm_rss;
+  jcc_context_free(ctx);
+
+  printf("libjcc: %d compiles, %.0f compiles/s, peak RSS grew by %ld KB\n",
+         iterations, iterations / elapsed, rss_growth);
+
+  int spawns = iterations / 100 + 1;
+  snprintf(src, sizeof(src), valid_snippet, 1);
+  double spawn_elapsed = SpawnJcc(src, spawns);
+  if (spawn_elapsed < 0) {
+    printf("spawn:  ./jcc is not available\n");
+  } else {
+    printf("spawn:  %d compiles, %.0f compiles/s\n",
+           spawns, spawns / spawn_elapsed);
+  }
+
+  // Anything leaked per compile would show up over so many compiles.
+  if (rss_growth > 1024) {
+    return Fail("Memory keeps growing", iterations);
+  }
+  return 0;
+}
@@ -0,0 +1,89 @@
+#!/bin/bash
+# Compiler throughput benchmark.
+#
+# Usage: bench/run.sh [--update-baseline]
+#
+# Compiles a generated program of each shape (see bench/gen.c) with
+# `jcc --stats` and prints the time of each phase, MB/s and functions/s
+# of the best of $BENCH_RUNS runs. MB/s is compared with
+# bench/baseline.txt, which --update-baseline rewrites.
+#
+# BENCH_SCALE multiplies the size of every input (default 1).
+
+cd "$(dirname "$0")/.." || exit 1
+
+baseline=bench/baseline.txt
+runs=${BENCH_RUNS:-5}
+scale=${BENCH_SCALE:-1}
+
+# shape and its scale giving about 3 MB of source
+shapes="funcs:30000 locals:50 expr:800 loops:2500 arrays:3000"
+
+workdir=$(mktemp -d)
+trap 'rm -rf "$workdir"' EXIT
+
+# Prints "<phase> <wall_ms>" per phase and "functions <n>"
+# from the output of --stats. "function" appears in "counts" first,
+# then in "bytes".
+parse_stats() {
+  sed -n -e 's/^ *"\([a-z_]*\)": {"wall_ms": \([0-9.]*\).*/\1 \2/p' \
+         -e 's/^ *"function": \([0-9]*\).*/functions \1/p'
+}
+
+baseline_of() {
+  [ -f "$baseline" ] && awk -v shape="$1" '$1 == shape {print $2}' "$baseline"
+}
+
+new_baseline=""
+printf "%-8s %6s %9s %9s %9s %9s %9s %8s %10s %9s\n" \
+  shape MB tokenize parse add_type codegen total_ms MB/s funcs/s baseline
+for entry in $shapes; do
+  shape=${entry%%:*}
+  size=$((${entry##*:} * scale))
+  input="$workdir/$shape.c"
+  ./bench/gen "$shape" "$size" > "$input" || exit 1
+  bytes=$(wc -c < "$input")
+
+  best=""
+  for _ in $(seq 1 "$runs"); do
+    stats=$(./jcc --stats -o "$workdir/out.s" "$input" 2>&1 >/dev/null) || {
+      echo "$stats"
+      exit 1
+    }
+    stats=$(echo "$stats" | parse_stats)
+    total=$(echo "$stats" | awk '$1 == "total" {print $2}')
+    if [ -z "$best" ] || awk -v a="$total" -v b="$best_total" \
+        'BEGIN {exit !(a < b)}'; then
+      best=$stats
+      best_total=$total
+    fi
+  done
+
+  result=$(echo "$best" | awk -v bytes="$bytes" '
+    !($1 in v) {v[$1] = $2}
+    END {
+      mb = bytes / 1048576
+      s = v["total"] / 1000
+      printf "%6.2f %9.2f %9.2f %9.2f %9.2f %9.2f %8.2f %10.0f",
+             mb, v["tokenize"], v["parse"], v["add_type"], v["codegen"],
+             v["total"], mb / s, v["functions"] / s
+    }')
+  mb_per_sec=$(echo "$result" | awk '{print $7}')
+
+  old=$(baseline_of "$shape")
+  diff="-"
+  if [ -n "$old" ]; then
+    diff=$(awk -v new="$mb_per_sec" -v old="$old" \
+      'BEGIN {printf "%+.1f%%", (new - old) / old * 100}')
+  fi
+  printf "%-8s %s %9s\n" "$shape" "$result" "$diff"
+  new_baseline="$new_baseline$shape $mb_per_sec"$'\n'
+done
+
+if [ "$1" = "--update-baseline" ]; then
+  {
+    echo "# shape MB/s, written by bench/run.sh --update-baseline"
+    printf "%s" "$new_baseline"
+  } > "$baseline"
+  echo "Updated $baseline"
+fi
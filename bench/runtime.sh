@@ -0,0 +1,97 @@
+#!/bin/bash
+# Runtime benchmark of the code jcc generates.
+#
+# Usage: bench/runtime.sh [kernel.c ...]
+#
+# Each kernel in bench/kernels (or the given ones) is compiled with
+# jcc, `cc -O0` and `cc -O2`. Every binary is run $BENCH_RUNS times
+# and the median wall time is reported, together with the instructions
+# retired from `perf stat` if perf is available. The exit code of the
+# kernel is its checksum, and the three binaries must agree on it.
+#
+# JCCFLAGS is passed to jcc.
+#
+# Kernels must stay in the subset jcc accepts, so they have no comments:
+#   fib           recursive calls
+#   array_sum     sum of a global array, like `total_a` in test.sh
+#   nested_loops  triple loop over arrays indexed as matrices
+#   pointer_walk  pointer increments and dereferences
+#   many_args     calls with 8 arguments, 2 of them on the stack
+
+cd "$(dirname "$0")/.." || exit 1
+
+runs=${BENCH_RUNS:-5}
+cc=${CC:-cc}
+
+kernels=("$@")
+if [ ${#kernels[@]} -eq 0 ]; then
+  kernels=(bench/kernels/*.c)
+fi
+
+workdir=$(mktemp -d)
+trap 'rm -rf "$workdir"' EXIT
+
+use_perf=false
+if command -v perf > /dev/null &&
+    perf stat -x, -e instructions:u true > /dev/null 2>&1; then
+  use_perf=true
+fi
+
+# Prints the median of the numbers given as arguments.
+median() {
+  printf "%s\n" "$@" | sort -n | awk '{v[NR] = $1} END {print v[int((NR + 1) / 2)]}'
+}
+
+# Runs "$1" $runs times and prints "<exit code> <median ms> <instructions>".
+measure() {
+  local times=()
+  local status
+  for _ in $(seq 1 "$runs"); do
+    local start end
+    start=$(date +%s%N)
+    "$1"
+    status=$?
+    end=$(date +%s%N)
+    times+=($(((end - start) / 1000)))
+  done
+
+  local insns="-"
+  if $use_perf; then
+    insns=$(perf stat -x, -e instructions:u "$1" 2>&1 >/dev/null |
+            awk -F, '/instructions/ {print $1}')
+  fi
+  echo "$status $(median "${times[@]}" | awk '{printf "%.2f", $1 / 1000}') $insns"
+}
+
+printf "%-14s %10s %10s %10s %7s %7s %14s %14s %14s\n" \
+  kernel jcc_ms O0_ms O2_ms jcc/O0 jcc/O2 jcc_insns O0_insns O2_insns
+failed=0
+for kernel in "${kernels[@]}"; do
+  name=$(basename "$kernel" .c)
+  # shellcheck disable=SC2086
+  ./jcc $JCCFLAGS -o "$workdir/$name.s" "$kernel" || exit 1
+  "$cc" -o "$workdir/$name.jcc" "$workdir/$name.s" 2> /dev/null || exit 1
+  "$cc" -O0 -w -o "$workdir/$name.O0" "$kernel" || exit 1
+  "$cc" -O2 -w -o "$workdir/$name.O2" "$kernel" || exit 1
+
+  read -r jcc_status jcc_ms jcc_insns < <(measure "$workdir/$name.jcc")
+  read -r o0_status o0_ms o0_insns < <(measure "$workdir/$name.O0")
+  read -r o2_status o2_ms o2_insns < <(measure "$workdir/$name.O2")
+
+  if [ "$jcc_status" != "$o0_status" ] || [ "$jcc_status" != "$o2_status" ]; then
+    echo "$name: checksum differs (jcc $jcc_status, -O0 $o0_status, -O2 $o2_status)"
+    failed=1
+    continue
+  fi
+
+  awk -v name="$name" -v j="$jcc_ms" -v o0="$o0_ms" -v o2="$o2_ms" \
+      -v ji="$jcc_insns" -v o0i="$o0_insns" -v o2i="$o2_insns" 'BEGIN {
+    printf "%-14s %10.2f %10.2f %10.2f %7.2f %7.2f %14s %14s %14s\n",
+           name, j, o0, o2, o0 ? j / o0 : 0, o2 ? j / o2 : 0, ji, o0i, o2i
+  }'
+done
+
+if ! $use_perf; then
+  echo "(perf is not available; instructions are not counted)"
+fi
+exit $failed
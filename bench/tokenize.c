@@ -0,0 +1,82 @@
+/* Copyright 2022 Keita Morisaki. All rights reserved. */
+/*
+ * Tokenizer microbenchmark.
+ *
+ * Usage: bench/tokenize [size_in_mb] [iterations] [scanner]
+ *
+ * Builds a synthetic program of the given size by repeating
+ * a function definition, tokenizes it `iterations` times and
+ * prints the best tokens/sec and MB/s.
+ * `scanner` is one of "sse2" or "scalar".
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../jcc.h"
+
+static const char snippet[] =
+  "int function_%d(int alpha, int beta, int *gamma_ptr) {\n"
+  "  int counter; int total_value; int buffer[16];\n"
+  "  total_value = 0;\n"
+  "  for (counter = 0; counter < 16; ++counter) {\n"
+  "    buffer[counter] = alpha * counter + beta %% 7;\n"
+  "    total_value += buffer[counter];\n"
+  "  }\n"
+  "  while (total_value >= 1000) total_value -= 1000;\n"
+  "  if (total_value != 42) *gamma_ptr = total_value; else return sizeof(alpha);\n"
+  "  return total_value == beta;\n"
+  "}\n";
+
+static double Now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *BuildInput(size_t target_size) {
+  size_t cap = target_size + 2 * sizeof(snippet) + 64;
+  char *buf = malloc(cap);
+  size_t len = 0;
+  for (int i = 0; len < target_size; ++i) {
+    len += snprintf(buf + len, cap - len, snippet, i);
+  }
+  return buf;
+}
+
+int main(int argc, char **argv) {
+  size_t size_mb = argc > 1 ? strtoul(argv[1], NULL, 10) : 8;
+  int iterations = argc > 2 ? atoi(argv[2]) : 5;
+  if (argc > 3 && !UseScanner(argv[3])) {
+    fprintf(stderr, "Scanner \"%s\" is not available.\n", argv[3]);
+    return 1;
+  }
+
+  char *input = BuildInput(size_mb * 1024 * 1024);
+  size_t input_len = strlen(input);
+
+  // The token array is kept between iterations as it only grows once.
+  Compiler compiler;
+  Compiler *cc = &compiler;
+  InitCompiler(cc);
+  double best = 0;
+  for (int i = 0; i < iterations; ++i) {
+    cc->user_input = input;
+    double start = Now();
+    Tokenize(cc);
+    double elapsed = Now() - start;
+
+    if (i == 0 || elapsed < best) best = elapsed;
+  }
+
+  printf("scanner: %s\n", scanner.name);
+  printf("input: %.1f MB, %d tokens\n", input_len / 1e6, cc->num_tokens);
+  printf("best of %d: %.3f s, %.2f Mtokens/s, %.1f MB/s\n", iterations, best,
+         cc->num_tokens / best / 1e6, input_len / best / 1e6);
+
+  ReleaseCompiler(cc);
+  free(input);
+  return 0;
+}
@@ -0,0 +1,434 @@
+/* Copyright 2022 Keita Morisaki. All rights reserved. */
+/*
+ * Cache of the code generated for functions, kept across runs.
+ *
+ * The code of a function depends only on its tokens and on what its
+ * identifiers refer to outside of it: the types of global variables
+ * and the signatures of functions. Those make the key of the function.
+ * Labels are prefixed with the name of the function, so the code does
+ * not depend on where the function is in the program either.
+ *
+ * Every input has one pack file in the cache directory, named after
+ * the hash of the input name. It's memory-mapped at the start of the
+ * compilation, and rewritten at the end only if any function changed.
+ * A function found in the pack is not parsed beyond its signature.
+ *
+ * Keys are compared byte by byte on a hit, so a hash collision can
+ * not return wrong code. A pack written by another build of jcc
+ * is ignored.
+ *
+ * Pack file:
+ *   "JCCPACK1", hash of the jcc executable (8 bytes),
+ *   number of entries (4 bytes), 0 (4 bytes), then the entries:
+ *   hash (8 bytes), key length (4 bytes), code length (4 bytes),
+ *   key, code, padding to 8 bytes.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "./jcc.h"
+
+#define PACK_MAGIC "JCCPACK1"
+#define PACK_HEADER_SIZE 24
+#define PACK_ENTRY_HEADER_SIZE 16
+
+// Entry of the pack read at the start.
+typedef struct {
+  uint64_t hash;
+  const char *key;
+  uint32_t key_len;
+  const char *code;
+  uint32_t code_len;
+} PackEntry;
+
+struct Cache {
+  char *pack_path;
+
+  char *mapped;       // pack read at the start, or NULL
+  size_t mapped_size;
+  // Open addressing by `hash`. The capacity is 0 or a power of 2.
+  PackEntry *slots;
+  int slots_capacity;
+  int num_pack_entries;
+
+  // Entries of this compilation, to write the new pack.
+  CacheEntry *head;
+  CacheEntry *tail;
+
+  // Key being built
+  char *key;
+  size_t key_len;
+  size_t key_capacity;
+};
+
+#define HASH_INIT 14695981039346656037u
+
+static uint64_t exe_hash;
+static pthread_once_t exe_hash_once = PTHREAD_ONCE_INIT;
+
+static uint64_t HashBytes(uint64_t hash, const void *p, size_t len) {
+  // FNV-1a
+  const unsigned char *bytes = p;
+  for (size_t i = 0; i < len; ++i) {
+    hash ^= bytes[i];
+    hash *= 1099511628211u;
+  }
+  return hash;
+}
+
+// Any change of jcc changes the executable, and so the hash.
+static void HashExecutable() {
+  int fd = open("/proc/self/exe", O_RDONLY);
+  if (fd < 0) return;
+
+  struct stat st;
+  if (!fstat(fd, &st) && st.st_size > 0) {
+    void *exe = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (exe != MAP_FAILED) {
+      exe_hash = HashBytes(HASH_INIT, exe, st.st_size);
+      munmap(exe, st.st_size);
+    }
+  }
+  close(fd);
+}
+
+static uint32_t ReadU32(const char *p) {
+  uint32_t val;
+  memcpy(&val, p, sizeof(val));
+  return val;
+}
+
+static uint64_t ReadU64(const char *p) {
+  uint64_t val;
+  memcpy(&val, p, sizeof(val));
+  return val;
+}
+
+static size_t Align8(size_t size) {
+  return (size + 7) & ~(size_t)7;
+}
+
+static void AddPackEntry(Cache *cache, PackEntry *entry) {
+  uint32_t i = entry->hash & (cache->slots_capacity - 1);
+  while (cache->slots[i].key) i = (i + 1) & (cache->slots_capacity - 1);
+  cache->slots[i] = *entry;
+  ++cache->num_pack_entries;
+}
+
+/*
+ * Maps the pack of the last compilation and indexes its entries.
+ * Leaves the cache empty if there's none, or it's not usable.
+ */
+static void ReadPack(Cache *cache) {
+  int fd = open(cache->pack_path, O_RDONLY);
+  if (fd < 0) return;
+
+  struct stat st;
+  if (fstat(fd, &st) || st.st_size < PACK_HEADER_SIZE) {
+    close(fd);
+    return;
+  }
+  char *pack = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (pack == MAP_FAILED) return;
+  cache->mapped = pack;
+  cache->mapped_size = st.st_size;
+
+  uint32_t num_entries = ReadU32(pack + 16);
+  if (memcmp(pack, PACK_MAGIC, 8) || ReadU64(pack + 8) != exe_hash ||
+      num_entries > st.st_size / PACK_ENTRY_HEADER_SIZE) {
+    return;
+  }
+
+  int capacity = 8;
+  while (capacity < 2 * num_entries) capacity *= 2;
+  cache->slots = calloc(capacity, sizeof(PackEntry));
+  if (!cache->slots) return;
+  cache->slots_capacity = capacity;
+
+  const char *end = pack + st.st_size;
+  const char *p = pack + PACK_HEADER_SIZE;
+  for (uint32_t i = 0; i < num_entries; ++i) {
+    if (end - p < PACK_ENTRY_HEADER_SIZE) break;
+    PackEntry entry;
+    entry.hash = ReadU64(p);
+    entry.key_len = ReadU32(p + 8);
+    entry.code_len = ReadU32(p + 12);
+    p += PACK_ENTRY_HEADER_SIZE;
+
+    size_t size = Align8((size_t)entry.key_len + entry.code_len);
+    if ((size_t)(end - p) < size) break;
+    entry.key = p;
+    entry.code = p + entry.key_len;
+    p += size;
+    AddPackEntry(cache, &entry);
+  }
+}
+
+// Sets up the cache if `cc->cache_dir` is set.
+void OpenCache(Compiler *cc) {
+  pthread_once(&exe_hash_once, HashExecutable);
+  // Without knowing which jcc wrote a pack, it's not safe to use it.
+  if (!cc->cache_dir || !exe_hash) return;
+  // The code cached is assembly.
+  if (cc->output_format != OUTPUT_ASM) return;
+
+  cc->cache = calloc(1, sizeof(Cache));
+  if (!cc->cache) return;
+
+  uint64_t name_hash = HashBytes(HASH_INIT, cc->input_name,
+                                 strlen(cc->input_name));
+  size_t size = strlen(cc->cache_dir) + 1 + 16 + strlen(".jcache") + 1;
+  cc->cache->pack_path = malloc(size);
+  if (!cc->cache->pack_path) {
+    ReleaseCache(cc);
+    return;
+  }
+  snprintf(cc->cache->pack_path, size, "%s/%016llx.jcache", cc->cache_dir,
+           (unsigned long long)name_hash);
+
+  ReadPack(cc->cache);
+}
+
+static void AppendKey(Compiler *cc, const void *p, size_t len) {
+  Cache *cache = cc->cache;
+  if (len > cache->key_capacity - cache->key_len) {
+    size_t capacity = cache->key_capacity ? cache->key_capacity : 4096;
+    while (capacity - cache->key_len < len) capacity *= 2;
+    char *key = realloc(cache->key, capacity);
+    if (!key) {
+      ExitWithError(cc, "Out of memory.");
+    }
+    cache->key = key;
+    cache->key_capacity = capacity;
+  }
+  memcpy(cache->key + cache->key_len, p, len);
+  cache->key_len += len;
+}
+
+static void AppendKeyType(Compiler *cc, Type *ty) {
+  char buf[32];
+  for (; ty; ty = ty->point_to) {
+    switch (ty->kind) {
+      case TY_INT:
+        AppendKey(cc, "i", 1);
+        break;
+      case TY_PTR:
+        AppendKey(cc, "p", 1);
+        break;
+      case TY_ARRAY:
+        AppendKey(cc, buf,
+                  snprintf(buf, sizeof(buf), "a%zu;", ty->array_size));
+        break;
+    }
+  }
+}
+
+// Appends what `ident` refers to outside of the function.
+static void AppendKeyReference(Compiler *cc, Ident *ident) {
+  Node *global = SymbolTableGet(&cc->global_scope.vars, ident);
+  if (global) {
+    AppendKey(cc, "G", 1);
+    AppendKeyType(cc, global->type);
+  }
+
+  Function *func = SymbolTableGet(&cc->functions, ident);
+  if (func) {
+    char buf[16];
+    AppendKey(cc, buf,
+              snprintf(buf, sizeof(buf), "F%d", func->num_parameters));
+    AppendKeyType(cc, func->ret_type);
+  }
+  AppendKey(cc, "", 1);
+}
+
+// Returns the index of the "}" closing the "{" at `open_brace`, or -1.
+static int FindClosingBrace(Compiler *cc, int open_brace) {
+  int depth = 0;
+  for (int i = open_brace; i < cc->num_tokens; ++i) {
+    Token *tok = &cc->tokens[i];
+    if (tok->kind != TK_RESERVED || tok->len != 1) continue;
+
+    if (*tok->str == '{') {
+      ++depth;
+    } else if (*tok->str == '}' && !--depth) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static PackEntry *FindPackEntry(Cache *cache, uint64_t hash,
+                                const char *key, size_t key_len) {
+  if (!cache->num_pack_entries) return NULL;
+
+  uint32_t i = hash & (cache->slots_capacity - 1);
+  for (; cache->slots[i].key; i = (i + 1) & (cache->slots_capacity - 1)) {
+    PackEntry *entry = &cache->slots[i];
+    if (entry->hash == hash && entry->key_len == key_len &&
+        !memcmp(entry->key, key, key_len)) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Looks up the function from the token at `first_token` to the "}"
+ * matching the "{" at `open_brace`. Its signature must be parsed, so
+ * that the function refers to itself correctly. Returns NULL if
+ * the function can't be cached. On a hit, the parser skips to the "}".
+ */
+CacheEntry *LookUpFunction(Compiler *cc, int first_token, int open_brace) {
+  Cache *cache = cc->cache;
+  int close_brace = FindClosingBrace(cc, open_brace);
+  if (close_brace < 0) return NULL;
+
+  cache->key_len = 0;
+  AppendKey(cc, cc->verbose_asm ? "v" : "-", 1);
+  char opt_level = '0' + (cc->opt_level > 0);
+  AppendKey(cc, &opt_level, 1);
+  for (int i = first_token; i <= close_brace; ++i) {
+    Token *tok = &cc->tokens[i];
+    char kind = 'A' + tok->kind;
+    AppendKey(cc, &kind, 1);
+    AppendKey(cc, tok->str, tok->len);
+    AppendKey(cc, "", 1);
+    if (tok->kind == TK_IDENT) AppendKeyReference(cc, tok->ident);
+  }
+
+  CacheEntry *entry = ArenaAlloc(cc, &cc->arena, AR_CACHE, sizeof(CacheEntry));
+  entry->hash = HashBytes(HASH_INIT, cache->key, cache->key_len);
+  entry->key = ArenaAlloc(cc, &cc->arena, AR_CACHE, cache->key_len);
+  memcpy(entry->key, cache->key, cache->key_len);
+  entry->key_len = cache->key_len;
+
+  PackEntry *found = FindPackEntry(cache, entry->hash, entry->key,
+                                   entry->key_len);
+  if (found) {
+    entry->hit = true;
+    entry->code = (char *)found->code;
+    entry->code_len = found->code_len;
+    cc->token_pos = close_brace;
+    ++cc->cache_hits;
+  } else {
+    ++cc->cache_misses;
+  }
+
+  if (cache->tail) {
+    cache->tail->next = entry;
+  } else {
+    cache->head = entry;
+  }
+  cache->tail = entry;
+  return entry;
+}
+
+// Appends the code emitted to `cc->capture`.
+void CaptureCode(Compiler *cc, const char *p, size_t len) {
+  CacheEntry *entry = cc->capture;
+  if (len > entry->code_capacity - entry->code_len) {
+    size_t capacity = entry->code_capacity ? entry->code_capacity : 1024;
+    while (capacity - entry->code_len < len) capacity *= 2;
+    char *code = realloc(entry->code, capacity);
+    if (!code) {
+      ExitWithError(cc, "Out of memory.");
+    }
+    entry->code = code;
+    entry->code_capacity = capacity;
+  }
+  memcpy(entry->code + entry->code_len, p, len);
+  entry->code_len += len;
+}
+
+static bool WriteU32(FILE *out, uint32_t val) {
+  return fwrite(&val, sizeof(val), 1, out) == 1;
+}
+
+static bool WriteU64(FILE *out, uint64_t val) {
+  return fwrite(&val, sizeof(val), 1, out) == 1;
+}
+
+static bool WriteEntries(Cache *cache, FILE *out, uint32_t num_entries) {
+  static const char padding[8];
+  bool ok = fwrite(PACK_MAGIC, 8, 1, out) == 1 &&
+            WriteU64(out, exe_hash) &&
+            WriteU32(out, num_entries) &&
+            WriteU32(out, 0);
+
+  for (CacheEntry *entry = cache->head; ok && entry; entry = entry->next) {
+    size_t size = entry->key_len + entry->code_len;
+    ok = WriteU64(out, entry->hash) &&
+         WriteU32(out, entry->key_len) &&
+         WriteU32(out, entry->code_len) &&
+         fwrite(entry->key, 1, entry->key_len, out) == entry->key_len &&
+         fwrite(entry->code, 1, entry->code_len, out) == entry->code_len &&
+         fwrite(padding, 1, Align8(size) - size, out) == Align8(size) - size;
+  }
+  return ok;
+}
+
+/*
+ * Writes the new pack, unless it would be the same as the old one,
+ * and releases the cache. The pack is replaced by renaming, so
+ * a reader never sees it half-written. Failing to write it isn't
+ * an error, as it only makes the next compilation slower.
+ */
+void CloseCache(Compiler *cc) {
+  Cache *cache = cc->cache;
+  if (!cache) return;
+
+  uint32_t num_entries = 0;
+  for (CacheEntry *entry = cache->head; entry; entry = entry->next) {
+    ++num_entries;
+  }
+  if (!cc->cache_misses && cc->cache_hits == cache->num_pack_entries) {
+    ReleaseCache(cc);
+    return;
+  }
+
+  mkdir(cc->cache_dir, 0777);
+  size_t size = strlen(cache->pack_path) + strlen(".XXXXXX") + 1;
+  char *tmp_path = malloc(size);
+  int fd = -1;
+  if (tmp_path) {
+    snprintf(tmp_path, size, "%s.XXXXXX", cache->pack_path);
+    fd = mkstemp(tmp_path);
+  }
+  FILE *out = fd < 0 ? NULL : fdopen(fd, "w");
+  if (out) {
+    bool ok = WriteEntries(cache, out, num_entries);
+    ok = !fclose(out) && ok;
+    if (!ok || rename(tmp_path, cache->pack_path)) unlink(tmp_path);
+  } else if (fd >= 0) {
+    close(fd);
+    unlink(tmp_path);
+  }
+  free(tmp_path);
+  ReleaseCache(cc);
+}
+
+// Releases the cache without writing anything.
+void ReleaseCache(Compiler *cc) {
+  Cache *cache = cc->cache;
+  if (!cache) return;
+
+  for (CacheEntry *entry = cache->head; entry; entry = entry->next) {
+    if (entry->code_capacity) free(entry->code);
+  }
+  if (cache->mapped) munmap(cache->mapped, cache->mapped_size);
+  free(cache->slots);
+  free(cache->key);
+  free(cache->pack_path);
+  free(cache);
+  cc->cache = NULL;
+  cc->capture = NULL;
+}
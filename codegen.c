@@ -3,9 +3,14 @@
 
 #include "./jcc.h"
 
-int label_num = 0;
-const int label_digit = 5;
-static const char registers[6][4] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
+const Register registers[6] = {RDI, RSI, RDX, RCX, R8, R9};
+
+// Prints `node` as a statement, dropping the value it leaves, if any.
+static void PrintStatement(Compiler *cc, Node *node) {
+  if (PrintAssembly(cc, node)) {
+    Insn1(cc, I_POP, Reg(RAX));
+  }
+}
 
 static bool IsDereferenceable(Node *node) {
   return node->kind == ND_DEREF ||
@@ -15,11 +20,11 @@ static bool IsDereferenceable(Node *node) {
 
 // TODO(k1832): Reconsider if the comment is accurate
 // Push the ADDRESS of node only iff the node is left-valued
-static void PrintAssemblyForLeftVal(Node *node) {
+static void PrintAssemblyForLeftVal(Compiler *cc, Node *node) {
   DBGPRNT;
 
   if (!IsDereferenceable(node)) {
-    ExitWithError("Failed to parse the node as a left-hand-side.\n");
+    ExitWithError(cc, "Failed to parse the node as a left-hand-side.\n");
     return;
   }
 
@@ -34,10 +39,10 @@ static void PrintAssemblyForLeftVal(Node *node) {
      * So this function should prints the assembly that
      * push the value that `a` holds.
      */
-    AddType(node->lhs);
+    AddType(cc, node->lhs);
 
     if (!IsDereferenceable(node->lhs)) {
-      PrintAssembly(node->lhs);
+      PrintAssembly(cc, node->lhs);
       return;
     }
 
@@ -48,7 +53,7 @@ static void PrintAssemblyForLeftVal(Node *node) {
        * which is the address of the `a` itself.
        * So pushing the address of the `a`.
        */
-      PrintAssemblyForLeftVal(node->lhs);
+      PrintAssemblyForLeftVal(cc, node->lhs);
       return;
     }
 
@@ -62,32 +67,31 @@ static void PrintAssemblyForLeftVal(Node *node) {
      * The address of `a` is stored in `tmp` as a value
      * in the example above. So just pushing the value of `tmp`.
      */
-    PrintAssembly(node->lhs);
+    PrintAssembly(cc, node->lhs);
     return;
   }
 
   if (node->kind == ND_LOCAL_VAR) {
     DBGPRNT;
-    printf("  mov rax, rbp\n");
-    printf("  sub rax, %d\n", node->offset);
-    printf("  push rax\n");
+    Insn2(cc, I_MOV, Reg(RAX), Reg(RBP));
+    Insn2(cc, I_SUB, Reg(RAX), Imm(node->offset));
+    Insn1(cc, I_PUSH, Reg(RAX));
     return;
   }
 
   // node->kind == ND_GLBL_VAR
-  printf("  lea rax, %.*s[rip]\n",
-         node->var_name_len, node->var_name);
-  printf("  push rax\n");
+  Insn2(cc, I_LEA, Reg(RAX), Sym(node->var_name));
+  Insn1(cc, I_PUSH, Reg(RAX));
 }
 
 /*
- * Prints assembly that processes `node`.
+ * Generates the instructions that process `node` into `cc->insns`.
  * Returns true if a value is pushed to stack at the end.
  * Otherwise, returns false
  */
-bool PrintAssembly(Node *node) {
+bool PrintAssembly(Compiler *cc, Node *node) {
   if (node == NULL) {
-    ExitWithError("Can not print assembly for NULL.\n");
+    ExitWithError(cc, "Can not print assembly for NULL.\n");
   }
 
   if (node->kind == ND_GLOBAL_VAR_LIST) {
@@ -101,16 +105,21 @@ bool PrintAssembly(Node *node) {
     return false;
   }
 
+  if (node->kind == ND_FUNC_DECLARATION) {
+    DBGPRNT;
+    return false;
+  }
+
   // TODO(k1832): Use Switch-case
   if (node->kind == ND_NUM) {
     DBGPRNT;
-    printf("  push %d\n", node->val);
+    Insn1(cc, I_PUSH, Imm(node->val));
     return true;
   }
 
   if (node->kind == ND_LOCAL_VAR || node->kind == ND_GLBL_VAR) {
     DBGPRNT;
-    PrintAssemblyForLeftVal(node);
+    PrintAssemblyForLeftVal(cc, node);
     DBGPRNT;
 
     if (node->type->kind == TY_ARRAY) {
@@ -118,110 +127,109 @@ bool PrintAssembly(Node *node) {
       return true;
     }
 
-    printf("  pop rax\n");
-    printf("  mov rdi, [rax]\n");
-    printf("  push rdi\n");
+    Insn1(cc, I_POP, Reg(RAX));
+    Insn2(cc, I_MOV, Reg(RDI), Mem(RAX, 0));
+    Insn1(cc, I_PUSH, Reg(RDI));
     return true;
   }
 
   if (node->kind == ND_ASSIGN) {
     DBGPRNT;
     // Push the address of the left value to the stack
-    PrintAssemblyForLeftVal(node->lhs);
+    PrintAssemblyForLeftVal(cc, node->lhs);
     // Push the value of the right-hand-side
-    PrintAssembly(node->rhs);
-    printf("  pop rdi\n");
-    printf("  pop rax\n");
-    printf("  mov [rax], rdi\n");
-    printf("  push rdi\n");
+    PrintAssembly(cc, node->rhs);
+    Insn1(cc, I_POP, Reg(RDI));
+    Insn1(cc, I_POP, Reg(RAX));
+    Insn2(cc, I_MOV, Mem(RAX, 0), Reg(RDI));
+    Insn1(cc, I_PUSH, Reg(RDI));
     return true;
   }
 
   if (node->kind == ND_RETURN) {
     DBGPRNT;
-    PrintAssembly(node->lhs);
-    printf("  pop rax\n");
-    printf("  mov rsp, rbp\n");
-    printf("  pop rbp\n");
+    PrintAssembly(cc, node->lhs);
+    Insn1(cc, I_POP, Reg(RAX));
+    Insn2(cc, I_MOV, Reg(RSP), Reg(RBP));
+    Insn1(cc, I_POP, Reg(RBP));
     // "ret" pops the address stored at the stack top, and jump there.
-    printf("  ret\n");
+    Insn0(cc, I_RET);
     return false;
   }
   if (node->kind == ND_IF) {
     DBGPRNT;
-    int label_for_else_statement = label_num++;
-    int label_for_if_end = label_num++;
-    PrintAssembly(node->condition);
-    printf("  pop rax\n");  // pop condition
-    printf("  cmp rax, 0\n");
+    int label_for_else_statement = cc->label_num++;
+    int label_for_if_end = cc->label_num++;
+    PrintAssembly(cc, node->condition);
+    Insn1(cc, I_POP, Reg(RAX));  // pop condition
+    Insn2(cc, I_CMP, Reg(RAX), Imm(0));
     // if condition is false, skip the if (body) statement
-    printf("  je .L%0*d\n", label_digit, label_for_else_statement);
+    Insn1(cc, I_JE, Label(label_for_else_statement));
 
-    PrintAssembly(node->body_program);
-    printf("  jmp .L%0*d\n", label_digit, label_for_if_end);
+    PrintStatement(cc, node->body_program);
+    Insn1(cc, I_JMP, Label(label_for_if_end));
 
-    printf(".L%0*d:\n", label_digit, label_for_else_statement);
+    Insn1(cc, I_LABEL, Label(label_for_else_statement));
     if (node->else_program) {
-      PrintAssembly(node->else_program);
+      PrintStatement(cc, node->else_program);
     }
 
-    printf(".L%0*d:\n", label_digit, label_for_if_end);
+    Insn1(cc, I_LABEL, Label(label_for_if_end));
     return false;
   }
 
   if (node->kind == ND_WHILE) {
     DBGPRNT;
-    int label_for_while_start = label_num++;
-    int label_for_while_end = label_num++;
-    printf(".L%0*d:\n", label_digit, label_for_while_start);
-    PrintAssembly(node->lhs);
-    printf("  pop rax\n");  // pop condition
-    printf("  cmp rax, 0\n");
+    int label_for_while_start = cc->label_num++;
+    int label_for_while_end = cc->label_num++;
+    Insn1(cc, I_LABEL, Label(label_for_while_start));
+    PrintAssembly(cc, node->lhs);
+    Insn1(cc, I_POP, Reg(RAX));  // pop condition
+    Insn2(cc, I_CMP, Reg(RAX), Imm(0));
     // if condition is false, skip the while statement
-    printf("  je .L%0*d\n", label_digit, label_for_while_end);
+    Insn1(cc, I_JE, Label(label_for_while_end));
 
-    PrintAssembly(node->rhs);
-    printf("  jmp .L%0*d\n", label_digit, label_for_while_start);
+    PrintStatement(cc, node->rhs);
+    Insn1(cc, I_JMP, Label(label_for_while_start));
 
-    printf(".L%0*d:\n", label_digit, label_for_while_end);
+    Insn1(cc, I_LABEL, Label(label_for_while_end));
     return false;
   }
 
   if (node->kind == ND_FOR) {
     DBGPRNT;
-    int label_for_for_start = label_num++;
-    int label_for_for_end = label_num++;
+    int label_for_for_start = cc->label_num++;
+    int label_for_for_end = cc->label_num++;
     if (node->initialization) {
-      PrintAssembly(node->initialization);
+      PrintStatement(cc, node->initialization);
     }
-    printf(".L%0*d:\n", label_digit, label_for_for_start);
+    Insn1(cc, I_LABEL, Label(label_for_for_start));
     if (node->condition == NULL) {
-      printf("  push 1\n");  // HACK: condition is always true.
+      Insn1(cc, I_PUSH, Imm(1));  // HACK: condition is always true.
     } else {
-      PrintAssembly(node->condition);
+      PrintAssembly(cc, node->condition);
     }
-    printf("  pop rax\n");  // pop condition
-    printf("  cmp rax, 0\n");
+    Insn1(cc, I_POP, Reg(RAX));  // pop condition
+    Insn2(cc, I_CMP, Reg(RAX), Imm(0));
     // if condition is false, skip the for statement
-    printf("  je .L%0*d\n", label_digit, label_for_for_end);
+    Insn1(cc, I_JE, Label(label_for_for_end));
 
-    PrintAssembly(node->body_program);
+    PrintStatement(cc, node->body_program);
     if (node->iteration) {
-      PrintAssembly(node->iteration);
+      PrintStatement(cc, node->iteration);
     }
-    printf("  jmp .L%0*d\n", label_digit, label_for_for_start);
+    Insn1(cc, I_JMP, Label(label_for_for_start));
 
-    printf(".L%0*d:\n", label_digit, label_for_for_end);
+    Insn1(cc, I_LABEL, Label(label_for_for_end));
     return false;
   }
 
   if (node->kind == ND_BLOCK) {
     DBGPRNT;
-    node = node->next_in_block;
+    node = node->body_program;
     while (node) {
-      printf("  # LINE starts in block\n");
-      PrintAssembly(node);
-      printf("  pop rax\n");  // pop statement result
+      if (cc->verbose_asm) AddComment(cc, "LINE starts in block");
+      PrintStatement(cc, node);
       node = node->next_in_block;
     }
     return false;
@@ -233,9 +241,9 @@ bool PrintAssembly(Node *node) {
     // Push arguments after the first 6 arguments
     // reversely to stack
     int argv_i = node->argc;
-    Node *argument = node->arg_next;  // head of arg linked-list
+    Node *argument = node->args;  // head of arg linked-list
     while (argv_i > 6) {
-      PrintAssembly(argument);
+      PrintAssembly(cc, argument);
       // leave the result in stack
 
       argument = argument->arg_next;
@@ -243,27 +251,31 @@ bool PrintAssembly(Node *node) {
     }
     while (argv_i) {
       // Transfer results to registers specified by ABI.
-      PrintAssembly(argument);
-      printf("  pop %s\n", registers[argv_i - 1]);
+      PrintAssembly(cc, argument);
+      Insn1(cc, I_POP, Reg(registers[argv_i - 1]));
 
       argument = argument->arg_next;
       --argv_i;
     }
     // TODO(k1832): 16byte allignment?
-    printf("  call %.*s\n", node->func_name_len, node->func_name);
-    printf("  push rax\n");
+    Insn1(cc, I_CALL, Sym(node->func_name));
+    if (node->argc > 6) {
+      // Drop the arguments passed on the stack.
+      Insn2(cc, I_ADD, Reg(RSP), Imm(8 * (node->argc - 6)));
+    }
+    Insn1(cc, I_PUSH, Reg(RAX));
     return true;
   }
 
   if (node->kind == ND_FUNC_DEFINITION) {
     DBGPRNT;
-    printf("%.*s:\n", node->func_name_len, node->func_name);
+    Insn1(cc, I_LABEL, Sym(node->func_name));
     // prologue
-    printf("  push rbp\n");
-    printf("  mov rbp, rsp\n");
-    const int num_variables = 26;
-    const int bytes_per_variable = 8;
-    printf("  sub rsp, %d\n", num_variables * bytes_per_variable);
+    Insn1(cc, I_PUSH, Reg(RBP));
+    Insn2(cc, I_MOV, Reg(RBP), Reg(RSP));
+    // Keep rsp 16-byte aligned.
+    int frame_size = (node->next_offset_in_block + 15) / 16 * 16;
+    Insn2(cc, I_SUB, Reg(RSP), Imm(frame_size));
 
 
     // Transfer argument values into stack frame
@@ -278,43 +290,41 @@ bool PrintAssembly(Node *node) {
     }
 
     while (param_i) {
-      printf("  mov rax, rbp\n");
-      printf("  sub rax, %d\n", param->offset);
-      printf("  mov [rax], %s\n", registers[param_i - 1]);
+      Insn2(cc, I_MOV, Reg(RAX), Reg(RBP));
+      Insn2(cc, I_SUB, Reg(RAX), Imm(param->offset));
+      Insn2(cc, I_MOV, Mem(RAX, 0), Reg(registers[param_i - 1]));
       param = param->param_next;
       --param_i;
     }
 
     node = node->next_in_block;
     while (node) {
-      printf("  # LINE starts in function\n");
-      if (PrintAssembly(node)) {
-        printf("  pop rax\n");
-      }
+      if (cc->verbose_asm) AddComment(cc, "LINE starts in function");
+      PrintStatement(cc, node);
       node = node->next_in_block;
     }
     // epilogue
-    printf("  mov rsp, rbp\n");
-    printf("  pop rbp\n");
+    Insn2(cc, I_MOV, Reg(RSP), Reg(RBP));
+    Insn1(cc, I_POP, Reg(RBP));
     // "ret" pops the address stored at the stack top, and jump there.
-    printf("  ret\n");
+    Insn0(cc, I_RET);
     return false;
   }
 
   if (node->kind == ND_ADDR) {
     DBGPRNT;
-    PrintAssemblyForLeftVal(node->lhs);
+    PrintAssemblyForLeftVal(cc, node->lhs);
     return true;
   }
 
   if (node->kind == ND_DEREF) {
     DBGPRNT;
-    PrintAssembly(node->lhs);
+    PrintAssembly(cc, node->lhs);
     DBGPRNT;
 
-    printf("  pop rax\n");
-    printf("  mov rax, [rax]\n");
-    printf("  push rax\n");
+    Insn1(cc, I_POP, Reg(RAX));
+    Insn2(cc, I_MOV, Reg(RAX), Mem(RAX, 0));
+    Insn1(cc, I_PUSH, Reg(RAX));
     return true;
   }
 
@@ -322,68 +332,68 @@ bool PrintAssembly(Node *node) {
   // Both expressions are evaluated.
   // And the value of this is Expression B
   if (node->kind == ND_COMMA) {
-    if (PrintAssembly(node->lhs)) {
-      printf("  pop rax\n");
+    if (PrintAssembly(cc, node->lhs)) {
+      Insn1(cc, I_POP, Reg(RAX));
     }
 
-    return PrintAssembly(node->rhs);
+    return PrintAssembly(cc, node->rhs);
   }
 
-  PrintAssembly(node->lhs);
-  PrintAssembly(node->rhs);
+  PrintAssembly(cc, node->lhs);
+  PrintAssembly(cc, node->rhs);
 
-  printf("  pop rdi\n");
-  printf("  pop rax\n");
+  Insn1(cc, I_POP, Reg(RDI));
+  Insn1(cc, I_POP, Reg(RAX));
 
   switch (node->kind) {
     case ND_ADD:
       DBGPRNT;
-      printf("  add rax, rdi\n");
+      Insn2(cc, I_ADD, Reg(RAX), Reg(RDI));
       break;
     case ND_SUB:
       DBGPRNT;
-      printf("  sub rax, rdi\n");
+      Insn2(cc, I_SUB, Reg(RAX), Reg(RDI));
       break;
     case ND_MUL:
       DBGPRNT;
-      printf("  imul rax, rdi\n");
+      Insn2(cc, I_IMUL, Reg(RAX), Reg(RDI));
       break;
     case ND_DIV:
       DBGPRNT;
-      printf("  cqo\n");
-      printf("  idiv rdi\n");
+      Insn0(cc, I_CQO);
+      Insn1(cc, I_IDIV, Reg(RDI));
       break;
     case ND_MOD:
       DBGPRNT;
-      printf("  cqo\n");
-      printf("  idiv rdi\n");
-      printf("  mov rax, rdx\n");
+      Insn0(cc, I_CQO);
+      Insn1(cc, I_IDIV, Reg(RDI));
+      Insn2(cc, I_MOV, Reg(RAX), Reg(RDX));
       break;
     case ND_EQ:
       DBGPRNT;
-      printf("  cmp rax, rdi\n");
-      printf("  sete al\n");  // al is the bottom 8 bits of rax
-      printf("  movzb rax, al\n");  // zero-fill top 56 bits
+      Insn2(cc, I_CMP, Reg(RAX), Reg(RDI));
+      Insn1(cc, I_SETE, Reg(RAX));  // al is the bottom 8 bits of rax
+      Insn2(cc, I_MOVZB, Reg(RAX), Reg(RAX));  // zero-fill top 56 bits
       break;
     case ND_LT:
       // rax < rdi
       DBGPRNT;
-      printf("  cmp rax, rdi\n");
-      printf("  setl al\n");
-      printf("  movzb rax, al\n");
+      Insn2(cc, I_CMP, Reg(RAX), Reg(RDI));
+      Insn1(cc, I_SETL, Reg(RAX));
+      Insn2(cc, I_MOVZB, Reg(RAX), Reg(RAX));
       break;
     case ND_NGT:
       // rax <= rdi
       DBGPRNT;
-      printf("  cmp rax, rdi\n");
-      printf("  setle al\n");
-      printf("  movzb rax, al\n");
+      Insn2(cc, I_CMP, Reg(RAX), Reg(RDI));
+      Insn1(cc, I_SETLE, Reg(RAX));
+      Insn2(cc, I_MOVZB, Reg(RAX), Reg(RAX));
       break;
     default:
-      ExitWithError("node->kind %u is not handled in %s",
+      ExitWithError(cc, "node->kind %u is not handled in %s",
                     node->kind, __FUNCTION__);
   }
 
-  printf("  push rax\n");
+  Insn1(cc, I_PUSH, Reg(RAX));
   return true;
 }
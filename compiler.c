@@ -0,0 +1,189 @@
+/* Copyright 2022 Keita Morisaki. All rights reserved. */
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "./jcc.h"
+
+void InitCompiler(Compiler *cc) {
+  *cc = (Compiler){0};
+  cc->input_name = "<command line>";
+  cc->out_fd = STDOUT_FILENO;
+  cc->current_scope = &cc->global_scope;
+}
+
+void CopyOptions(Compiler *dst, const Compiler *src) {
+  dst->verbose_asm = src->verbose_asm;
+  dst->stats_enabled = src->stats_enabled;
+  dst->codegen_threads = src->codegen_threads;
+  dst->cache_dir = src->cache_dir;
+  dst->output_format = src->output_format;
+  dst->opt_level = src->opt_level;
+}
+
+/*
+ * Makes `cc` ready to compile another program. The options and the
+ * memory that the next compilation is likely to need are kept:
+ * the token array, the identifier table, one block of each arena and
+ * the output buffer.
+ */
+void ResetCompiler(Compiler *cc) {
+  ReleaseCache(cc);
+  SymbolTableRelease(&cc->global_scope.vars);
+  SymbolTableRelease(&cc->functions);
+  ArenaReset(&cc->func_arena);
+  ArenaReset(&cc->arena);
+  ReleaseInput(cc);
+
+  cc->num_tokens = 0;
+  if (cc->ident_slots) {
+    memset(cc->ident_slots, 0, cc->ident_slots_capacity * sizeof(Ident *));
+  }
+  cc->num_idents = 0;
+
+  cc->token_pos = 0;
+  cc->current_scope = &cc->global_scope;
+  cc->current_func = NULL;
+  cc->globals = NULL;
+
+  cc->label_num = 0;
+  cc->num_insns = 0;
+  ResetObject(&cc->object);
+  cc->out_fd = STDOUT_FILENO;
+  cc->out_path = NULL;
+  cc->out_is_regular = false;
+  cc->out_completed = false;
+  cc->out_buffer_used = 0;
+
+  memset(cc->phase_wall_ns, 0, sizeof(cc->phase_wall_ns));
+  memset(cc->phase_cpu_ns, 0, sizeof(cc->phase_cpu_ns));
+  cc->phase_depth = 0;
+  cc->cache_hits = 0;
+  cc->cache_misses = 0;
+  cc->folded_nodes = 0;
+  memset(cc->peephole_hits, 0, sizeof(cc->peephole_hits));
+  cc->error_message[0] = '\0';
+}
+
+/*
+ * Compiles `cc->user_input` to the output opened with `EmitOpen` or
+ * `EmitOpenMemory`. The output is left open.
+ */
+void Compile(Compiler *cc) {
+  EnterPhase(cc, PH_TOKENIZE);
+  Tokenize(cc);
+  LeavePhase(cc);
+
+  OpenCache(cc);
+
+  EnterPhase(cc, PH_CODEGEN);
+
+  if (cc->output_format == OUTPUT_ASM) {
+    Emit(cc, ".intel_syntax noprefix\n");
+    Emit(cc, ".globl main\n");
+  }
+
+  // Only the assembly of the items can be put together in any order.
+  if (cc->codegen_threads > 1 && cc->output_format == OUTPUT_ASM) {
+    GenerateInParallel(cc);
+  } else {
+    // Each item is emitted as soon as it's parsed, then its AST is freed.
+    for (int i = 0;; ++i) {
+      EnterPhase(cc, PH_PARSE);
+      Node *item = ParseNextItem(cc);
+      LeavePhase(cc);
+      if (!item) break;
+
+      GenerateItem(cc, item, i);
+    }
+  }
+
+  if (cc->globals && cc->output_format == OUTPUT_ASM) {
+    if (cc->verbose_asm) Emit(cc, "  # global variables\n");
+    Emit(cc, "\n");
+    Emit(cc, ".data\n");
+  }
+  if (cc->globals) {
+    for (Node *var = cc->globals->variable_next; var;
+         var = var->variable_next) {
+      // TODO(k1832): Replace with GetSize
+      int size = 8;
+      if (var->type->array_size) {
+        size *= var->type->array_size;
+      }
+      if (cc->output_format == OUTPUT_ASM) {
+        Emit(cc, "%I:\n", var->var_name);
+        Emit(cc, "  .zero %d\n", size);
+      } else if (cc->output_format == OUTPUT_IR) {
+        Emit(cc, "%I: global %d\n", var->var_name, size);
+      } else {
+        AddBss(cc, var->var_name, size);
+      }
+    }
+  }
+  if (cc->output_format == OUTPUT_OBJECT) WriteObject(cc);
+  LeavePhase(cc);
+
+  CloseCache(cc);
+}
+
+/*
+ * Generates the code of `item`, the `index`th top-level item.
+ * Labels are numbered from 0 in each item, so items can be generated
+ * in any order or at the same time with different `cc`s.
+ */
+void GenerateItem(Compiler *cc, Node *item, int index) {
+  cc->label_func = item->kind == ND_FUNC_DEFINITION ? item->func_name : NULL;
+  cc->label_scope = index;
+  cc->label_num = 0;
+
+  if (cc->verbose_asm && cc->output_format == OUTPUT_ASM) {
+    Emit(cc, "  # programs[%d] starts.\n", index);
+  }
+
+  CacheEntry *entry = item->cache_entry;
+  if (entry && entry->hit) {
+    EmitBytes(cc, entry->code, entry->code_len);
+    return;
+  }
+
+  if (item->kind == ND_FUNC_DEFINITION) FoldFunction(cc, item);
+
+  bool uses_ir = cc->opt_level > 0 || cc->output_format == OUTPUT_IR;
+  if (uses_ir && item->kind == ND_FUNC_DEFINITION) {
+    IRFunction *fn = LowerFunction(cc, item);
+    if (cc->output_format == OUTPUT_IR) {
+      PrintIR(cc, fn);
+      return;
+    }
+    GenerateFromIR(cc, fn);
+  } else if (PrintAssembly(cc, item)) {
+    /*
+     * "pop" if there is any remaining value at the top
+     * to prevent stack overflow
+     */
+    Insn1(cc, I_POP, Reg(RAX));
+  }
+
+  // The code of a function missed in the cache is kept for the cache.
+  cc->capture = entry;
+  FlushInsns(cc);
+  cc->capture = NULL;
+}
+
+// Frees everything `cc` owns. Output isn't closed; see `EmitClose`.
+void ReleaseCompiler(Compiler *cc) {
+  ReleaseCache(cc);
+  SymbolTableRelease(&cc->global_scope.vars);
+  SymbolTableRelease(&cc->functions);
+  ArenaRelease(&cc->func_arena);
+  ArenaRelease(&cc->arena);
+  ReleaseTokens(cc);
+  ReleaseIdents(cc);
+  ReleaseInput(cc);
+  ReleaseInsns(cc);
+  ReleaseObject(&cc->object);
+  free(cc->out_buffer);
+  cc->out_buffer = NULL;
+  cc->out_buffer_capacity = 0;
+}
@@ -0,0 +1,226 @@
+/* Copyright 2022 Keita Morisaki. All rights reserved. */
+/*
+ * Driver compiling many files on a pool of threads.
+ *
+ * Each thread owns one Compiler, reused for every file it compiles,
+ * and takes the next file from a shared atomic index. So a thread that
+ * finished a small file immediately takes another one. Files are taken
+ * from the biggest, so that no big file is started last while the other
+ * threads run out of work.
+ *
+ * An error in a file doesn't stop the others. The errors are printed in
+ * the order of the files once all are done, so the output is the same
+ * whatever the number of threads is.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "./jcc.h"
+
+typedef struct {
+  char *path;
+  char *out_path;
+  off_t size;
+  bool failed;
+  char *error;    // message of the error if `failed`. May be NULL.
+  int cache_hits;
+  int cache_misses;
+  int folded_nodes;
+  int peephole_hits[NUM_PEEPHOLE_RULES];
+} Job;
+
+typedef struct {
+  Job **order;    // from the biggest file
+  int num_jobs;
+  atomic_int next;  // index in `order` of the next job to take
+  const Compiler *options;
+} Pool;
+
+static double Now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Returns "<out_dir>/<base name of path without .c><suffix>".
+static char *OutputPath(const char *out_dir, const char *path,
+                        const char *suffix) {
+  const char *base = strrchr(path, '/');
+  base = base ? base + 1 : path;
+  int base_len = strlen(base) - strlen(".c");
+
+  size_t dir_len = strlen(out_dir);
+  const char *separator = dir_len && out_dir[dir_len - 1] == '/' ? "" : "/";
+
+  size_t size = dir_len + strlen(separator) + base_len + strlen(suffix) + 1;
+  char *out_path = malloc(size);
+  if (!out_path) {
+    fprintf(stderr, "Out of memory.\n");
+    exit(1);
+  }
+  snprintf(out_path, size, "%s%s%.*s%s", out_dir, separator, base_len, base,
+           suffix);
+  return out_path;
+}
+
+static int CompareSizeDesc(const void *a, const void *b) {
+  const Job *job_a = *(Job *const *)a;
+  const Job *job_b = *(Job *const *)b;
+  if (job_a->size != job_b->size) return job_a->size < job_b->size ? 1 : -1;
+  // Keep the order of the command line for the same size.
+  return job_a < job_b ? -1 : job_a > job_b;
+}
+
+static int CompareOutPath(const void *a, const void *b) {
+  return strcmp((*(Job *const *)a)->out_path, (*(Job *const *)b)->out_path);
+}
+
+static void CompileJob(Compiler *cc, Job *job) {
+  ResetCompiler(cc);
+
+  jmp_buf on_error;
+  cc->error_jmp = &on_error;
+  if (setjmp(on_error)) {
+    cc->error_jmp = NULL;
+    EmitDiscard(cc);
+    job->failed = true;
+    job->error = strdup(cc->error_message);
+    return;
+  }
+
+  LoadInput(cc, job->path);
+  EmitOpen(cc, job->out_path);
+  Compile(cc);
+  EmitClose(cc);
+  cc->error_jmp = NULL;
+  job->cache_hits = cc->cache_hits;
+  job->cache_misses = cc->cache_misses;
+  job->folded_nodes = cc->folded_nodes;
+  memcpy(job->peephole_hits, cc->peephole_hits, sizeof(job->peephole_hits));
+}
+
+static void *Worker(void *arg) {
+  Pool *pool = arg;
+
+  Compiler compiler;
+  InitCompiler(&compiler);
+  CopyOptions(&compiler, pool->options);
+  // Files are already compiled in parallel.
+  compiler.stats_enabled = false;
+  compiler.codegen_threads = 1;
+
+  for (;;) {
+    int i = atomic_fetch_add(&pool->next, 1);
+    if (i >= pool->num_jobs) break;
+    CompileJob(&compiler, pool->order[i]);
+  }
+
+  ReleaseCompiler(&compiler);
+  return NULL;
+}
+
+/*
+ * Compiles each of `paths` into "<out_dir>/<name>.s", or ".o" for
+ * objects and ".ir" for the IR, on `num_threads` threads, with the options
+ * set in `options`.
+ * Returns the exit status of jcc.
+ */
+int CompileFiles(char **paths, int num_paths, const char *out_dir,
+                 int num_threads, const Compiler *options) {
+  double start = Now();
+
+  if (num_threads > num_paths) num_threads = num_paths;
+  Job *jobs = calloc(num_paths, sizeof(Job));
+  Job **order = calloc(num_paths, sizeof(Job *));
+  pthread_t *threads = calloc(num_threads, sizeof(pthread_t));
+  if (!jobs || !order || !threads) {
+    fprintf(stderr, "Out of memory.\n");
+    return 1;
+  }
+
+  const char *suffix = options->output_format == OUTPUT_OBJECT ? ".o" :
+                       options->output_format == OUTPUT_IR ? ".ir" : ".s";
+  off_t total_size = 0;
+  for (int i = 0; i < num_paths; ++i) {
+    jobs[i].path = paths[i];
+    jobs[i].out_path = OutputPath(out_dir, paths[i], suffix);
+    // A file that can't be read fails later with a proper message.
+    struct stat st;
+    if (!stat(paths[i], &st)) jobs[i].size = st.st_size;
+    total_size += jobs[i].size;
+    order[i] = &jobs[i];
+  }
+
+  // Two files writing to the same output would race.
+  qsort(order, num_paths, sizeof(Job *), CompareOutPath);
+  for (int i = 1; i < num_paths; ++i) {
+    if (!strcmp(order[i - 1]->out_path, order[i]->out_path)) {
+      fprintf(stderr, "%s and %s are both compiled to %s.\n",
+              order[i - 1]->path, order[i]->path, order[i]->out_path);
+      return 1;
+    }
+  }
+  qsort(order, num_paths, sizeof(Job *), CompareSizeDesc);
+
+  Pool pool = {order, num_paths, 0, options};
+
+  // This thread is one of the workers.
+  int num_started = 0;
+  for (int i = 1; i < num_threads; ++i) {
+    if (pthread_create(&threads[num_started], NULL, Worker, &pool)) break;
+    ++num_started;
+  }
+  Worker(&pool);
+  for (int i = 0; i < num_started; ++i) {
+    pthread_join(threads[i], NULL);
+  }
+
+  int status = 0;
+  int cache_hits = 0;
+  int cache_misses = 0;
+  int folded_nodes = 0;
+  int peephole_hits[NUM_PEEPHOLE_RULES] = {0};
+  for (int i = 0; i < num_paths; ++i) {
+    cache_hits += jobs[i].cache_hits;
+    cache_misses += jobs[i].cache_misses;
+    folded_nodes += jobs[i].folded_nodes;
+    for (int r = 0; r < NUM_PEEPHOLE_RULES; ++r) {
+      peephole_hits[r] += jobs[i].peephole_hits[r];
+    }
+    if (!jobs[i].failed) continue;
+    fputs(jobs[i].error ? jobs[i].error : "Out of memory.\n", stderr);
+    status = 1;
+  }
+
+  if (options->stats_enabled) {
+    double seconds = Now() - start;
+    fprintf(stderr, "{\n");
+    fprintf(stderr, "  \"files\": %d,\n", num_paths);
+    fprintf(stderr, "  \"threads\": %d,\n", num_started + 1);
+    fprintf(stderr, "  \"bytes\": %lld,\n", (long long)total_size);
+    fprintf(stderr, "  \"wall_ms\": %.3f,\n", seconds * 1e3);
+    fprintf(stderr, "  \"mb_per_s\": %.2f,\n", total_size / seconds / 1e6);
+    fprintf(stderr, "  \"files_per_s\": %.1f,\n", num_paths / seconds);
+    fprintf(stderr, "  \"cache\": {\"hits\": %d, \"misses\": %d},\n",
+            cache_hits, cache_misses);
+    fprintf(stderr, "  \"fold\": {\"removed_nodes\": %d},\n", folded_nodes);
+    PrintPeepholeHits(stderr, peephole_hits);
+    fprintf(stderr, "}\n");
+  }
+
+  for (int i = 0; i < num_paths; ++i) {
+    free(jobs[i].out_path);
+    free(jobs[i].error);
+  }
+  free(threads);
+  free(order);
+  free(jobs);
+  return status;
+}
@@ -0,0 +1,186 @@
+/* Copyright 2022 Keita Morisaki. All rights reserved. */
+/*
+ * Writer of `cc->object` as an ELF relocatable object for x86-64,
+ * which the system linker takes like the output of an assembler.
+ *
+ * Layout: ELF header, .text, .symtab, .strtab, .rela.text, .shstrtab
+ * and the section headers. Global variables are in .bss, which takes
+ * no space in the file. The empty .note.GNU-stack tells the linker
+ * that the stack doesn't need to be executable.
+ */
+#include <elf.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./jcc.h"
+
+enum {
+  SH_NULL,
+  SH_TEXT,
+  SH_BSS,
+  SH_NOTE_GNU_STACK,
+  SH_SYMTAB,
+  SH_STRTAB,
+  SH_RELA_TEXT,
+  SH_SHSTRTAB,
+  SH_NUM,
+};
+
+static const char *section_names[SH_NUM] = {
+  "", ".text", ".bss", ".note.GNU-stack", ".symtab", ".strtab", ".rela.text",
+  ".shstrtab",
+};
+
+static size_t Align8(size_t size) {
+  return (size + 7) / 8 * 8;
+}
+
+static void EmitPadding(Compiler *cc, size_t len) {
+  static const char zeros[8];
+  EmitBytes(cc, zeros, len);
+}
+
+static bool IsLocal(ObjectSymbol *sym) {
+  return sym->section != SEC_UNDEF && !sym->global;
+}
+
+static void *Calloc(Compiler *cc, size_t count, size_t size) {
+  void *p = calloc(count ? count : 1, size);
+  if (!p) {
+    ExitWithError(cc, "Out of memory.");
+  }
+  return p;
+}
+
+// Writes the ELF file through `EmitBytes`.
+void WriteObject(Compiler *cc) {
+  Object *obj = &cc->object;
+
+  // Local symbols must come first. 0 is the null symbol.
+  int num_symbols = 1;
+  size_t strtab_size = 1;
+  for (ObjectSymbol *sym = obj->symbols; sym; sym = sym->next) {
+    if (IsLocal(sym)) sym->index = num_symbols++;
+    strtab_size += sym->name->len + 1;
+  }
+  int first_global = num_symbols;
+  for (ObjectSymbol *sym = obj->symbols; sym; sym = sym->next) {
+    if (!IsLocal(sym)) sym->index = num_symbols++;
+  }
+
+  Elf64_Sym *symtab = Calloc(cc, num_symbols, sizeof(Elf64_Sym));
+  char *strtab = Calloc(cc, strtab_size, 1);
+  size_t strtab_used = 1;
+  for (ObjectSymbol *sym = obj->symbols; sym; sym = sym->next) {
+    Elf64_Sym *esym = &symtab[sym->index];
+    esym->st_name = strtab_used;
+    memcpy(strtab + strtab_used, sym->name->str, sym->name->len);
+    strtab_used += sym->name->len + 1;
+
+    int bind = IsLocal(sym) ? STB_LOCAL : STB_GLOBAL;
+    switch (sym->section) {
+      case SEC_UNDEF:
+        esym->st_info = ELF64_ST_INFO(bind, STT_NOTYPE);
+        esym->st_shndx = SHN_UNDEF;
+        break;
+      case SEC_TEXT:
+        esym->st_info = ELF64_ST_INFO(bind, STT_FUNC);
+        esym->st_shndx = SH_TEXT;
+        break;
+      case SEC_BSS:
+        esym->st_info = ELF64_ST_INFO(bind, STT_OBJECT);
+        esym->st_shndx = SH_BSS;
+        break;
+    }
+    esym->st_value = sym->offset;
+    esym->st_size = sym->size;
+  }
+
+  Elf64_Rela *relas = Calloc(cc, obj->num_relocs, sizeof(Elf64_Rela));
+  for (int i = 0; i < obj->num_relocs; ++i) {
+    Relocation *reloc = &obj->relocs[i];
+    int type = reloc->kind == RELOC_PLT32 ? R_X86_64_PLT32 : R_X86_64_PC32;
+    relas[i].r_offset = reloc->offset;
+    relas[i].r_info = ELF64_R_INFO(reloc->symbol->index, type);
+    relas[i].r_addend = reloc->addend;
+  }
+
+  Elf64_Shdr shdrs[SH_NUM] = {0};
+  size_t shstrtab_size = 0;
+  for (int i = 0; i < SH_NUM; ++i) {
+    shdrs[i].sh_name = shstrtab_size;
+    shstrtab_size += strlen(section_names[i]) + 1;
+  }
+
+  size_t offset = sizeof(Elf64_Ehdr);
+  shdrs[SH_TEXT] = (Elf64_Shdr){
+    .sh_name = shdrs[SH_TEXT].sh_name, .sh_type = SHT_PROGBITS,
+    .sh_flags = SHF_ALLOC | SHF_EXECINSTR, .sh_offset = offset,
+    .sh_size = obj->text_len, .sh_addralign = 16,
+  };
+  offset = Align8(offset + obj->text_len);
+  shdrs[SH_BSS] = (Elf64_Shdr){
+    .sh_name = shdrs[SH_BSS].sh_name, .sh_type = SHT_NOBITS,
+    .sh_flags = SHF_ALLOC | SHF_WRITE, .sh_offset = offset,
+    .sh_size = obj->bss_size, .sh_addralign = 8,
+  };
+  shdrs[SH_NOTE_GNU_STACK] = (Elf64_Shdr){
+    .sh_name = shdrs[SH_NOTE_GNU_STACK].sh_name, .sh_type = SHT_PROGBITS,
+    .sh_offset = offset, .sh_addralign = 1,
+  };
+  shdrs[SH_SYMTAB] = (Elf64_Shdr){
+    .sh_name = shdrs[SH_SYMTAB].sh_name, .sh_type = SHT_SYMTAB,
+    .sh_offset = offset, .sh_size = num_symbols * sizeof(Elf64_Sym),
+    .sh_link = SH_STRTAB, .sh_info = first_global, .sh_addralign = 8,
+    .sh_entsize = sizeof(Elf64_Sym),
+  };
+  offset += shdrs[SH_SYMTAB].sh_size;
+  shdrs[SH_STRTAB] = (Elf64_Shdr){
+    .sh_name = shdrs[SH_STRTAB].sh_name, .sh_type = SHT_STRTAB,
+    .sh_offset = offset, .sh_size = strtab_size, .sh_addralign = 1,
+  };
+  offset = Align8(offset + strtab_size);
+  shdrs[SH_RELA_TEXT] = (Elf64_Shdr){
+    .sh_name = shdrs[SH_RELA_TEXT].sh_name, .sh_type = SHT_RELA,
+    .sh_flags = SHF_INFO_LINK, .sh_offset = offset,
+    .sh_size = obj->num_relocs * sizeof(Elf64_Rela), .sh_link = SH_SYMTAB,
+    .sh_info = SH_TEXT, .sh_addralign = 8, .sh_entsize = sizeof(Elf64_Rela),
+  };
+  offset += shdrs[SH_RELA_TEXT].sh_size;
+  shdrs[SH_SHSTRTAB] = (Elf64_Shdr){
+    .sh_name = shdrs[SH_SHSTRTAB].sh_name, .sh_type = SHT_STRTAB,
+    .sh_offset = offset, .sh_size = shstrtab_size, .sh_addralign = 1,
+  };
+  offset = Align8(offset + shstrtab_size);
+
+  Elf64_Ehdr ehdr = {
+    .e_ident = {ELFMAG0, ELFMAG1, ELFMAG2, ELFMAG3, ELFCLASS64, ELFDATA2LSB,
+                EV_CURRENT, ELFOSABI_SYSV},
+    .e_type = ET_REL,
+    .e_machine = EM_X86_64,
+    .e_version = EV_CURRENT,
+    .e_shoff = offset,
+    .e_ehsize = sizeof(Elf64_Ehdr),
+    .e_shentsize = sizeof(Elf64_Shdr),
+    .e_shnum = SH_NUM,
+    .e_shstrndx = SH_SHSTRTAB,
+  };
+
+  EmitBytes(cc, (char *)&ehdr, sizeof(ehdr));
+  EmitBytes(cc, obj->text, obj->text_len);
+  EmitPadding(cc, shdrs[SH_SYMTAB].sh_offset - sizeof(ehdr) - obj->text_len);
+  EmitBytes(cc, (char *)symtab, shdrs[SH_SYMTAB].sh_size);
+  EmitBytes(cc, strtab, strtab_size);
+  EmitPadding(cc, shdrs[SH_RELA_TEXT].sh_offset - shdrs[SH_STRTAB].sh_offset -
+                  strtab_size);
+  EmitBytes(cc, (char *)relas, shdrs[SH_RELA_TEXT].sh_size);
+  for (int i = 0; i < SH_NUM; ++i) {
+    EmitBytes(cc, section_names[i], strlen(section_names[i]) + 1);
+  }
+  EmitPadding(cc, offset - shdrs[SH_SHSTRTAB].sh_offset - shstrtab_size);
+  EmitBytes(cc, (char *)shdrs, sizeof(shdrs));
+
+  free(symtab);
+  free(strtab);
+  free(relas);
+}
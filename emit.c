@@ -0,0 +1,235 @@
+/* Copyright 2022 Keita Morisaki. All rights reserved. */
+/*
+ * Buffered assembly writer.
+ *
+ * The assembly is the only big output of jcc, so it bypasses stdio:
+ * text is copied into a large buffer which is handed to write(2)
+ * only when it's full, and numbers are formatted by hand.
+ *
+ * When the output is memory (see `EmitOpenMemory`), the buffer grows
+ * instead and holds the whole assembly in the end.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "./jcc.h"
+
+#define EMIT_BUFFER_SIZE (1 << 20)
+
+static void WriteAll(Compiler *cc, const char *p, size_t len) {
+  while (len) {
+    ssize_t written = write(cc->out_fd, p, len);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      ExitWithError(cc, "Failed to write assembly: %s", strerror(errno));
+    }
+    p += written;
+    len -= written;
+  }
+}
+
+static void EmitFlush(Compiler *cc) {
+  WriteAll(cc, cc->out_buffer, cc->out_buffer_used);
+  cc->out_buffer_used = 0;
+}
+
+static void GrowOutBuffer(Compiler *cc, size_t min_capacity) {
+  size_t capacity = cc->out_buffer_capacity ? cc->out_buffer_capacity
+                                            : EMIT_BUFFER_SIZE;
+  while (capacity < min_capacity) capacity *= 2;
+
+  char *buffer = realloc(cc->out_buffer, capacity);
+  if (!buffer) {
+    ExitWithError(cc, "Out of memory.");
+  }
+  cc->out_buffer = buffer;
+  cc->out_buffer_capacity = capacity;
+}
+
+void EmitBytes(Compiler *cc, const char *p, size_t len) {
+  if (cc->capture) CaptureCode(cc, p, len);
+
+  if (len > cc->out_buffer_capacity - cc->out_buffer_used) {
+    if (cc->out_fd < 0) {
+      GrowOutBuffer(cc, cc->out_buffer_used + len);
+    } else {
+      EmitFlush(cc);
+      if (len > cc->out_buffer_capacity) {
+        WriteAll(cc, p, len);
+        return;
+      }
+    }
+  }
+  memcpy(cc->out_buffer + cc->out_buffer_used, p, len);
+  cc->out_buffer_used += len;
+}
+
+/*
+ * Returns where `len` bytes can be written directly into the output,
+ * for the callers formatting a lot. They are output by `EmitCommit`.
+ */
+char *EmitReserve(Compiler *cc, size_t len) {
+  if (len > cc->out_buffer_capacity - cc->out_buffer_used) {
+    if (cc->out_fd >= 0) EmitFlush(cc);
+    if (len > cc->out_buffer_capacity - cc->out_buffer_used) {
+      GrowOutBuffer(cc, cc->out_buffer_used + len);
+    }
+  }
+  return cc->out_buffer + cc->out_buffer_used;
+}
+
+// Outputs `len` bytes written at `EmitReserve`.
+void EmitCommit(Compiler *cc, size_t len) {
+  if (cc->capture) {
+    CaptureCode(cc, cc->out_buffer + cc->out_buffer_used, len);
+  }
+  cc->out_buffer_used += len;
+}
+
+// Writes `val` in decimal at `p`, and returns the end.
+char *FormatInt(char *p, long val) {
+  char digits[24];
+  char *end = digits + sizeof(digits);
+  char *start = end;
+
+  unsigned long abs_val = val < 0 ? -(unsigned long)val : (unsigned long)val;
+  do {
+    *--start = '0' + abs_val % 10;
+    abs_val /= 10;
+  } while (abs_val);
+  if (val < 0) *--start = '-';
+
+  memcpy(p, start, end - start);
+  return p + (end - start);
+}
+
+// Prints `val` in decimal.
+void EmitInt(Compiler *cc, long val) {
+  char digits[24];
+  EmitBytes(cc, digits, FormatInt(digits, val) - digits);
+}
+
+/*
+ * Like printf, but understands only what the code generator needs:
+ *   %d  int
+ *   %s  NUL-terminated string
+ *   %I  Ident *
+ *   %L  label number, printed as ".L<function name>_<number>"
+ *       or ".L<cc->label_scope>_<number>" outside of functions
+ *   %%  '%'
+ */
+void Emit(Compiler *cc, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+
+  const char *p = fmt;
+  for (;;) {
+    const char *directive = strchr(p, '%');
+    if (!directive) {
+      EmitBytes(cc, p, strlen(p));
+      break;
+    }
+    EmitBytes(cc, p, directive - p);
+
+    switch (directive[1]) {
+      case 'd':
+        EmitInt(cc, va_arg(ap, int));
+        break;
+      case 's': {
+        const char *str = va_arg(ap, const char *);
+        EmitBytes(cc, str, strlen(str));
+        break;
+      }
+      case 'I': {
+        Ident *ident = va_arg(ap, Ident *);
+        EmitBytes(cc, ident->str, ident->len);
+        break;
+      }
+      case 'L':
+        EmitBytes(cc, ".L", 2);
+        if (cc->label_func) {
+          EmitBytes(cc, cc->label_func->str, cc->label_func->len);
+        } else {
+          EmitInt(cc, cc->label_scope);
+        }
+        EmitBytes(cc, "_", 1);
+        EmitInt(cc, va_arg(ap, int));
+        break;
+      case '%':
+        EmitBytes(cc, "%", 1);
+        break;
+      default:
+        ExitWithError(cc, "Unknown directive \"%%%c\" in Emit.", directive[1]);
+    }
+    p = directive + 2;
+  }
+
+  va_end(ap);
+}
+
+/*
+ * Closes the output file and removes it if it's only half-written
+ * because of an error.
+ */
+void EmitDiscard(Compiler *cc) {
+  if (!cc->out_path || cc->out_completed) return;
+
+  close(cc->out_fd);
+  if (cc->out_is_regular) unlink(cc->out_path);
+  cc->out_path = NULL;
+}
+
+/*
+ * Directs the assembly to the file at `path`, or to stdout
+ * if `path` is NULL.
+ */
+void EmitOpen(Compiler *cc, const char *path) {
+  if (cc->out_buffer_capacity < EMIT_BUFFER_SIZE) {
+    GrowOutBuffer(cc, EMIT_BUFFER_SIZE);
+  }
+  cc->out_buffer_used = 0;
+  cc->out_fd = STDOUT_FILENO;
+  if (!path) return;
+
+  cc->out_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (cc->out_fd < 0) {
+    ExitWithError(cc, "Failed to open %s: %s", path, strerror(errno));
+  }
+  cc->out_path = path;
+  struct stat st;
+  cc->out_is_regular = !fstat(cc->out_fd, &st) && S_ISREG(st.st_mode);
+}
+
+/*
+ * Keeps the assembly in `cc->out_buffer`, `cc->out_buffer_used` bytes
+ * long without NUL. The buffer is reused by the following compilations
+ * with `cc`.
+ */
+void EmitOpenMemory(Compiler *cc) {
+  cc->out_buffer_used = 0;
+  cc->out_fd = -1;
+}
+
+// Writes out whatever is buffered and closes the output.
+void EmitClose(Compiler *cc) {
+  if (cc->out_fd < 0) {
+    cc->out_completed = true;
+    return;
+  }
+
+  EmitFlush(cc);
+  if (cc->out_path && close(cc->out_fd)) {
+    ExitWithError(cc, "Failed to close %s: %s", cc->out_path, strerror(errno));
+  }
+  cc->out_completed = true;
+  free(cc->out_buffer);
+  cc->out_buffer = NULL;
+  cc->out_buffer_capacity = 0;
+}
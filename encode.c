@@ -0,0 +1,384 @@
+/* Copyright 2022 Keita Morisaki. All rights reserved. */
+/*
+ * Encoder of the instructions into x86-64 machine code.
+ *
+ * The code of each item is appended to `cc->object.text`. Jumps are
+ * always encoded with 32-bit displacements, so an instruction is never
+ * encoded twice; they are patched once all the labels of the item are
+ * known. References to symbols become relocations, resolved by the
+ * linker.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "./jcc.h"
+
+#define NO_LABEL ((size_t)-1)
+
+static void Reserve(Compiler *cc, size_t len) {
+  Object *obj = &cc->object;
+  if (len <= obj->text_capacity - obj->text_len) return;
+
+  size_t capacity = obj->text_capacity ? obj->text_capacity : 64 * 1024;
+  while (capacity - obj->text_len < len) capacity *= 2;
+  char *text = realloc(obj->text, capacity);
+  if (!text) {
+    ExitWithError(cc, "Out of memory.");
+  }
+  obj->text = text;
+  obj->text_capacity = capacity;
+}
+
+static void Byte(Compiler *cc, int byte) {
+  Reserve(cc, 1);
+  cc->object.text[cc->object.text_len++] = byte;
+}
+
+static void Int32(Compiler *cc, int val) {
+  Reserve(cc, 4);
+  // x86-64 is little-endian, like the host.
+  memcpy(cc->object.text + cc->object.text_len, &val, 4);
+  cc->object.text_len += 4;
+}
+
+static bool FitsInt8(int val) {
+  return -128 <= val && val <= 127;
+}
+
+static ObjectSymbol *SymbolOf(Compiler *cc, Ident *name) {
+  Object *obj = &cc->object;
+  ObjectSymbol *sym = SymbolTableGet(&obj->symbol_table, name);
+  if (sym) return sym;
+
+  sym = ArenaAlloc(cc, &cc->arena, AR_SYMBOL, sizeof(ObjectSymbol));
+  sym->name = name;
+  SymbolTablePut(cc, &obj->symbol_table, name, sym);
+  if (obj->last_symbol) {
+    obj->last_symbol->next = sym;
+  } else {
+    obj->symbols = sym;
+  }
+  obj->last_symbol = sym;
+  return sym;
+}
+
+static ObjectSymbol *DefineSymbol(Compiler *cc, Ident *name, Section section,
+                                  size_t offset) {
+  ObjectSymbol *sym = SymbolOf(cc, name);
+  if (sym->section != SEC_UNDEF) {
+    ExitWithError(cc, "Symbol \"%.*s\" is defined twice.", name->len,
+                  name->str);
+  }
+  sym->section = section;
+  sym->offset = offset;
+  // Only main is visible to other objects, as in the assembly.
+  sym->global = name->len == 4 && !memcmp(name->str, "main", 4);
+  return sym;
+}
+
+// Relocation of the 4 bytes about to be appended.
+static void AddRelocation(Compiler *cc, RelocKind kind, Ident *name) {
+  Object *obj = &cc->object;
+  if (obj->num_relocs == obj->relocs_capacity) {
+    int capacity = obj->relocs_capacity ? obj->relocs_capacity * 2 : 256;
+    Relocation *relocs = realloc(obj->relocs, capacity * sizeof(Relocation));
+    if (!relocs) {
+      ExitWithError(cc, "Out of memory.");
+    }
+    obj->relocs = relocs;
+    obj->relocs_capacity = capacity;
+  }
+  // The displacement is relative to the end of the instruction, which is
+  // where these 4 bytes end in every instruction encoded.
+  obj->relocs[obj->num_relocs++] =
+      (Relocation){obj->text_len, kind, SymbolOf(cc, name), -4};
+}
+
+// 32-bit displacement to `label`, patched at the end of the item.
+static void LabelDisplacement(Compiler *cc, int label) {
+  Object *obj = &cc->object;
+  if (obj->num_fixups == obj->fixups_capacity) {
+    int capacity = obj->fixups_capacity ? obj->fixups_capacity * 2 : 64;
+    LabelFixup *fixups = realloc(obj->fixups, capacity * sizeof(LabelFixup));
+    if (!fixups) {
+      ExitWithError(cc, "Out of memory.");
+    }
+    obj->fixups = fixups;
+    obj->fixups_capacity = capacity;
+  }
+  obj->fixups[obj->num_fixups++] = (LabelFixup){obj->text_len, label};
+  Int32(cc, 0);
+}
+
+/*
+ * REX prefix. `w` selects 64-bit operands, and the high bits of `reg` and
+ * `rm` extend the fields of ModRM. Without any of them, the prefix is
+ * omitted unless `force`d.
+ */
+static void Rex(Compiler *cc, bool w, int reg, int rm, bool force) {
+  int rex = 0x40 | w << 3 | (reg >> 3) << 2 | rm >> 3;
+  if (rex != 0x40 || force) Byte(cc, rex);
+}
+
+static int RmRegister(Operand *rm) {
+  return rm->kind == OP_REG || rm->kind == OP_MEM ? rm->reg : 0;
+}
+
+// ModRM (and SIB and displacement) of `reg` and the register or memory `rm`.
+static void ModRM(Compiler *cc, int reg, Operand *rm) {
+  reg &= 7;
+  if (rm->kind == OP_REG) {
+    Byte(cc, 0xC0 | reg << 3 | (rm->reg & 7));
+    return;
+  }
+
+  if (rm->kind == OP_SYM) {
+    Byte(cc, reg << 3 | 5);   // [rip + disp32]
+    AddRelocation(cc, RELOC_PC32, rm->sym);
+    Int32(cc, 0);
+    return;
+  }
+
+  int base = rm->reg & 7;
+  int disp = rm->imm;
+  // [rbp] and [r13] can only be written with a displacement.
+  int mod = !disp && base != RBP ? 0 : FitsInt8(disp) ? 1 : 2;
+  Byte(cc, mod << 6 | reg << 3 | base);
+  // [rsp] and [r12] need SIB.
+  if (base == RSP) Byte(cc, 0x24);
+  if (mod == 1) {
+    Byte(cc, disp);
+  } else if (mod == 2) {
+    Int32(cc, disp);
+  }
+}
+
+// "<opcode> reg, rm" on 64-bit operands. `opcode` is up to 2 bytes.
+static void EncodeRM(Compiler *cc, int opcode, int reg, Operand *rm) {
+  Rex(cc, true, reg, RmRegister(rm), false);
+  if (opcode > 0xFF) Byte(cc, opcode >> 8);
+  Byte(cc, opcode & 0xFF);
+  ModRM(cc, reg, rm);
+}
+
+// Opcode extension and opcodes of add, sub and cmp.
+static void EncodeArithmetic(Compiler *cc, Insn *insn, int extension,
+                             int opcode_rm_reg, int opcode_reg_rm) {
+  if (insn->src.kind == OP_IMM) {
+    int imm = insn->src.imm;
+    EncodeRM(cc, FitsInt8(imm) ? 0x83 : 0x81, extension, &insn->dst);
+    if (FitsInt8(imm)) {
+      Byte(cc, imm);
+    } else {
+      Int32(cc, imm);
+    }
+  } else if (insn->src.kind == OP_REG) {
+    EncodeRM(cc, opcode_rm_reg, insn->src.reg, &insn->dst);
+  } else {
+    EncodeRM(cc, opcode_reg_rm, insn->dst.reg, &insn->src);
+  }
+}
+
+// Condition codes of jcc and setcc
+static int ConditionCode(InsnKind kind) {
+  switch (kind) {
+    case I_JE:
+    case I_SETE:
+      return 0x4;
+    case I_JNE:
+    case I_SETNE:
+      return 0x5;
+    case I_JL:
+    case I_SETL:
+      return 0xC;
+    case I_JGE:
+      return 0xD;
+    case I_JLE:
+    case I_SETLE:
+      return 0xE;
+    case I_JG:
+      return 0xF;
+    default:
+      return -1;
+  }
+}
+
+static void EncodeInsn(Compiler *cc, Insn *insn) {
+  Operand *dst = &insn->dst;
+  Operand *src = &insn->src;
+
+  switch (insn->kind) {
+    case I_MOV:
+      if (src->kind == OP_IMM) {
+        EncodeRM(cc, 0xC7, 0, dst);
+        Int32(cc, src->imm);
+      } else if (src->kind == OP_REG) {
+        EncodeRM(cc, 0x89, src->reg, dst);
+      } else {
+        EncodeRM(cc, 0x8B, dst->reg, src);
+      }
+      return;
+    case I_MOVZB:
+      // REX.W is always there, so the low bytes of rsp to rdi are reachable.
+      EncodeRM(cc, 0x0FB6, dst->reg, src);
+      return;
+    case I_LEA:
+      EncodeRM(cc, 0x8D, dst->reg, src);
+      return;
+    case I_PUSH:
+      if (dst->kind == OP_IMM) {
+        if (FitsInt8(dst->imm)) {
+          Byte(cc, 0x6A);
+          Byte(cc, dst->imm);
+        } else {
+          Byte(cc, 0x68);
+          Int32(cc, dst->imm);
+        }
+      } else {
+        Rex(cc, false, 0, dst->reg, false);
+        Byte(cc, 0x50 | (dst->reg & 7));
+      }
+      return;
+    case I_POP:
+      Rex(cc, false, 0, dst->reg, false);
+      Byte(cc, 0x58 | (dst->reg & 7));
+      return;
+    case I_ADD:
+      EncodeArithmetic(cc, insn, 0, 0x01, 0x03);
+      return;
+    case I_SUB:
+      EncodeArithmetic(cc, insn, 5, 0x29, 0x2B);
+      return;
+    case I_CMP:
+      EncodeArithmetic(cc, insn, 7, 0x39, 0x3B);
+      return;
+    case I_IMUL:
+      if (src->kind == OP_IMM) {
+        // imul dst, dst, imm
+        EncodeRM(cc, FitsInt8(src->imm) ? 0x6B : 0x69, dst->reg, dst);
+        if (FitsInt8(src->imm)) {
+          Byte(cc, src->imm);
+        } else {
+          Int32(cc, src->imm);
+        }
+      } else {
+        EncodeRM(cc, 0x0FAF, dst->reg, src);
+      }
+      return;
+    case I_CQO:
+      Byte(cc, 0x48);
+      Byte(cc, 0x99);
+      return;
+    case I_IDIV:
+      EncodeRM(cc, 0xF7, 7, dst);
+      return;
+    case I_SETE:
+    case I_SETNE:
+    case I_SETL:
+    case I_SETLE:
+      // Without REX, 4 to 7 are ah, ch, dh and bh.
+      Rex(cc, false, 0, dst->reg, RSP <= dst->reg && dst->reg <= RDI);
+      Byte(cc, 0x0F);
+      Byte(cc, 0x90 | ConditionCode(insn->kind));
+      ModRM(cc, 0, dst);
+      return;
+    case I_JMP:
+      Byte(cc, 0xE9);
+      LabelDisplacement(cc, dst->imm);
+      return;
+    case I_JE:
+    case I_JNE:
+    case I_JL:
+    case I_JLE:
+    case I_JGE:
+    case I_JG:
+      Byte(cc, 0x0F);
+      Byte(cc, 0x80 | ConditionCode(insn->kind));
+      LabelDisplacement(cc, dst->imm);
+      return;
+    case I_CALL:
+      Byte(cc, 0xE8);
+      AddRelocation(cc, RELOC_PLT32, dst->sym);
+      Int32(cc, 0);
+      return;
+    case I_RET:
+      Byte(cc, 0xC3);
+      return;
+    case I_LABEL:
+      if (dst->kind == OP_SYM) {
+        DefineSymbol(cc, dst->sym, SEC_TEXT, cc->object.text_len);
+      } else {
+        cc->object.label_offsets[dst->imm] = cc->object.text_len;
+      }
+      return;
+    case I_COMMENT:
+    case I_NUM_KINDS:
+      return;
+  }
+}
+
+// Encodes the instructions of the item generated into the object.
+void EncodeInsns(Compiler *cc) {
+  Object *obj = &cc->object;
+  if (obj->label_offsets_capacity < cc->label_num) {
+    size_t *offsets = realloc(obj->label_offsets,
+                              cc->label_num * sizeof(size_t));
+    if (!offsets) {
+      ExitWithError(cc, "Out of memory.");
+    }
+    obj->label_offsets = offsets;
+    obj->label_offsets_capacity = cc->label_num;
+  }
+  for (int i = 0; i < cc->label_num; ++i) {
+    obj->label_offsets[i] = NO_LABEL;
+  }
+
+  ObjectSymbol *func = NULL;
+  for (int i = 0; i < cc->num_insns; ++i) {
+    Insn *insn = &cc->insns[i];
+    EncodeInsn(cc, insn);
+    if (insn->kind == I_LABEL && insn->dst.kind == OP_SYM) {
+      func = SymbolOf(cc, insn->dst.sym);
+    }
+  }
+  if (func) func->size = obj->text_len - func->offset;
+
+  for (int i = 0; i < obj->num_fixups; ++i) {
+    LabelFixup *fixup = &obj->fixups[i];
+    size_t target = obj->label_offsets[fixup->label];
+    if (target == NO_LABEL) {
+      ExitWithError(cc, "Label %d is used but not defined.", fixup->label);
+    }
+    int disp = target - (fixup->offset + 4);
+    memcpy(obj->text + fixup->offset, &disp, 4);
+  }
+  obj->num_fixups = 0;
+}
+
+// Reserves `size` zero bytes for the global variable `name`.
+void AddBss(Compiler *cc, Ident *name, int size) {
+  Object *obj = &cc->object;
+  obj->bss_size = (obj->bss_size + 7) / 8 * 8;
+  DefineSymbol(cc, name, SEC_BSS, obj->bss_size)->size = size;
+  obj->bss_size += size;
+}
+
+// Empties `obj`, keeping its buffers. The symbols are in the arena.
+void ResetObject(Object *obj) {
+  obj->text_len = 0;
+  obj->bss_size = 0;
+  obj->symbols = NULL;
+  obj->last_symbol = NULL;
+  SymbolTableRelease(&obj->symbol_table);
+  obj->num_relocs = 0;
+  obj->num_fixups = 0;
+}
+
+void ReleaseObject(Object *obj) {
+  ResetObject(obj);
+  free(obj->text);
+  free(obj->relocs);
+  free(obj->label_offsets);
+  free(obj->fixups);
+  *obj = (Object){0};
+}
@@ -0,0 +1,260 @@
+/* Copyright 2022 Keita Morisaki. All rights reserved. */
+/*
+ * Constant folding and algebraic simplification of the typed AST of
+ * a function, before its code is generated.
+ *
+ * The parser leaves a lot to fold: "-x" is "0 - x", "p + 2" is
+ * "p + 2 * 8", "sizeof x" is a constant and "i++" is "(i += 1) - 1".
+ * This pass rewrites
+ *
+ *   - operations on constants, e.g. "2 * 3 + 4" to 10,
+ *   - identities, e.g. "x + 0", "x * 1" and "x / 1" to x,
+ *   - chains of constants, e.g. "(x + 1) - 3" to "x + -2",
+ *   - operations whose value is dropped, e.g. "i++;" to "i += 1;".
+ *
+ * Values are computed in 64 bits like the generated code, and only
+ * folded if the result fits in `val` of a node. A division by 0 is
+ * left to happen at run time.
+ *
+ * Every rewrite removes an operation and one of its operands, and
+ * keeps the rest of the nodes in place.
+ */
+#include <limits.h>
+#include <stdint.h>
+
+#include "./jcc.h"
+
+static Node *Fold(Compiler *cc, Node *node, bool dropped);
+
+static bool IsNum(Node *node) {
+  return node->kind == ND_NUM;
+}
+
+static Node *Removed(Compiler *cc, Node *kept) {
+  cc->folded_nodes += 2;
+  return kept;
+}
+
+/*
+ * Computes "a `kind` b" into `*result`. Returns false if it can't be
+ * folded.
+ */
+static bool Compute(NodeKind kind, int64_t a, int64_t b, int64_t *result) {
+  switch (kind) {
+    case ND_ADD:
+      *result = a + b;
+      break;
+    case ND_SUB:
+      *result = a - b;
+      break;
+    case ND_MUL:
+      *result = a * b;
+      break;
+    case ND_DIV:
+      if (!b) return false;
+      *result = a / b;
+      break;
+    case ND_MOD:
+      if (!b) return false;
+      *result = a % b;
+      break;
+    case ND_EQ:
+      *result = a == b;
+      break;
+    case ND_NEQ:
+      *result = a != b;
+      break;
+    case ND_LT:
+      *result = a < b;
+      break;
+    case ND_NGT:
+      *result = a <= b;
+      break;
+    default:
+      return false;
+  }
+  return INT_MIN <= *result && *result <= INT_MAX;
+}
+
+static bool IsCommutative(NodeKind kind) {
+  return kind == ND_ADD || kind == ND_MUL || kind == ND_EQ || kind == ND_NEQ;
+}
+
+// Division is left out as it can trap.
+static bool HasNoEffect(NodeKind kind) {
+  return kind != ND_DIV && kind != ND_MOD;
+}
+
+static Node *FoldBinary(Compiler *cc, Node *node, bool dropped) {
+  node->rhs = Fold(cc, node->rhs, false);
+  // Only the operand with effects is kept if the value isn't used.
+  if (dropped && IsNum(node->rhs) && HasNoEffect(node->kind)) {
+    return Removed(cc, Fold(cc, node->lhs, true));
+  }
+  node->lhs = Fold(cc, node->lhs, false);
+
+  Node *lhs = node->lhs;
+  Node *rhs = node->rhs;
+  int64_t val;
+  if (IsNum(lhs) && IsNum(rhs)) {
+    if (!Compute(node->kind, lhs->val, rhs->val, &val)) return node;
+    lhs->val = val;
+    return Removed(cc, lhs);
+  }
+
+  // A constant goes to the right, e.g. "2 * x" to "x * 2".
+  if (IsNum(lhs) && IsCommutative(node->kind) &&
+      rhs->type->kind == TY_INT) {
+    node->lhs = rhs;
+    node->rhs = lhs;
+    lhs = node->lhs;
+    rhs = node->rhs;
+  }
+  if (!IsNum(rhs)) return node;
+
+  // "x - c" is "x + -c", so that chains of + and - are folded alike.
+  if (node->kind == ND_SUB && rhs->val != INT_MIN) {
+    node->kind = ND_ADD;
+    rhs->val = -rhs->val;
+  }
+
+  // "(x + 1) + 2" to "x + 3", and "(x * 2) * 3" to "x * 6"
+  if ((node->kind == ND_ADD || node->kind == ND_MUL) &&
+      lhs->kind == node->kind && IsNum(lhs->rhs) &&
+      Compute(node->kind, lhs->rhs->val, rhs->val, &val)) {
+    lhs->rhs->val = val;
+    node = Removed(cc, lhs);
+    rhs = node->rhs;
+    lhs = node->lhs;
+  }
+
+  bool is_identity = node->kind == ND_ADD ? rhs->val == 0 :
+                     node->kind == ND_MUL || node->kind == ND_DIV ?
+                     rhs->val == 1 : false;
+  return is_identity ? Removed(cc, lhs) : node;
+}
+
+/*
+ * Returns `node` folded, or what replaces it. `dropped` is true if its
+ * value isn't used.
+ */
+static Node *Fold(Compiler *cc, Node *node, bool dropped) {
+  if (!node) return NULL;
+
+  switch (node->kind) {
+    case ND_ADD:
+    case ND_SUB:
+    case ND_MUL:
+    case ND_DIV:
+    case ND_MOD:
+    case ND_EQ:
+    case ND_NEQ:
+    case ND_LT:
+    case ND_NGT:
+      return FoldBinary(cc, node, dropped);
+    case ND_COMMA:
+      node->lhs = Fold(cc, node->lhs, true);
+      node->rhs = Fold(cc, node->rhs, dropped);
+      return node;
+    case ND_FUNC_CALL:
+      for (Node **arg = &node->args; *arg; arg = &(*arg)->arg_next) {
+        Node *next = (*arg)->arg_next;
+        *arg = Fold(cc, *arg, false);
+        (*arg)->arg_next = next;
+      }
+      return node;
+    default:
+      node->lhs = Fold(cc, node->lhs, false);
+      node->rhs = Fold(cc, node->rhs, false);
+      return node;
+  }
+}
+
+static Node *FoldStatements(Compiler *cc, Node *first, bool dropped);
+
+static Node *FoldStatement(Compiler *cc, Node *node, bool dropped) {
+  if (!node) return NULL;
+
+  switch (node->kind) {
+    case ND_IF:
+      node->condition = Fold(cc, node->condition, false);
+      node->body_program = FoldStatement(cc, node->body_program, dropped);
+      if (node->else_program) {
+        node->else_program = FoldStatement(cc, node->else_program, dropped);
+      }
+      return node;
+    // The condition is evaluated after the body, and after the
+    // initialization and the iteration of "for".
+    case ND_WHILE:
+      node->lhs = Fold(cc, node->lhs, false);
+      node->rhs = FoldStatement(cc, node->rhs, true);
+      return node;
+    case ND_FOR:
+      node->initialization = Fold(cc, node->initialization, true);
+      node->condition = Fold(cc, node->condition, false);
+      node->iteration = Fold(cc, node->iteration, true);
+      node->body_program = FoldStatement(cc, node->body_program, true);
+      return node;
+    case ND_BLOCK:
+      node->body_program = FoldStatements(cc, node->body_program, dropped);
+      return node;
+    case ND_RETURN:
+      node->lhs = Fold(cc, node->lhs, false);
+      return node;
+    case ND_VAR_DCLR:
+    case ND_FUNC_DECLARATION:
+      return node;
+    default:
+      return Fold(cc, node, dropped);
+  }
+}
+
+// Expressions and "return" leave the value a function running to its
+// end returns.
+static bool LeavesValue(Node *stmt) {
+  switch (stmt->kind) {
+    case ND_IF:
+    case ND_WHILE:
+    case ND_FOR:
+    case ND_BLOCK:
+    case ND_VAR_DCLR:
+    case ND_FUNC_DECLARATION:
+      return false;
+    default:
+      return true;
+  }
+}
+
+/*
+ * Folds the statements from `first`, and returns the first of them.
+ * A function running to its end returns the value of its last
+ * expression, so only the values before the last one are dropped,
+ * unless `dropped`.
+ */
+static Node *FoldStatements(Compiler *cc, Node *first, bool dropped) {
+  Node *last_value = NULL;
+  for (Node *stmt = first; stmt; stmt = stmt->next_in_block) {
+    if (LeavesValue(stmt)) last_value = stmt;
+  }
+
+  bool before_last = last_value != NULL;
+  Node **link = &first;
+  while (*link) {
+    Node *stmt = *link;
+    Node *next = stmt->next_in_block;
+    if (stmt == last_value) before_last = false;
+    *link = FoldStatement(cc, stmt, dropped || before_last);
+    (*link)->next_in_block = next;
+    link = &(*link)->next_in_block;
+  }
+  return first;
+}
+
+// Folds the body of the function definition `func` in place.
+void FoldFunction(Compiler *cc, Node *func) {
+  AddType(cc, func);
+
+  EnterPhase(cc, PH_FOLD);
+  func->next_in_block = FoldStatements(cc, func->next_in_block, false);
+  LeavePhase(cc);
+}
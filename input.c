@@ -0,0 +1,143 @@
+/* Copyright 2022 Keita Morisaki. All rights reserved. */
+/*
+ * Loading of the program text.
+ *
+ * Tokens point into the text, so it must stay in memory until
+ * the compilation ends. The text is always followed by a NUL,
+ * and reading a few bytes past the NUL doesn't fault.
+ */
+// MAP_ANONYMOUS is not in POSIX.
+#define _DEFAULT_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "./jcc.h"
+
+#define STDIN_CHUNK_SIZE (1 << 20)
+
+/*
+ * Maps the file at `path` read-only.
+ *
+ * An anonymous zero-filled region one byte longer than the file is
+ * reserved first and the file is mapped over its beginning, so the
+ * text is NUL-terminated even if its size is a multiple of the page
+ * size. Nothing is copied.
+ */
+static char *MapFile(Compiler *cc, char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    ExitWithError(cc, "Failed to open %s: %s", path, strerror(errno));
+  }
+
+  // errno is saved before close and munmap, which can change it.
+  struct stat st;
+  if (fstat(fd, &st)) {
+    int err = errno;
+    close(fd);
+    ExitWithError(cc, "Failed to stat %s: %s", path, strerror(err));
+  }
+  size_t size = st.st_size;
+
+  long page_size = sysconf(_SC_PAGESIZE);
+  cc->mapped_size = (size + 1 + page_size - 1) / page_size * page_size;
+  char *text = mmap(NULL, cc->mapped_size, PROT_READ,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (text == MAP_FAILED) {
+    int err = errno;
+    close(fd);
+    ExitWithError(cc, "Failed to map %s: %s", path, strerror(err));
+  }
+
+  if (size && mmap(text, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0)
+              == MAP_FAILED) {
+    int err = errno;
+    close(fd);
+    munmap(text, cc->mapped_size);
+    ExitWithError(cc, "Failed to map %s: %s", path, strerror(err));
+  }
+
+  close(fd);
+  return text;
+}
+
+// Reads the whole stdin in large chunks.
+static char *ReadStdin(Compiler *cc) {
+  size_t capacity = STDIN_CHUNK_SIZE;
+  size_t size = 0;
+  char *text = malloc(capacity);
+  if (!text) {
+    ExitWithError(cc, "Out of memory.");
+  }
+
+  for (;;) {
+    // Leave room for the NUL and a few bytes of padding for the scanners.
+    if (capacity - size < STDIN_CHUNK_SIZE + 64) {
+      capacity *= 2;
+      char *grown = realloc(text, capacity);
+      if (!grown) {
+        free(text);
+        ExitWithError(cc, "Out of memory.");
+      }
+      text = grown;
+    }
+
+    ssize_t len = read(STDIN_FILENO, text + size, STDIN_CHUNK_SIZE);
+    if (len < 0) {
+      if (errno == EINTR) continue;
+      int err = errno;
+      free(text);
+      ExitWithError(cc, "Failed to read stdin: %s", strerror(err));
+    }
+    if (len == 0) break;
+    size += len;
+  }
+
+  memset(text + size, 0, 64);
+  return text;
+}
+
+/*
+ * Sets `cc->user_input` from a command line argument:
+ *   "-"         read stdin
+ *   "<path>.c"  map the file
+ *   otherwise   the argument itself is the program
+ */
+void LoadInput(Compiler *cc, char *arg) {
+  if (!strcmp(arg, "-")) {
+    cc->input_name = "<stdin>";
+    cc->input_kind = INPUT_MALLOC;
+    cc->user_input = ReadStdin(cc);
+    return;
+  }
+
+  if (EndsWith(arg, ".c")) {
+    cc->input_name = arg;
+    cc->input_kind = INPUT_MMAP;
+    cc->user_input = MapFile(cc, arg);
+    return;
+  }
+
+  cc->input_kind = INPUT_BORROWED;
+  cc->user_input = arg;
+}
+
+void ReleaseInput(Compiler *cc) {
+  switch (cc->input_kind) {
+    case INPUT_MMAP:
+      munmap(cc->user_input, cc->mapped_size);
+      break;
+    case INPUT_MALLOC:
+      free(cc->user_input);
+      break;
+    case INPUT_BORROWED:
+      break;
+  }
+  cc->user_input = NULL;
+  cc->input_kind = INPUT_BORROWED;
+}
@@ -0,0 +1,206 @@
+/* Copyright 2022 Keita Morisaki. All rights reserved. */
+/*
+ * List of the instructions of the item being generated.
+ *
+ * The code generator appends instructions to `cc->insns`, and
+ * `FlushInsns` hands them to the output at the end of each item,
+ * after the peephole optimization (peephole.c): printed as assembly,
+ * or encoded into the object to write or run.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "./jcc.h"
+
+static const char *insn_names[I_NUM_KINDS] = {
+  "mov", "movzb", "lea", "push", "pop", "add", "sub", "imul", "cqo", "idiv",
+  "cmp", "sete", "setne", "setl", "setle", "jmp", "je", "jne", "jl", "jle",
+  "jge", "jg", "call", "ret", "", "",
+};
+
+static const char *reg_names[16] = {
+  "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+  "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15",
+};
+
+// Low bytes of the registers
+static const char *reg8_names[16] = {
+  "al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil",
+  "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b",
+};
+
+Operand Reg(Register reg) {
+  return (Operand){.kind = OP_REG, .reg = reg};
+}
+
+Operand Imm(int val) {
+  return (Operand){.kind = OP_IMM, .imm = val};
+}
+
+Operand Mem(Register base, int disp) {
+  return (Operand){.kind = OP_MEM, .reg = base, .imm = disp};
+}
+
+Operand Sym(Ident *sym) {
+  return (Operand){.kind = OP_SYM, .sym = sym};
+}
+
+Operand Label(int label) {
+  return (Operand){.kind = OP_LABEL, .imm = label};
+}
+
+static Insn *NewInsn(Compiler *cc, InsnKind kind) {
+  if (cc->num_insns == cc->insns_capacity) {
+    int capacity = cc->insns_capacity ? cc->insns_capacity * 2 : 256;
+    Insn *insns = realloc(cc->insns, capacity * sizeof(Insn));
+    if (!insns) {
+      ExitWithError(cc, "Out of memory.");
+    }
+    cc->insns = insns;
+    cc->insns_capacity = capacity;
+  }
+  Insn *insn = &cc->insns[cc->num_insns++];
+  *insn = (Insn){.kind = kind};
+  return insn;
+}
+
+void Insn0(Compiler *cc, InsnKind kind) {
+  NewInsn(cc, kind);
+}
+
+void Insn1(Compiler *cc, InsnKind kind, Operand dst) {
+  NewInsn(cc, kind)->dst = dst;
+}
+
+void Insn2(Compiler *cc, InsnKind kind, Operand dst, Operand src) {
+  Insn *insn = NewInsn(cc, kind);
+  insn->dst = dst;
+  insn->src = src;
+}
+
+void AddComment(Compiler *cc, const char *comment) {
+  NewInsn(cc, I_COMMENT)->comment = comment;
+}
+
+// Comment telling where in jcc the following code comes from.
+void AddSourceComment(Compiler *cc, const char *file, int line,
+                      const char *func) {
+  Insn *insn = NewInsn(cc, I_COMMENT);
+  insn->comment = file;
+  insn->comment_func = func;
+  insn->comment_line = line;
+}
+
+static char *Append(char *p, const char *str, size_t len) {
+  memcpy(p, str, len);
+  return p + len;
+}
+
+static char *AppendString(char *p, const char *str) {
+  return Append(p, str, strlen(str));
+}
+
+// Every instruction is printed, so it's formatted without `Emit`.
+static char *AppendOperand(Compiler *cc, char *p, Insn *insn, Operand *op) {
+  switch (op->kind) {
+    case OP_NONE:
+      break;
+    case OP_REG:
+      if ((insn->kind >= I_SETE && insn->kind <= I_SETLE) ||
+          (insn->kind == I_MOVZB && op == &insn->src)) {
+        p = AppendString(p, reg8_names[op->reg]);
+      } else {
+        p = AppendString(p, reg_names[op->reg]);
+      }
+      break;
+    case OP_IMM:
+      p = FormatInt(p, op->imm);
+      break;
+    case OP_MEM:
+      *p++ = '[';
+      p = AppendString(p, reg_names[op->reg]);
+      if (op->imm > 0) *p++ = '+';
+      if (op->imm) p = FormatInt(p, op->imm);
+      *p++ = ']';
+      break;
+    case OP_SYM:
+      p = Append(p, op->sym->str, op->sym->len);
+      if (insn->kind != I_CALL && insn->kind != I_LABEL) {
+        p = Append(p, "[rip]", 5);
+      }
+      break;
+    case OP_LABEL:
+      // The same as "%L" of `Emit`
+      p = Append(p, ".L", 2);
+      if (cc->label_func) {
+        p = Append(p, cc->label_func->str, cc->label_func->len);
+      } else {
+        p = FormatInt(p, cc->label_scope);
+      }
+      *p++ = '_';
+      p = FormatInt(p, op->imm);
+      break;
+  }
+  return p;
+}
+
+static size_t OperandLength(Compiler *cc, Operand *op) {
+  if (op->kind == OP_SYM) return op->sym->len;
+  if (op->kind == OP_LABEL && cc->label_func) return cc->label_func->len;
+  return 0;
+}
+
+static void PrintInsn(Compiler *cc, Insn *insn) {
+  if (insn->kind == I_COMMENT) {
+    if (insn->comment_func) {
+      Emit(cc, "  # %s:%d (%s)\n", insn->comment, insn->comment_line,
+           insn->comment_func);
+    } else {
+      Emit(cc, "  # %s\n", insn->comment);
+    }
+    return;
+  }
+
+  // Names aside, a line is shorter than this.
+  size_t max_len = 96 + OperandLength(cc, &insn->dst) +
+                   OperandLength(cc, &insn->src);
+  char *line = EmitReserve(cc, max_len);
+  char *p = line;
+  if (insn->kind == I_LABEL) {
+    p = AppendOperand(cc, p, insn, &insn->dst);
+    *p++ = ':';
+  } else {
+    p = Append(p, "  ", 2);
+    p = AppendString(p, insn_names[insn->kind]);
+    if (insn->dst.kind != OP_NONE) {
+      *p++ = ' ';
+      p = AppendOperand(cc, p, insn, &insn->dst);
+    }
+    if (insn->src.kind != OP_NONE) {
+      p = Append(p, ", ", 2);
+      p = AppendOperand(cc, p, insn, &insn->src);
+    }
+  }
+  *p++ = '\n';
+  EmitCommit(cc, p - line);
+}
+
+// Outputs the instructions collected, and empties the list.
+void FlushInsns(Compiler *cc) {
+  OptimizePeephole(cc);
+  if (cc->output_format == OUTPUT_ASM) {
+    for (int i = 0; i < cc->num_insns; ++i) {
+      PrintInsn(cc, &cc->insns[i]);
+    }
+  } else if (cc->output_format != OUTPUT_IR) {
+    EncodeInsns(cc);
+  }
+  cc->num_insns = 0;
+}
+
+void ReleaseInsns(Compiler *cc) {
+  free(cc->insns);
+  cc->insns = NULL;
+  cc->num_insns = 0;
+  cc->insns_capacity = 0;
+}
@@ -0,0 +1,85 @@
+/* Copyright 2022 Keita Morisaki. All rights reserved. */
+/*
+ * Identifier interning.
+ *
+ * Every distinct identifier spelling is mapped to exactly one `Ident`,
+ * so two names are equal iff their `Ident *` are equal.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./jcc.h"
+
+static uint32_t HashName(char *str, int len) {
+  // FNV-1a
+  uint32_t hash = 2166136261u;
+  for (int i = 0; i < len; ++i) {
+    hash ^= (unsigned char)str[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static void GrowSlots(Compiler *cc) {
+  int new_capacity =
+      cc->ident_slots_capacity ? cc->ident_slots_capacity * 2 : 1024;
+  Ident **new_slots = calloc(new_capacity, sizeof(Ident *));
+  if (!new_slots) {
+    ExitWithError(cc, "Out of memory.");
+  }
+
+  for (int i = 0; i < cc->ident_slots_capacity; ++i) {
+    Ident *ident = cc->ident_slots[i];
+    if (!ident) continue;
+
+    uint32_t j = ident->hash & (new_capacity - 1);
+    while (new_slots[j]) j = (j + 1) & (new_capacity - 1);
+    new_slots[j] = ident;
+  }
+
+  free(cc->ident_slots);
+  cc->ident_slots = new_slots;
+  cc->ident_slots_capacity = new_capacity;
+}
+
+/*
+ * Returns the unique `Ident` for the name `str[0..len)`.
+ * `str` must outlive the compilation, as the `Ident` points into it.
+ */
+Ident *Intern(Compiler *cc, char *str, int len) {
+  // Keep the load factor at most 1/2.
+  if (2 * (cc->num_idents + 1) > cc->ident_slots_capacity) {
+    GrowSlots(cc);
+  }
+
+  uint32_t hash = HashName(str, len);
+  uint32_t i = hash & (cc->ident_slots_capacity - 1);
+  for (;;) {
+    Ident *ident = cc->ident_slots[i];
+    if (!ident) break;
+
+    if (ident->hash == hash && ident->len == len &&
+        !memcmp(ident->str, str, len)) {
+      return ident;
+    }
+    i = (i + 1) & (cc->ident_slots_capacity - 1);
+  }
+
+  Ident *ident = ArenaAlloc(cc, &cc->arena, AR_IDENT, sizeof(Ident));
+  ident->str = str;
+  ident->len = len;
+  ident->hash = hash;
+  ident->id = cc->num_idents++;
+
+  cc->ident_slots[i] = ident;
+  return ident;
+}
+
+void ReleaseIdents(Compiler *cc) {
+  free(cc->ident_slots);
+  cc->ident_slots = NULL;
+  cc->ident_slots_capacity = 0;
+  cc->num_idents = 0;
+}
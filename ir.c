@@ -0,0 +1,95 @@
+/* Copyright 2022 Keita Morisaki. All rights reserved. */
+/*
+ * Helpers on the IR, and its printer for --dump-ir.
+ *
+ * A function is printed as its name followed by its blocks:
+ *
+ *   f:
+ *   B0:
+ *     v1 = param 0
+ *     v2 = local 8
+ *     store v2, v1
+ *     v3 = load v2
+ *     v4 = lt v3, 10
+ *     br v4, B1, B2
+ */
+#include "./jcc.h"
+
+static const char *ir_names[IR_NUM_OPS] = {
+  "imm", "mov", "add", "sub", "mul", "div", "mod", "eq", "ne", "lt", "le",
+  "param", "local", "global", "load", "store", "call", "jmp", "br", "ret",
+};
+
+/*
+ * Stores the blocks `block` can jump to into `succs`, and returns how
+ * many they are. Every block ends with a jump or a return.
+ */
+int Successors(BasicBlock *block, BasicBlock **succs) {
+  IRInsn *last = block->last;
+  switch (last->op) {
+    case IR_JMP:
+      succs[0] = last->then_block;
+      return 1;
+    case IR_BR:
+      succs[0] = last->then_block;
+      succs[1] = last->else_block;
+      return 2;
+    default:
+      return 0;
+  }
+}
+
+static void PrintInsn(Compiler *cc, IRInsn *insn) {
+  Emit(cc, "  ");
+  if (insn->dst) Emit(cc, "v%d = ", insn->dst);
+  Emit(cc, "%s", ir_names[insn->op]);
+
+  switch (insn->op) {
+    case IR_IMM:
+    case IR_PARAM:
+    case IR_LOCAL_ADDR:
+      Emit(cc, " %d", insn->imm);
+      break;
+    case IR_GLOBAL_ADDR:
+      Emit(cc, " %I", insn->sym);
+      break;
+    case IR_CALL:
+      Emit(cc, " %I(", insn->sym);
+      for (int i = 0; i < insn->num_args; ++i) {
+        Emit(cc, i ? ", v%d" : "v%d", insn->args[i]);
+      }
+      Emit(cc, ")");
+      break;
+    case IR_JMP:
+      Emit(cc, " B%d", insn->then_block->id);
+      break;
+    case IR_BR:
+      Emit(cc, " v%d, B%d, B%d", insn->a, insn->then_block->id,
+           insn->else_block->id);
+      break;
+    case IR_MOV:
+    case IR_LOAD:
+    case IR_RET:
+      Emit(cc, " v%d", insn->a);
+      break;
+    default:
+      // Binary operations and IR_STORE
+      if (insn->b) {
+        Emit(cc, " v%d, v%d", insn->a, insn->b);
+      } else {
+        Emit(cc, " v%d, %d", insn->a, insn->imm);
+      }
+      break;
+  }
+  Emit(cc, "\n");
+}
+
+void PrintIR(Compiler *cc, IRFunction *fn) {
+  Emit(cc, "%I:\n", fn->name);
+  for (BasicBlock *block = fn->blocks; block; block = block->next) {
+    Emit(cc, "B%d:\n", block->id);
+    for (IRInsn *insn = block->first; insn; insn = insn->next) {
+      PrintInsn(cc, insn);
+    }
+  }
+}
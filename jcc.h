@@ -1,12 +1,19 @@
 /* Copyright 2021 Keita Morisaki. All rights reserved. */
+#include <setjmp.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 // read this header only once
 #ifndef JCC_H_
 #define JCC_H_
 
-#define DBGPRNT printf("  # %s:%d (%s)\n", __FILE__, __LINE__, __func__)
+// Comment in the assembly telling which part of jcc emitted what follows.
+// Expects the `Compiler *cc` in the scope.
+#define DBGPRNT \
+  do { \
+    if (cc->verbose_asm) AddSourceComment(cc, __FILE__, __LINE__, __func__); \
+  } while (0)
 
 /*** Token definition ***/
 typedef enum {
@@ -22,13 +29,28 @@ typedef enum {
   TK_INT,
 } TokenKind;
 
+/*
+ * Interned identifier. There is exactly one `Ident` per spelling,
+ * so names are compared by pointer.
+ */
+typedef struct Ident Ident;
+struct Ident {
+  char *str;
+  int len;
+  uint32_t hash;
+  int id;         // 0, 1, 2, ... in order of first appearance
+};
+
+// Tokens are stored contiguously in `tokens`, not linked to each other.
 typedef struct Token Token;
 struct Token {
-  TokenKind kind;
-  Token *next;
-  int val;
   char *str;
+  union {
+    int val;        // TK_NUM
+    Ident *ident;   // TK_IDENT
+  };
   int len;
+  TokenKind kind;
 };
 /*** Token definition ***/
 
@@ -58,6 +80,7 @@ typedef enum {
   ND_BLOCK,
   ND_FUNC_CALL,
   ND_FUNC_DEFINITION,
+  ND_FUNC_DECLARATION,    // prototype. No code is generated.
   // Node for holding all the global variables
   ND_GLOBAL_VAR_LIST,
   ND_ADDR,
@@ -78,69 +101,650 @@ struct Type {
   size_t array_size;
 };
 
+/*
+ * Function known by name. It is registered by its first
+ * declaration or definition, so it can be called afterwards
+ * including from its own body.
+ */
+typedef struct Function Function;
+struct Function {
+  Ident *name;
+  Type *ret_type;
+  int num_parameters;
+  bool is_defined;    // false if only prototypes have been seen
+};
+
+typedef struct CacheEntry CacheEntry;
+
 struct Node {
   NodeKind kind;
   Node *lhs;
   Node *rhs;
   Node *condition;                      // for ND_IF, for ND_FOR
-  Node *body_program;                 // for ND_IF
+  Node *body_program;                 // for ND_IF, ND_FOR, ND_BLOCK
   Node *else_program;                 // for ND_IF
   Node *initialization;                 // for ND_FOR
   Node *iteration;                      // for ND_FOR
-  Node *next_in_block;                  // for ND_BLOCK
+  Node *next_in_block;                  // next statement in the same block
 
   // function
-  char *func_name;
-  int func_name_len;
+  Ident *func_name;
   Node *variable_next;                 // link new token to head
   Node *param_next;                     // link new token to head
   int next_offset_in_block;
   int argc;                             // for ND_FUNC_CALL, ND_FUNC_DEFINITION
   int num_parameters;                   // for ND_FUNC_DEFINITION
   Type *ret_type;
+  // For ND_FUNC_DEFINITION at the top level while caching. If it's a hit,
+  // the body is not parsed.
+  CacheEntry *cache_entry;
 
   // function call
+  // The arguments are linked by `arg_next` from the last one. A call
+  // can be an argument itself, so they have their own head.
+  Node *args;
   Node *arg_next;                       // link new token to head
-  Node *func_def;
+  Function *func;                       // callee
 
   // variables
   Type *type;  // variable type or return value type
-  char *var_name;
-  int var_name_len;
+  Ident *var_name;
   int val;
   int offset;
 };
 /*** AST definition ***/
 
 
-/*** GLOBAL VARIALBES ***/
-extern Token *token;       // token currently processed
-extern char *user_input;   // whole program
-// TODO(k1832): Replace this with a linked-list
-extern Node *programs[100];
+/*** IR definition ***/
+/*
+ * Three-address code of a function, lowered from its AST (lower.c).
+ * Values are held in virtual registers, numbered from 1. Unlike SSA,
+ * a virtual register can be assigned any number of times.
+ */
+typedef enum {
+  IR_IMM,           // dst = imm
+  IR_MOV,           // dst = a
+  IR_ADD,           // dst = a + b
+  IR_SUB,
+  IR_MUL,
+  IR_DIV,
+  IR_MOD,
+  IR_EQ,            // dst = a == b ? 1 : 0
+  IR_NE,
+  IR_LT,
+  IR_LE,
+  IR_PARAM,         // dst = parameter `imm` (from 0) passed in a register
+  IR_LOCAL_ADDR,    // dst = address of the local variable at rbp - imm
+  IR_GLOBAL_ADDR,   // dst = address of `sym`
+  IR_LOAD,          // dst = *a
+  IR_STORE,         // *a = b
+  IR_CALL,          // dst = sym(args...)
+  IR_JMP,           // jump to `then_block`
+  IR_BR,            // jump to `then_block` if a, otherwise to `else_block`
+  IR_RET,           // return a
+  IR_NUM_OPS,
+} IROp;
+
+typedef struct BasicBlock BasicBlock;
+
+typedef struct IRInsn IRInsn;
+struct IRInsn {
+  IROp op;
+  int dst;    // 0 if the instruction has no result
+  int a;
+  int b;      // 0 for IR_ADD to IR_LE if the operand is `imm` instead
+  int imm;
+  Ident *sym;
+  int *args;  // IR_CALL, in the order of the parameters
+  int num_args;
+  BasicBlock *then_block;
+  BasicBlock *else_block;
+  IRInsn *next;
+};
+
+// Instructions run one after another, only the last one may jump.
+struct BasicBlock {
+  int id;           // 0 to num_blocks - 1, in the order of `next`
+  IRInsn *first;
+  IRInsn *last;
+  BasicBlock *next;   // in the order of the code. The first is the entry.
+};
+
+typedef struct IRFunction IRFunction;
+struct IRFunction {
+  Ident *name;
+  BasicBlock *blocks;
+  BasicBlock *last_block;
+  int num_blocks;
+  int num_vregs;
+  int frame_size;   // bytes of the local variables below rbp
+  int used_registers;   // bit (1 << reg) of each register allocated
+};
+
+/*
+ * Local variable of the function being lowered. One whose address is
+ * never taken lives in a virtual register instead of its slot.
+ */
+typedef struct {
+  bool escapes;     // its address is taken, or it's an array
+  int vreg;         // holding the variable unless it escapes
+  int offset;       // of its slot if it escapes, in the frame without
+                    // the others
+  /*
+   * For the temporary pointer "tmp = &x" of "x += y", which then points
+   * to the variable of `vreg` instead of holding an address.
+   */
+  bool is_alias;
+} IRVar;
+/*** IR definition ***/
+
+
+/*** Instruction definition ***/
+// In the order of their encoding
+typedef enum {
+  RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+  R8, R9, R10, R11, R12, R13, R14, R15,
+} Register;
+
+typedef enum {
+  OP_NONE,
+  OP_REG,
+  OP_IMM,
+  OP_MEM,     // [reg + imm]
+  OP_SYM,     // address of `sym`, relative to rip except for "call"
+  OP_LABEL,   // label `imm` of the item
+} OperandKind;
+
+typedef struct Operand Operand;
+struct Operand {
+  OperandKind kind;
+  Register reg;
+  int imm;
+  Ident *sym;
+};
+
+typedef enum {
+  I_MOV,
+  I_MOVZB,    // zero-extends the low byte of `src`
+  I_LEA,
+  I_PUSH,
+  I_POP,
+  I_ADD,
+  I_SUB,
+  I_IMUL,
+  I_CQO,
+  I_IDIV,
+  I_CMP,
+  I_SETE,     // sets the low byte of `dst`
+  I_SETNE,
+  I_SETL,
+  I_SETLE,
+  I_JMP,
+  I_JE,
+  I_JNE,
+  I_JL,
+  I_JLE,
+  I_JGE,
+  I_JG,
+  I_CALL,
+  I_RET,
+  I_LABEL,    // defines the label or the symbol `dst`
+  I_COMMENT,  // printed only in the assembly
+  I_NUM_KINDS,
+} InsnKind;
 
 /*
- * `ND_GLOBAL_VARIABLE` node that holds linked-list
- * of the global variables.
- * Through entire program, there is only one `ND_GLOBAL_VARIABLE` node
+ * Instruction of x86-64, as written in the Intel syntax. The code of
+ * an item is collected as a list of them, then printed as assembly or
+ * encoded into an object.
  */
-extern Node *globals;
-extern int label_num;
+typedef struct Insn Insn;
+struct Insn {
+  InsnKind kind;
+  union {
+    struct {
+      Operand dst;
+      Operand src;
+    };
+    // I_COMMENT. `comment_func` and `comment_line` are set by DBGPRNT.
+    struct {
+      const char *comment;
+      const char *comment_func;
+      int comment_line;
+    };
+  };
+};
+/*** Instruction definition ***/
+
+
+/*** Arena definition ***/
+// Kinds of objects allocated from an arena. Used for statistics only.
+typedef enum {
+  AR_NODE,
+  AR_TYPE,
+  AR_IDENT,
+  AR_FUNCTION,
+  AR_CACHE,
+  AR_SYMBOL,
+  AR_IR,
+  AR_NUM_KINDS,
+} ArenaKind;
+
+typedef struct ArenaBlock ArenaBlock;
+
+typedef struct Arena Arena;
+struct Arena {
+  ArenaBlock *head;     // block currently carved; older blocks are linked
+  size_t reserved_bytes;
+  size_t peak_reserved_bytes;
+  size_t bytes[AR_NUM_KINDS];
+  size_t objects[AR_NUM_KINDS];
+};
+/*** Arena definition ***/
+
+
+/*** SymbolTable definition ***/
+typedef struct SymbolTableEntry SymbolTableEntry;
+struct SymbolTableEntry {
+  Ident *key;     // NULL for an empty slot
+  void *value;
+};
+
+// Zero-initialized SymbolTable is an empty table.
+typedef struct SymbolTable SymbolTable;
+struct SymbolTable {
+  SymbolTableEntry *entries;
+  int capacity;
+  int count;
+};
+/*** SymbolTable definition ***/
+
+
+/*** Object definition ***/
+typedef enum {
+  SEC_UNDEF,    // defined by another object or a library
+  SEC_TEXT,
+  SEC_BSS,
+} Section;
+
+typedef struct ObjectSymbol ObjectSymbol;
+struct ObjectSymbol {
+  Ident *name;
+  Section section;
+  size_t offset;      // in `section`
+  size_t size;
+  bool global;
+  // In the symbol table of the ELF file, or of the stubs when run for
+  // an undefined symbol (see jit.c)
+  int index;
+  ObjectSymbol *next;   // in the order of the first reference
+};
+
+typedef enum {
+  RELOC_PC32,     // 32-bit address of the symbol relative to rip
+  RELOC_PLT32,    // "call" to the symbol
+} RelocKind;
+
+// Patches 4 bytes of .text at `offset` with the address of `symbol`.
+typedef struct Relocation Relocation;
+struct Relocation {
+  size_t offset;
+  RelocKind kind;
+  ObjectSymbol *symbol;
+  int addend;
+};
+
+// Jump to a label, resolved at the end of the item.
+typedef struct LabelFixup LabelFixup;
+struct LabelFixup {
+  size_t offset;    // of the 32-bit displacement in .text
+  int label;
+};
+
+/*
+ * Machine code and data of a program, encoded from instructions
+ * (encode.c). Written out as an ELF relocatable object (elf.c).
+ */
+typedef struct Object Object;
+struct Object {
+  char *text;
+  size_t text_len;
+  size_t text_capacity;
+  size_t bss_size;
+
+  ObjectSymbol *symbols;      // head of the list
+  ObjectSymbol *last_symbol;
+  SymbolTable symbol_table;   // Ident -> ObjectSymbol
+
+  Relocation *relocs;
+  int num_relocs;
+  int relocs_capacity;
+
+  // Labels of the item being encoded
+  size_t *label_offsets;
+  int label_offsets_capacity;
+  LabelFixup *fixups;
+  int num_fixups;
+  int fixups_capacity;
+};
+/*** Object definition ***/
+
+
+/*** Scanner definition ***/
+// Each function returns the first character after the run starting at `p`.
+typedef struct Scanner Scanner;
+struct Scanner {
+  const char *name;
+  char *(*skip_spaces)(char *p);
+  char *(*skip_ident)(char *p);
+  char *(*skip_digits)(char *p);
+};
+/*** Scanner definition ***/
+
+
+/*** Stats definition ***/
+#define NUM_PEEPHOLE_RULES 6
+
+// Phases of the compilation timed by --stats.
+typedef enum {
+  PH_INPUT,
+  PH_TOKENIZE,
+  PH_PARSE,
+  PH_ADD_TYPE,
+  PH_FOLD,
+  PH_CODEGEN,
+  PH_OUTPUT,
+  PH_NUM_PHASES,
+} Phase;
+/*** Stats definition ***/
+
+
+/*** Cache definition ***/
+/*
+ * Generated code of one function, looked up by the tokens of
+ * the function and what they refer to (see cache.c).
+ */
+struct CacheEntry {
+  uint64_t hash;        // of `key`
+  char *key;
+  size_t key_len;
+  bool hit;             // `code` was found in the cache
+  char *code;           // generated code, without NUL
+  size_t code_len;
+  size_t code_capacity;   // 0 if `code` is not allocated by the entry
+  CacheEntry *next;     // in the order of the program
+};
+
+typedef struct Cache Cache;
+/*** Cache definition ***/
+
+
+/*** Compiler definition ***/
+/*
+ * A lexical scope. A name declared in a scope hides
+ * the same name declared in its enclosing scopes.
+ */
+typedef struct Scope Scope;
+struct Scope {
+  Scope *parent;
+  SymbolTable vars;   // Ident -> ND_VAR_DCLR node
+};
+
+typedef enum {
+  OUTPUT_ASM,       // text assembly
+  OUTPUT_OBJECT,    // ELF relocatable object
+  OUTPUT_RUN,       // nothing, the object is run in memory by `RunObject`
+  OUTPUT_IR,        // IR of the functions, for --dump-ir
+} OutputFormat;
+
+// How `user_input` was obtained, to release it accordingly.
+typedef enum {
+  INPUT_BORROWED,   // owned by someone else, e.g. argv
+  INPUT_MMAP,
+  INPUT_MALLOC,
+} InputKind;
+
+#define MAX_PHASE_DEPTH 8
+#define ERROR_MESSAGE_SIZE 1024
+
+/*
+ * Whole state of one compilation, passed to every phase.
+ * Compilations share nothing but read-only data (`scanner` and
+ * `ty_int`), so any number of them can run at the same time.
+ * Set up with `InitCompiler` and free with `ReleaseCompiler`.
+ * `ResetCompiler` makes it ready for another program.
+ */
+typedef struct Compiler Compiler;
+struct Compiler {
+  // Options
+  bool verbose_asm;     // emit debug comments
+  bool stats_enabled;   // collect statistics for --stats
+  int codegen_threads;  // generate code on this many threads if above 1
+  const char *cache_dir;  // reuse the code of unchanged functions if set
+  OutputFormat output_format;
+  int opt_level;        // above 0, functions are compiled through the IR
+
+  // Errors (util.c). Without `error_jmp`, an error ends the process.
+  jmp_buf *error_jmp;   // where an error returns to
+  char error_message[ERROR_MESSAGE_SIZE];   // set before jumping
+
+  // Input (input.c)
+  char *user_input;     // whole program, terminated by NUL
+  char *input_name;     // file name of `user_input`
+  InputKind input_kind;
+  size_t mapped_size;
+
+  // Tokens (tokenizer.c)
+  Token *tokens;        // all tokens, terminated by TK_EOF
+  int num_tokens;
+  int tokens_capacity;
+
+  // Identifiers (intern.c). Open addressing, the capacity is a power of 2.
+  Ident **ident_slots;
+  int ident_slots_capacity;
+  int num_idents;
+
+  // Objects that live through the whole compilation: identifiers,
+  // functions, global variables and their types.
+  Arena arena;
+  // AST of the function being compiled. Reset before the next function.
+  Arena func_arena;
+
+  // Parser (parser.c)
+  int token_pos;        // index of the token currently processed
+  Scope global_scope;
+  Scope *current_scope;   // innermost scope
+  Node *current_func;   // function being defined. NULL at the top level.
+  SymbolTable functions;  // Ident -> Function
+  /*
+   * `ND_GLOBAL_VAR_LIST` node that holds linked-list
+   * of the global variables.
+   */
+  Node *globals;
+
+  // IR (lower.c)
+  IRFunction *ir;       // function being lowered
+  BasicBlock *ir_block;   // block the instructions are appended to
+  IRVar *ir_vars;       // locals of the function by (offset - ir_vars_base) / 8
+  int ir_vars_base;
+  int ir_var_vregs;     // virtual registers 1 to this hold variables
+
+  // Code generation (codegen.c, emit.c)
+  // Labels are prefixed with the name of the function generated,
+  // or the index of the item if it's not a function.
+  Ident *label_func;
+  int label_scope;
+  int label_num;        // from 0 in each item
+  Insn *insns;          // code of the item being generated
+  int num_insns;
+  int insns_capacity;
+  Object object;        // OUTPUT_OBJECT and OUTPUT_RUN only
+  int out_fd;             // -1 while writing to `out_buffer` only
+  const char *out_path;   // NULL while writing to stdout or memory
+  bool out_is_regular;    // false for e.g. /dev/null
+  bool out_completed;
+  char *out_buffer;
+  size_t out_buffer_used;
+  size_t out_buffer_capacity;
+
+  // Cache (cache.c)
+  Cache *cache;         // NULL unless caching
+  CacheEntry *capture;  // receives a copy of the code emitted if set
+
+  // Statistics (stats.c)
+  uint64_t phase_wall_ns[PH_NUM_PHASES];
+  uint64_t phase_cpu_ns[PH_NUM_PHASES];
+  Phase phase_stack[MAX_PHASE_DEPTH];
+  int phase_depth;
+  uint64_t last_wall_ns;  // when the innermost phase was entered or resumed
+  uint64_t last_cpu_ns;
+  int cache_hits;
+  int cache_misses;
+  int folded_nodes;     // AST nodes removed by FoldFunction
+  int peephole_hits[NUM_PEEPHOLE_RULES];  // rewrites by each rule
+};
+/*** Compiler definition ***/
+
+
+/*** GLOBAL VARIALBES ***/
+// Never modified, so it's shared by all compilations.
 extern Type *ty_int;
+
+// Run scanners, SSE2 on x86-64 unless JCC_SCANNER selects another
+extern Scanner scanner;
+
+// Registers passing the first 6 arguments, in the System V ABI
+extern const Register registers[6];
 /*** GLOBAL VARIALBES ***/
 
-void Tokenize();
-void BuildAST();
-bool PrintAssembly(Node *node);
-void ExitWithErrorAt(char *input, char *loc, char *fmt, ...);
-void ExitWithError(char *fmt, ...);
+// compiler.c
+void InitCompiler(Compiler *cc);
+void CopyOptions(Compiler *dst, const Compiler *src);
+void ResetCompiler(Compiler *cc);
+void ReleaseCompiler(Compiler *cc);
+void Compile(Compiler *cc);
+void GenerateItem(Compiler *cc, Node *item, int index);
+
+void Tokenize(Compiler *cc);
+void ReleaseTokens(Compiler *cc);
+Token *Peek(Compiler *cc, int k);
+Node *ParseNextItem(Compiler *cc);
+bool PrintAssembly(Compiler *cc, Node *node);
+_Noreturn void ExitWithErrorAt(Compiler *cc, char *loc, char *fmt, ...);
+_Noreturn void ExitWithError(Compiler *cc, char *fmt, ...);
+_Noreturn void ExitWithSavedError(Compiler *cc);
 bool StartsWith(char *p, char *possible_suffix);
-bool IsAlnumOrUnderscore(char c);
+bool EndsWith(char *str, char *suffix);
+
+// arena.c
+void *ArenaAlloc(Compiler *cc, Arena *ar, ArenaKind kind, size_t size);
+void ArenaReset(Arena *ar);
+void ArenaRelease(Arena *ar);
+void ArenaAddStats(Arena *dst, const Arena *src);
+const char *ArenaKindName(ArenaKind kind);
+void PrintArenaStats(Arena *ar, FILE *out);
+
+// cache.c
+void OpenCache(Compiler *cc);
+CacheEntry *LookUpFunction(Compiler *cc, int first_token, int open_brace);
+void CaptureCode(Compiler *cc, const char *p, size_t len);
+void CloseCache(Compiler *cc);
+void ReleaseCache(Compiler *cc);
+
+// driver.c
+int CompileFiles(char **paths, int num_paths, const char *out_dir,
+                 int num_threads, const Compiler *options);
+
+// fold.c
+void FoldFunction(Compiler *cc, Node *func);
+
+// backend.c
+void GenerateFromIR(Compiler *cc, IRFunction *fn);
+
+// elf.c
+void WriteObject(Compiler *cc);
+
+// emit.c
+void Emit(Compiler *cc, const char *fmt, ...);
+void EmitBytes(Compiler *cc, const char *p, size_t len);
+char *EmitReserve(Compiler *cc, size_t len);
+void EmitCommit(Compiler *cc, size_t len);
+char *FormatInt(char *p, long val);
+void EmitInt(Compiler *cc, long val);
+void EmitOpen(Compiler *cc, const char *path);
+void EmitOpenMemory(Compiler *cc);
+void EmitClose(Compiler *cc);
+void EmitDiscard(Compiler *cc);
+
+// encode.c
+void EncodeInsns(Compiler *cc);
+void AddBss(Compiler *cc, Ident *name, int size);
+void ResetObject(Object *obj);
+void ReleaseObject(Object *obj);
+
+// jit.c
+int RunObject(Compiler *cc);
+
+// input.c
+void LoadInput(Compiler *cc, char *arg);
+void ReleaseInput(Compiler *cc);
+
+// insn.c
+Operand Reg(Register reg);
+Operand Imm(int val);
+Operand Mem(Register base, int disp);
+Operand Sym(Ident *sym);
+Operand Label(int label);
+void Insn0(Compiler *cc, InsnKind kind);
+void Insn1(Compiler *cc, InsnKind kind, Operand dst);
+void Insn2(Compiler *cc, InsnKind kind, Operand dst, Operand src);
+void AddComment(Compiler *cc, const char *comment);
+void AddSourceComment(Compiler *cc, const char *file, int line,
+                      const char *func);
+void FlushInsns(Compiler *cc);
+void ReleaseInsns(Compiler *cc);
+
+// ir.c
+int Successors(BasicBlock *block, BasicBlock **succs);
+void PrintIR(Compiler *cc, IRFunction *fn);
+
+// intern.c
+Ident *Intern(Compiler *cc, char *str, int len);
+void ReleaseIdents(Compiler *cc);
+
+// lower.c
+IRFunction *LowerFunction(Compiler *cc, Node *func);
+
+// parallel.c
+void GenerateInParallel(Compiler *cc);
+
+// peephole.c
+const char *PeepholeRuleName(int rule);
+void OptimizePeephole(Compiler *cc);
+
+// regalloc.c
+void AllocateRegisters(Compiler *cc, IRFunction *fn, Operand *locs);
+
+// scan.c
+bool UseScanner(const char *name);
+
+// stats.c
+void EnterPhase(Compiler *cc, Phase phase);
+void LeavePhase(Compiler *cc);
+void PrintPeepholeHits(FILE *out, const int *hits);
+void PrintStats(Compiler *cc, FILE *out);
+
+// symtab.c
+void *SymbolTableGet(SymbolTable *table, Ident *key);
+void SymbolTablePut(Compiler *cc, SymbolTable *table, Ident *key,
+                    void *value);
+void SymbolTableRelease(SymbolTable *table);
 
 // type.c
-bool IsTypeToken();
-Type *GetType();
-void AddType(Node *node);
-int GetSize(Type *ty);
+bool IsTypeToken(Token *tok);
+bool IsSameType(Type *a, Type *b);
+Type *GetType(Compiler *cc);
+void AddType(Compiler *cc, Node *node);
+int GetSize(Compiler *cc, Type *ty);
 
 #endif  // JCC_H_
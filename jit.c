@@ -0,0 +1,148 @@
+/* Copyright 2022 Keita Morisaki. All rights reserved. */
+/*
+ * Runs the object encoded in memory, for jcc --run.
+ *
+ * The code and the global variables are put in one mapping, so that
+ * rip-relative references between them are in the range of 32 bits.
+ * Functions of libc are out of that range, so each of them is called
+ * through a stub, "jmp [rip]" followed by its address.
+ *
+ * Undefined functions are looked up by dlsym in jcc and the libraries
+ * it is linked with, libc among them. A build of jcc linked with
+ * -static has no dynamic symbol table to search, so a few functions of
+ * libc are listed in `libc_functions` for it as well.
+ */
+#define _GNU_SOURCE  // RTLD_DEFAULT, MAP_ANONYMOUS
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "./jcc.h"
+
+#define STUB_SIZE 16
+
+typedef void (*LibcFunction)(void);
+
+static const struct {
+  const char *name;
+  LibcFunction address;
+} libc_functions[] = {
+  {"abort", (LibcFunction)abort},
+  {"abs", (LibcFunction)abs},
+  {"calloc", (LibcFunction)calloc},
+  {"exit", (LibcFunction)exit},
+  {"free", (LibcFunction)free},
+  {"getchar", (LibcFunction)getchar},
+  {"malloc", (LibcFunction)malloc},
+  {"putchar", (LibcFunction)putchar},
+  {"rand", (LibcFunction)rand},
+  {"realloc", (LibcFunction)realloc},
+  {"srand", (LibcFunction)srand},
+};
+
+static LibcFunction FindLibcFunction(Ident *name) {
+  char *symbol = strndup(name->str, name->len);
+  LibcFunction address = (LibcFunction)dlsym(RTLD_DEFAULT, symbol);
+  free(symbol);
+  if (address) return address;
+
+  int n = sizeof(libc_functions) / sizeof(libc_functions[0]);
+  for (int i = 0; i < n; ++i) {
+    const char *libc_name = libc_functions[i].name;
+    if (strlen(libc_name) == name->len &&
+        !memcmp(libc_name, name->str, name->len)) {
+      return libc_functions[i].address;
+    }
+  }
+  return NULL;
+}
+
+static size_t AlignTo(size_t size, size_t align) {
+  return (size + align - 1) / align * align;
+}
+
+static char *AddressOf(ObjectSymbol *sym, char *text, char *stubs,
+                       char *bss) {
+  switch (sym->section) {
+    case SEC_TEXT:
+      return text + sym->offset;
+    case SEC_BSS:
+      return bss + sym->offset;
+    case SEC_UNDEF:
+      break;
+  }
+  return stubs + sym->index * STUB_SIZE;
+}
+
+// Writes "jmp [rip]" followed by `address`.
+static void WriteStub(char *stub, LibcFunction address) {
+  static const char jmp[6] = {0xFF, 0x25, 0, 0, 0, 0};
+  memcpy(stub, jmp, sizeof(jmp));
+  memcpy(stub + sizeof(jmp), &address, sizeof(address));
+}
+
+/*
+ * Calls main of the program compiled with OUTPUT_RUN, and returns
+ * what it returns. The memory of the program is unmapped afterwards.
+ */
+int RunObject(Compiler *cc) {
+  Object *obj = &cc->object;
+
+  ObjectSymbol *main_func = NULL;
+  int num_stubs = 0;
+  for (ObjectSymbol *sym = obj->symbols; sym; sym = sym->next) {
+    if (sym->section == SEC_UNDEF) {
+      if (!FindLibcFunction(sym->name)) {
+        ExitWithError(cc, "Undefined function \"%.*s\".", sym->name->len,
+                      sym->name->str);
+      }
+      sym->index = num_stubs++;
+    } else if (sym->global) {
+      main_func = sym;
+    }
+  }
+  if (!main_func) {
+    ExitWithError(cc, "main is not defined.");
+  }
+
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  size_t stubs_offset = AlignTo(obj->text_len, STUB_SIZE);
+  size_t code_size = AlignTo(stubs_offset + num_stubs * STUB_SIZE,
+                             page_size);
+  size_t size = code_size + AlignTo(obj->bss_size, page_size);
+  char *text = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (text == MAP_FAILED) {
+    ExitWithError(cc, "Failed to map memory for the program.");
+  }
+  char *stubs = text + stubs_offset;
+  char *bss = text + code_size;
+
+  memcpy(text, obj->text, obj->text_len);
+  for (ObjectSymbol *sym = obj->symbols; sym; sym = sym->next) {
+    if (sym->section == SEC_UNDEF) {
+      WriteStub(AddressOf(sym, text, stubs, bss), FindLibcFunction(sym->name));
+    }
+  }
+  for (int i = 0; i < obj->num_relocs; ++i) {
+    Relocation *reloc = &obj->relocs[i];
+    char *place = text + reloc->offset;
+    int disp = AddressOf(reloc->symbol, text, stubs, bss) + reloc->addend -
+               place;
+    memcpy(place, &disp, sizeof(disp));
+  }
+
+  if (mprotect(text, code_size, PROT_READ | PROT_EXEC)) {
+    munmap(text, size);
+    ExitWithError(cc, "Failed to make the program executable.");
+  }
+
+  int (*entry)(void) = (int (*)(void))(text + main_func->offset);
+  int status = entry();
+
+  munmap(text, size);
+  return status;
+}
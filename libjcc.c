@@ -0,0 +1,81 @@
+/* Copyright 2022 Keita Morisaki. All rights reserved. */
+#include <setjmp.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./jcc.h"
+#include "./libjcc.h"
+
+struct jcc_context {
+  Compiler cc;
+  char *source;   // NUL-terminated copy of the program being compiled
+  size_t source_capacity;
+};
+
+jcc_context *jcc_context_new(void) {
+  jcc_context *ctx = calloc(1, sizeof(jcc_context));
+  if (!ctx) return NULL;
+
+  InitCompiler(&ctx->cc);
+  return ctx;
+}
+
+void jcc_context_free(jcc_context *ctx) {
+  if (!ctx) return;
+
+  ReleaseCompiler(&ctx->cc);
+  free(ctx->source);
+  free(ctx);
+}
+
+/*
+ * The text is copied as the tokenizer needs the NUL, and identifiers
+ * keep pointing into it after `src` may have been freed by the caller.
+ */
+static bool CopySource(jcc_context *ctx, const char *src, size_t len) {
+  if (ctx->source_capacity < len + 1) {
+    char *source = realloc(ctx->source, len + 1);
+    if (!source) return false;
+    ctx->source = source;
+    ctx->source_capacity = len + 1;
+  }
+  memcpy(ctx->source, src, len);
+  ctx->source[len] = '\0';
+  return true;
+}
+
+jcc_result jcc_compile(jcc_context *ctx, const char *src, size_t len,
+                       jcc_output *out) {
+  Compiler *cc = &ctx->cc;
+  ResetCompiler(cc);
+  out->len = 0;
+  out->error = NULL;
+
+  if (!CopySource(ctx, src, len)) {
+    out->error = "Out of memory.";
+    return JCC_ERROR;
+  }
+  cc->input_name = "<input>";
+  cc->user_input = ctx->source;
+
+  jmp_buf on_error;
+  cc->error_jmp = &on_error;
+  if (setjmp(on_error)) {
+    cc->error_jmp = NULL;
+    out->error = cc->error_message;
+    return JCC_ERROR;
+  }
+  EmitOpenMemory(cc);
+  Compile(cc);
+  EmitClose(cc);
+  cc->error_jmp = NULL;
+
+  out->len = cc->out_buffer_used;
+  if (out->cap < out->len + 1) {
+    out->error = "The output buffer is too small.";
+    return JCC_ERROR_OUTPUT_TOO_SMALL;
+  }
+  memcpy(out->buf, cc->out_buffer, out->len);
+  out->buf[out->len] = '\0';
+  return JCC_OK;
+}
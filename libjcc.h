@@ -0,0 +1,59 @@
+/* Copyright 2022 Keita Morisaki. All rights reserved. */
+/*
+ * libjcc: jcc as a library, to compile many programs in one process.
+ *
+ *   jcc_context *ctx = jcc_context_new();
+ *   char buf[65536];
+ *   jcc_output out = {buf, sizeof(buf)};
+ *   if (jcc_compile(ctx, src, strlen(src), &out) == JCC_OK) {
+ *     // buf holds out.len bytes of assembly, terminated by NUL.
+ *   }
+ *   jcc_context_free(ctx);
+ *
+ * A context keeps the memory of the previous compilation to reuse it,
+ * so compile any number of programs with one context. Contexts are
+ * independent, so each thread can compile with its own.
+ */
+#ifndef LIBJCC_H_
+#define LIBJCC_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct jcc_context jcc_context;
+
+typedef enum {
+  JCC_OK = 0,
+  JCC_ERROR,                    // the program is invalid, or out of memory
+  JCC_ERROR_OUTPUT_TOO_SMALL,   // `len` is set, but nothing is copied
+} jcc_result;
+
+typedef struct {
+  // Set by the caller
+  char *buf;    // receives the assembly
+  size_t cap;   // size of `buf`
+
+  // Set by `jcc_compile`
+  size_t len;           // length of the assembly, without NUL
+  const char *error;    // message if not JCC_OK, owned by the context
+} jcc_output;
+
+// Returns NULL if out of memory.
+jcc_context *jcc_context_new(void);
+void jcc_context_free(jcc_context *ctx);
+
+/*
+ * Compiles the program `src[0..len)` into assembly in `out->buf`.
+ * `out->error` is valid until the next call with `ctx`.
+ */
+jcc_result jcc_compile(jcc_context *ctx, const char *src, size_t len,
+                       jcc_output *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // LIBJCC_H_
@@ -0,0 +1,504 @@
+/* Copyright 2022 Keita Morisaki. All rights reserved. */
+/*
+ * Lowering of the AST of a function into the IR.
+ *
+ * A local variable whose address is never taken, by "&" or as an array,
+ * is kept in a virtual register for its whole lifetime. The others
+ * live in slots of the stack frame, which is laid out again with only
+ * them. Expressions are evaluated in the same order as in codegen.c,
+ * including the arguments of calls from the last one.
+ *
+ * Loops are laid out with their condition at the bottom, so that each
+ * iteration takes one jump.
+ */
+#include <stdlib.h>
+
+#include "./jcc.h"
+
+static int NewVReg(Compiler *cc) {
+  return ++cc->ir->num_vregs;
+}
+
+static BasicBlock *NewBlock(Compiler *cc) {
+  return ArenaAlloc(cc, &cc->func_arena, AR_IR, sizeof(BasicBlock));
+}
+
+static bool IsTerminator(IRInsn *insn) {
+  return insn &&
+         (insn->op == IR_JMP || insn->op == IR_BR || insn->op == IR_RET);
+}
+
+static IRInsn *AddIR(Compiler *cc, IROp op, int dst, int a, int b);
+
+static void AddJump(Compiler *cc, BasicBlock *target) {
+  AddIR(cc, IR_JMP, 0, 0, 0)->then_block = target;
+}
+
+/*
+ * Appends `block` to the function and makes it the current block.
+ * Every block ends with a jump, so the current one jumps to `block`
+ * unless it already ends with one.
+ */
+static void StartBlock(Compiler *cc, BasicBlock *block) {
+  if (cc->ir_block && !IsTerminator(cc->ir_block->last)) {
+    AddJump(cc, block);
+  }
+
+  IRFunction *fn = cc->ir;
+  if (fn->last_block) {
+    fn->last_block->next = block;
+  } else {
+    fn->blocks = block;
+  }
+  fn->last_block = block;
+  cc->ir_block = block;
+}
+
+static IRInsn *AddIR(Compiler *cc, IROp op, int dst, int a, int b) {
+  // Code after a jump, like the statements after "return", is put in
+  // a block of its own, which nothing jumps to.
+  if (IsTerminator(cc->ir_block->last)) StartBlock(cc, NewBlock(cc));
+
+  IRInsn *insn = ArenaAlloc(cc, &cc->func_arena, AR_IR, sizeof(IRInsn));
+  insn->op = op;
+  insn->dst = dst;
+  insn->a = a;
+  insn->b = b;
+
+  BasicBlock *block = cc->ir_block;
+  if (block->last) {
+    block->last->next = insn;
+  } else {
+    block->first = insn;
+  }
+  block->last = insn;
+  return insn;
+}
+
+static int AddImm(Compiler *cc, int val) {
+  int dst = NewVReg(cc);
+  AddIR(cc, IR_IMM, dst, 0, 0)->imm = val;
+  return dst;
+}
+
+static void AddBranch(Compiler *cc, int cond, BasicBlock *then_block,
+                      BasicBlock *else_block) {
+  IRInsn *insn = AddIR(cc, IR_BR, 0, cond, 0);
+  insn->then_block = then_block;
+  insn->else_block = else_block;
+}
+
+static IRVar *VarAt(Compiler *cc, int offset) {
+  return &cc->ir_vars[(offset - cc->ir_vars_base) / 8];
+}
+
+// The temporary of "x += y" has no name.
+static bool IsTemporary(Node *node) {
+  return node->kind == ND_LOCAL_VAR && !node->var_name;
+}
+
+/*
+ * Returns the variable held in a virtual register that `node` refers
+ * to, either by its name or as "*tmp" of "x += y", or NULL.
+ */
+static IRVar *VarInRegister(Compiler *cc, Node *node) {
+  if (node->kind == ND_LOCAL_VAR) {
+    IRVar *var = VarAt(cc, node->offset);
+    return var->escapes || var->is_alias ? NULL : var;
+  }
+  if (node->kind == ND_DEREF && IsTemporary(node->lhs)) {
+    IRVar *tmp = VarAt(cc, node->lhs->offset);
+    return tmp->is_alias ? tmp : NULL;
+  }
+  return NULL;
+}
+
+static int LowerExpression(Compiler *cc, Node *node);
+
+// Returns the virtual register holding the address of `node`.
+static int LowerAddress(Compiler *cc, Node *node) {
+  switch (node->kind) {
+    case ND_LOCAL_VAR: {
+      int dst = NewVReg(cc);
+      IRInsn *insn = AddIR(cc, IR_LOCAL_ADDR, dst, 0, 0);
+      insn->imm = VarAt(cc, node->offset)->offset;
+      return dst;
+    }
+    case ND_GLBL_VAR: {
+      int dst = NewVReg(cc);
+      AddIR(cc, IR_GLOBAL_ADDR, dst, 0, 0)->sym = node->var_name;
+      return dst;
+    }
+    case ND_DEREF:
+      // The pointer, or the address of the array, is the address.
+      return LowerExpression(cc, node->lhs);
+    default:
+      ExitWithError(cc, "Failed to parse the node as a left-hand-side.\n");
+  }
+}
+
+static int LowerCall(Compiler *cc, Node *node) {
+  int *args = ArenaAlloc(cc, &cc->func_arena, AR_IR, node->argc * sizeof(int));
+  // The arguments are linked from the last one.
+  int i = node->argc;
+  for (Node *arg = node->args; arg; arg = arg->arg_next) {
+    args[--i] = LowerExpression(cc, arg);
+  }
+
+  int dst = NewVReg(cc);
+  IRInsn *insn = AddIR(cc, IR_CALL, dst, 0, 0);
+  insn->sym = node->func_name;
+  insn->args = args;
+  insn->num_args = node->argc;
+  return dst;
+}
+
+static IROp BinaryOp(Compiler *cc, NodeKind kind) {
+  switch (kind) {
+    case ND_ADD:
+      return IR_ADD;
+    case ND_SUB:
+      return IR_SUB;
+    case ND_MUL:
+      return IR_MUL;
+    case ND_DIV:
+      return IR_DIV;
+    case ND_MOD:
+      return IR_MOD;
+    case ND_EQ:
+      return IR_EQ;
+    case ND_NEQ:
+      return IR_NE;
+    case ND_LT:
+      return IR_LT;
+    case ND_NGT:
+      return IR_LE;
+    default:
+      ExitWithError(cc, "node->kind %u is not handled in %s", kind, __func__);
+  }
+}
+
+static int LowerAssign(Compiler *cc, Node *node) {
+  if (IsTemporary(node->lhs) && node->rhs->kind == ND_ADDR) {
+    IRVar *target = VarInRegister(cc, node->rhs->lhs);
+    if (target) {
+      // "tmp = &x" with x in a register. "*tmp" is x from now on.
+      IRVar *tmp = VarAt(cc, node->lhs->offset);
+      tmp->vreg = target->vreg;
+      tmp->is_alias = true;
+      return 0;
+    }
+  }
+
+  IRVar *var = VarInRegister(cc, node->lhs);
+  if (var) {
+    int val = LowerExpression(cc, node->rhs);
+    // A value just computed is computed into the variable instead.
+    IRInsn *last = cc->ir_block->last;
+    if (val > cc->ir_var_vregs && last && last->dst == val) {
+      last->dst = var->vreg;
+    } else {
+      AddIR(cc, IR_MOV, var->vreg, val, 0);
+    }
+    return var->vreg;
+  }
+
+  int addr = LowerAddress(cc, node->lhs);
+  int val = LowerExpression(cc, node->rhs);
+  AddIR(cc, IR_STORE, 0, addr, val);
+  return val;
+}
+
+/*
+ * Returns the virtual register holding the value of `node`, or 0 if it
+ * has no value.
+ */
+static int LowerExpression(Compiler *cc, Node *node) {
+  IRVar *var = VarInRegister(cc, node);
+  if (var) return var->vreg;
+
+  switch (node->kind) {
+    case ND_NUM:
+      return AddImm(cc, node->val);
+    case ND_LOCAL_VAR:
+    case ND_GLBL_VAR: {
+      int addr = LowerAddress(cc, node);
+      if (node->type->kind == TY_ARRAY) return addr;
+      int dst = NewVReg(cc);
+      AddIR(cc, IR_LOAD, dst, addr, 0);
+      return dst;
+    }
+    case ND_ASSIGN:
+      return LowerAssign(cc, node);
+    case ND_ADDR:
+      return LowerAddress(cc, node->lhs);
+    case ND_DEREF: {
+      int addr = LowerExpression(cc, node->lhs);
+      int dst = NewVReg(cc);
+      AddIR(cc, IR_LOAD, dst, addr, 0);
+      return dst;
+    }
+    case ND_COMMA:
+      LowerExpression(cc, node->lhs);
+      return LowerExpression(cc, node->rhs);
+    case ND_FUNC_CALL:
+      return LowerCall(cc, node);
+    case ND_VAR_DCLR:
+    case ND_FUNC_DECLARATION:
+      return 0;
+    default:
+      break;
+  }
+
+  IROp op = BinaryOp(cc, node->kind);
+  int a = LowerExpression(cc, node->lhs);
+  // A constant operand is taken as is, like "add rax, 1".
+  if (node->rhs->kind == ND_NUM && op != IR_DIV && op != IR_MOD) {
+    int dst = NewVReg(cc);
+    AddIR(cc, op, dst, a, 0)->imm = node->rhs->val;
+    return dst;
+  }
+  int b = LowerExpression(cc, node->rhs);
+  int dst = NewVReg(cc);
+  AddIR(cc, op, dst, a, b);
+  return dst;
+}
+
+// Jumps to `then_block` if `cond` is true, otherwise to `else_block`.
+static void LowerCondition(Compiler *cc, Node *cond, BasicBlock *then_block,
+                           BasicBlock *else_block) {
+  if (!cond) {
+    AddJump(cc, then_block);
+    return;
+  }
+  AddBranch(cc, LowerExpression(cc, cond), then_block, else_block);
+}
+
+/*
+ * Returns the virtual register holding the value of `node` if it's
+ * an expression, otherwise 0.
+ */
+static int LowerStatement(Compiler *cc, Node *node) {
+  switch (node->kind) {
+    case ND_RETURN:
+      AddIR(cc, IR_RET, 0, LowerExpression(cc, node->lhs), 0);
+      return 0;
+    case ND_IF: {
+      BasicBlock *then_block = NewBlock(cc);
+      BasicBlock *else_block = node->else_program ? NewBlock(cc) : NULL;
+      BasicBlock *end = NewBlock(cc);
+      LowerCondition(cc, node->condition, then_block,
+                     else_block ? else_block : end);
+      StartBlock(cc, then_block);
+      LowerStatement(cc, node->body_program);
+      if (else_block) {
+        AddJump(cc, end);
+        StartBlock(cc, else_block);
+        LowerStatement(cc, node->else_program);
+      }
+      StartBlock(cc, end);
+      return 0;
+    }
+    case ND_WHILE:
+    case ND_FOR: {
+      BasicBlock *body = NewBlock(cc);
+      BasicBlock *cond = NewBlock(cc);
+      BasicBlock *end = NewBlock(cc);
+      bool is_for = node->kind == ND_FOR;
+      if (is_for && node->initialization) {
+        LowerStatement(cc, node->initialization);
+      }
+      AddJump(cc, cond);
+      StartBlock(cc, body);
+      LowerStatement(cc, is_for ? node->body_program : node->rhs);
+      if (is_for && node->iteration) LowerStatement(cc, node->iteration);
+      StartBlock(cc, cond);
+      LowerCondition(cc, is_for ? node->condition : node->lhs, body, end);
+      StartBlock(cc, end);
+      return 0;
+    }
+    case ND_BLOCK:
+      for (Node *stmt = node->body_program; stmt; stmt = stmt->next_in_block) {
+        LowerStatement(cc, stmt);
+      }
+      return 0;
+    default:
+      return LowerExpression(cc, node);
+  }
+}
+
+// Unlinks the blocks that can't be reached from the entry.
+static void RemoveUnreachableBlocks(Compiler *cc, IRFunction *fn) {
+  int num_blocks = 0;
+  for (BasicBlock *block = fn->blocks; block; block = block->next) {
+    block->id = num_blocks++;
+  }
+
+  bool *reachable = calloc(num_blocks, sizeof(bool));
+  BasicBlock **stack = calloc(num_blocks, sizeof(BasicBlock *));
+  if (!reachable || !stack) {
+    free(reachable);
+    free(stack);
+    ExitWithError(cc, "Out of memory.");
+  }
+  int depth = 0;
+  reachable[0] = true;
+  stack[depth++] = fn->blocks;
+  while (depth) {
+    BasicBlock *succs[2];
+    int num_succs = Successors(stack[--depth], succs);
+    for (int i = 0; i < num_succs; ++i) {
+      if (reachable[succs[i]->id]) continue;
+      reachable[succs[i]->id] = true;
+      stack[depth++] = succs[i];
+    }
+  }
+
+  // The entry is reachable, so it's kept as the first block.
+  BasicBlock *last = fn->blocks;
+  fn->num_blocks = 1;
+  for (BasicBlock *block = last->next; block; block = block->next) {
+    if (!reachable[block->id]) continue;
+    block->id = fn->num_blocks++;
+    last->next = block;
+    last = block;
+  }
+  last->next = NULL;
+  fn->last_block = last;
+
+  free(stack);
+  free(reachable);
+}
+
+/*
+ * Marks the local variables whose address is taken in `node` and the
+ * statements after it. "tmp = &x" of "x += y" doesn't count, as "*tmp"
+ * can be x itself.
+ */
+static void FindEscapes(Compiler *cc, Node *node) {
+  for (; node; node = node->next_in_block) {
+    if (node->kind == ND_ASSIGN && IsTemporary(node->lhs) &&
+        node->rhs->kind == ND_ADDR && node->rhs->lhs->kind == ND_LOCAL_VAR) {
+      continue;
+    }
+    if (node->kind == ND_ADDR && node->lhs->kind == ND_LOCAL_VAR) {
+      VarAt(cc, node->lhs->offset)->escapes = true;
+    }
+    FindEscapes(cc, node->lhs);
+    FindEscapes(cc, node->rhs);
+    FindEscapes(cc, node->condition);
+    FindEscapes(cc, node->body_program);
+    FindEscapes(cc, node->else_program);
+    FindEscapes(cc, node->initialization);
+    FindEscapes(cc, node->iteration);
+    FindEscapes(cc, node->args);
+    FindEscapes(cc, node->arg_next);
+  }
+}
+
+/*
+ * Gives a virtual register to each local variable of `func` that
+ * doesn't escape, and a slot to each one that does. The slots are laid
+ * out again from rbp, except the parameters above it. Returns the size
+ * of them.
+ */
+static int PlaceVars(Compiler *cc, Node *func) {
+  int min_offset = 0;
+  int max_offset = 0;
+  for (Node *var = func->variable_next; var; var = var->variable_next) {
+    if (var->offset < min_offset) min_offset = var->offset;
+    if (var->offset > max_offset) max_offset = var->offset;
+  }
+  cc->ir_vars_base = min_offset;
+  cc->ir_vars = ArenaAlloc(cc, &cc->func_arena, AR_IR,
+                           ((max_offset - min_offset) / 8 + 1) * sizeof(IRVar));
+
+  for (Node *var = func->variable_next; var; var = var->variable_next) {
+    if (var->type->kind == TY_ARRAY) VarAt(cc, var->offset)->escapes = true;
+  }
+  FindEscapes(cc, func->next_in_block);
+
+  int frame_size = 0;
+  for (Node *var = func->variable_next; var; var = var->variable_next) {
+    IRVar *entry = VarAt(cc, var->offset);
+    if (!entry->escapes) entry->vreg = NewVReg(cc);
+    if (var->offset < 0) {
+      // Parameters passed on the stack stay where they are.
+      entry->offset = var->offset;
+    } else if (entry->escapes) {
+      // An array is its elements, from the lowest address.
+      frame_size += var->type->kind == TY_ARRAY ?
+                    8 * var->type->array_size : 8;
+      entry->offset = frame_size;
+    }
+  }
+  cc->ir_var_vregs = cc->ir->num_vregs;
+  return frame_size;
+}
+
+/*
+ * Lowers the function definition `func` into the IR. It's allocated in
+ * `cc->func_arena` with the AST.
+ */
+IRFunction *LowerFunction(Compiler *cc, Node *func) {
+  AddType(cc, func);
+
+  IRFunction *fn = ArenaAlloc(cc, &cc->func_arena, AR_IR, sizeof(IRFunction));
+  fn->name = func->func_name;
+  cc->ir = fn;
+  cc->ir_block = NULL;
+  fn->frame_size = PlaceVars(cc, func);
+  StartBlock(cc, NewBlock(cc));
+
+  // Parameters are linked from the last one.
+  Node **params = ArenaAlloc(cc, &cc->func_arena, AR_IR,
+                             (func->num_parameters + 1) * sizeof(Node *));
+  Node *param = func->param_next;
+  for (int i = func->num_parameters - 1; i >= 0; --i) {
+    params[i] = param;
+    param = param->param_next;
+  }
+
+  /*
+   * The parameters passed in registers are taken first, before any of
+   * the registers is reused. The others are in the stack frame of the
+   * caller, above rbp, and are loaded if they don't escape.
+   */
+  int num_in_registers = func->num_parameters < 6 ? func->num_parameters : 6;
+  int *values = ArenaAlloc(cc, &cc->func_arena, AR_IR,
+                           (num_in_registers + 1) * sizeof(int));
+  for (int i = 0; i < num_in_registers; ++i) {
+    IRVar *var = VarAt(cc, params[i]->offset);
+    values[i] = var->escapes ? NewVReg(cc) : var->vreg;
+    AddIR(cc, IR_PARAM, values[i], 0, 0)->imm = i;
+  }
+  for (int i = 0; i < func->num_parameters; ++i) {
+    IRVar *var = VarAt(cc, params[i]->offset);
+    if (var->escapes == (i >= num_in_registers)) continue;
+    int addr = NewVReg(cc);
+    AddIR(cc, IR_LOCAL_ADDR, addr, 0, 0)->imm = var->offset;
+    if (var->escapes) {
+      AddIR(cc, IR_STORE, 0, addr, values[i]);
+    } else {
+      AddIR(cc, IR_LOAD, var->vreg, addr, 0);
+    }
+  }
+
+  /*
+   * Like the stack machine, a function running to its end returns the
+   * value of the last statement if it's an expression, e.g. 3 for
+   * "int main() {int a; a=3;}". Otherwise it returns 0.
+   */
+  int last_value = 0;
+  for (Node *stmt = func->next_in_block; stmt; stmt = stmt->next_in_block) {
+    int value = LowerStatement(cc, stmt);
+    if (stmt->kind != ND_VAR_DCLR) last_value = value;
+  }
+  AddIR(cc, IR_RET, 0, last_value ? last_value : AddImm(cc, 0), 0);
+
+  RemoveUnreachableBlocks(cc, fn);
+  cc->ir = NULL;
+  cc->ir_block = NULL;
+  cc->ir_vars = NULL;
+  return fn;
+}
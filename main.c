@@ -1,49 +1,201 @@
 /* Copyright 2021 Keita Morisaki. All rights reserved. */
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "./jcc.h"
 
+// Compilation whose output is discarded if jcc exits with an error.
+static Compiler *active_compiler;
+
+static void DiscardOutput() {
+  if (active_compiler) EmitDiscard(active_compiler);
+}
+
+static void PrintUsage() {
+  fprintf(stderr,
+          "Usage: jcc [-c] [-O<level>] [-o <file>] [-fverbose-asm] "
+          "[--arena-stats] [--stats] [--cache-dir <dir>] <input>\n"
+          "       jcc [-c] [-O<level>] [-j <threads>] [-o <dir>] "
+          "[-fverbose-asm] [--stats] [--cache-dir <dir>] <file>.c...\n"
+          "  <input> is a file ending with \".c\", \"-\" for stdin,\n"
+          "  or otherwise the program itself.\n"
+          "  Several files, or a directory given to -o, compile each\n"
+          "  <file>.c to <dir>/<file>.s (.o with -c) on <threads> threads\n"
+          "  (by default as many as the CPUs).\n"
+          "  For one file, -j generates the code of its functions\n"
+          "  on <threads> threads.\n"
+          "  -c writes an ELF object instead of assembly.\n"
+          "  -O1 (or -O) compiles the functions through the IR,\n"
+          "  -O0 (the default) directly from the syntax tree.\n"
+          "  --dump-ir writes the IR of the functions instead of assembly.\n"
+          "       jcc [-O<level>] --run <input>\n"
+          "  runs the program in memory, exiting with what main returns.\n"
+          "  --cache-dir keeps the code of the functions in <dir>, and\n"
+          "  reuses it for the functions unchanged since.\n");
+}
+
+static bool IsDirectory(char *path) {
+  struct stat st;
+  return !stat(path, &st) && S_ISDIR(st.st_mode);
+}
+
 int main(int argc, char **argv) {
-  if (argc != 2) {
-    fprintf(stderr, "Exactly one argument must be passed.\n");
-    return 1;
-  }
+  Compiler compiler;
+  Compiler *cc = &compiler;
+  InitCompiler(cc);
+
+  bool arena_stats = false;
+  char *output_path = NULL;   // stdout if NULL
+  int num_threads = 0;        // number of the CPUs if 0
+  char **inputs = calloc(argc, sizeof(char *));
+  int num_inputs = 0;
+
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--arena-stats")) {
+      arena_stats = true;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "--stats")) {
+      cc->stats_enabled = true;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "-c")) {
+      cc->output_format = OUTPUT_OBJECT;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "--run")) {
+      cc->output_format = OUTPUT_RUN;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "--dump-ir")) {
+      cc->output_format = OUTPUT_IR;
+      continue;
+    }
 
-  user_input = argv[1];
-  Tokenize();
-  BuildAST();
+    // "-O" is "-O1". Any level above 1 is the same as 1.
+    if (!strncmp(argv[i], "-O", 2)) {
+      char *level = argv[i] + 2;
+      if (*level && strspn(level, "0123456789") != strlen(level)) {
+        fprintf(stderr, "\"%s\" is not an optimization level.\n", argv[i]);
+        PrintUsage();
+        return 1;
+      }
+      cc->opt_level = *level ? atoi(level) : 1;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "-fverbose-asm")) {
+      cc->verbose_asm = true;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "--cache-dir")) {
+      if (++i == argc) {
+        fprintf(stderr, "Missing directory after \"--cache-dir\".\n");
+        PrintUsage();
+        return 1;
+      }
+      cc->cache_dir = argv[i];
+      continue;
+    }
 
-  printf(".intel_syntax noprefix\n");
-  printf(".globl main\n");
+    if (!strcmp(argv[i], "-o")) {
+      if (++i == argc) {
+        fprintf(stderr, "Missing file name after \"-o\".\n");
+        PrintUsage();
+        return 1;
+      }
+      output_path = argv[i];
+      continue;
+    }
 
-  for (int i = 0; programs[i]; ++i) {
-    printf("  # programs[%d] starts.\n", i);
-    if (PrintAssembly(programs[i])) {
-      /*
-       * "pop" if there is any remaining value at the top
-       * to prevent stack overflow
-       */
-      printf("  pop rax\n");
+    // "-j <threads>" or "-j<threads>"
+    if (!strncmp(argv[i], "-j", 2)) {
+      char *arg = argv[i][2] ? argv[i] + 2 : argv[++i];
+      num_threads = arg ? atoi(arg) : 0;
+      if (num_threads <= 0) {
+        fprintf(stderr, "\"-j\" needs a positive number of threads.\n");
+        PrintUsage();
+        return 1;
+      }
+      continue;
     }
+
+    inputs[num_inputs++] = argv[i];
   }
 
-  if (!globals)
-    return 0;
+  if (!num_inputs) {
+    PrintUsage();
+    return 1;
+  }
 
-  DBGPRNT;
-  printf("\n");
-  printf(".data\n");
-  for (Node *var = globals->variable_next; var; var=var->variable_next) {
-    printf("%.*s:\n", var->var_name_len, var->var_name);
+  if (cc->output_format == OUTPUT_RUN && (num_inputs > 1 || output_path)) {
+    fprintf(stderr, "\"--run\" takes one program and writes no file.\n");
+    PrintUsage();
+    return 1;
+  }
 
-    // TODO(k1832): Replace with GetSize
-    int size = 8;
-    if (var->type->array_size) {
-      size *= var->type->array_size;
+  if (num_inputs > 1 || (output_path && IsDirectory(output_path))) {
+    for (int i = 0; i < num_inputs; ++i) {
+      if (!EndsWith(inputs[i], ".c")) {
+        fprintf(stderr, "\"%s\" is not a file ending with \".c\".\n",
+                inputs[i]);
+        PrintUsage();
+        return 1;
+      }
     }
-    printf("  .zero %d\n", size);
+    if (!num_threads) num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_threads <= 0) num_threads = 1;
+
+    int status = CompileFiles(inputs, num_inputs,
+                              output_path ? output_path : ".", num_threads,
+                              cc);
+    free(inputs);
+    return status;
+  }
+  char *input_arg = inputs[0];
+  free(inputs);
+  cc->codegen_threads = num_threads;
+
+  active_compiler = cc;
+  atexit(DiscardOutput);
+
+  EnterPhase(cc, PH_INPUT);
+  LoadInput(cc, input_arg);
+  LeavePhase(cc);
+
+  bool run = cc->output_format == OUTPUT_RUN;
+  if (!run) EmitOpen(cc, output_path);
+  Compile(cc);
+
+  if (!run) {
+    EnterPhase(cc, PH_OUTPUT);
+    EmitClose(cc);
+    LeavePhase(cc);
+  }
+
+  if (arena_stats) {
+    PrintArenaStats(&cc->arena, stderr);
+    fprintf(stderr, "%-8s %12zu %12d\n", "token",
+            cc->num_tokens * sizeof(Token), cc->num_tokens);
+    // "reserved" of this one is the peak over all the functions.
+    fprintf(stderr, "\nfunction bodies:\n");
+    PrintArenaStats(&cc->func_arena, stderr);
+  }
+  if (cc->stats_enabled) {
+    PrintStats(cc, stderr);
   }
 
-  return 0;
+  int status = run ? RunObject(cc) : 0;
+  ReleaseCompiler(cc);
+  return status;
 }
@@ -0,0 +1,239 @@
+/* Copyright 2022 Keita Morisaki. All rights reserved. */
+/*
+ * Code generation of the top-level items on several threads.
+ *
+ * The calling thread parses the items one by one, as usual. Each item
+ * is parsed into the arena of a slot, and the code of the slot is then
+ * generated by whichever thread is free, into the output buffer of the
+ * slot. The calling thread writes the buffers out in the order of the
+ * items, so the output is the same as generating on one thread. Labels
+ * are numbered per item (see `GenerateItem`), which is what makes the
+ * items independent.
+ *
+ * There are a few slots per thread, so that parsing can run ahead of
+ * code generation, and a slot is reused once its code is written out.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./jcc.h"
+
+#define SLOTS_PER_THREAD 4
+
+typedef struct {
+  /*
+   * Only its arena, options and output are used. The arena holds
+   * the AST of `item` and the types added to it while generating.
+   */
+  Compiler cc;
+  Node *item;
+  int index;    // of `item` in the program
+  bool done;    // the code is in `cc.out_buffer`
+  bool failed;  // with the message in `cc.error_message`
+} Slot;
+
+typedef struct {
+  Slot *slots;
+  int num_slots;
+  pthread_t *threads;   // other than the calling one
+  int num_threads;
+
+  pthread_mutex_t mutex;
+  pthread_cond_t parsed;      // signaled when `num_parsed` increases
+  pthread_cond_t generated;   // signaled when a slot gets `done`
+  int num_parsed;       // number of items whose slots are ready
+  int num_taken;        // number of items a thread started to generate
+  bool parse_finished;  // no more items are coming
+} Pool;
+
+static Slot *SlotOf(Pool *pool, int index) {
+  return &pool->slots[index % pool->num_slots];
+}
+
+// Called with `pool->mutex` held, which is released meanwhile.
+static void GenerateTakenItem(Pool *pool, Slot *slot) {
+  pthread_mutex_unlock(&pool->mutex);
+
+  Compiler *cc = &slot->cc;
+  jmp_buf on_error;
+  cc->error_jmp = &on_error;
+  if (setjmp(on_error)) {
+    slot->failed = true;
+  } else {
+    EmitOpenMemory(cc);
+    GenerateItem(cc, slot->item, slot->index);
+  }
+  cc->error_jmp = NULL;
+
+  pthread_mutex_lock(&pool->mutex);
+  slot->done = true;
+  pthread_cond_broadcast(&pool->generated);
+}
+
+static void *Worker(void *arg) {
+  Pool *pool = arg;
+
+  pthread_mutex_lock(&pool->mutex);
+  for (;;) {
+    if (pool->num_taken < pool->num_parsed) {
+      GenerateTakenItem(pool, SlotOf(pool, pool->num_taken++));
+      continue;
+    }
+    if (pool->parse_finished) break;
+    pthread_cond_wait(&pool->parsed, &pool->mutex);
+  }
+  pthread_mutex_unlock(&pool->mutex);
+  return NULL;
+}
+
+/*
+ * Waits until the code of the `index`th item is generated, helping
+ * with the items not taken by any thread yet.
+ */
+static void WaitGenerated(Pool *pool, int index) {
+  Slot *slot = SlotOf(pool, index);
+
+  pthread_mutex_lock(&pool->mutex);
+  while (!slot->done) {
+    if (pool->num_taken < pool->num_parsed) {
+      GenerateTakenItem(pool, SlotOf(pool, pool->num_taken++));
+    } else {
+      pthread_cond_wait(&pool->generated, &pool->mutex);
+    }
+  }
+  pthread_mutex_unlock(&pool->mutex);
+}
+
+// Writes out the code of the `index`th item, whose slot is free after.
+static void WriteGenerated(Compiler *cc, Pool *pool, int index) {
+  Slot *slot = SlotOf(pool, index);
+  if (slot->failed) {
+    memcpy(cc->error_message, slot->cc.error_message,
+           sizeof(cc->error_message));
+    ExitWithSavedError(cc);
+  }
+  if (slot->cc.out_buffer_used) {
+    EmitBytes(cc, slot->cc.out_buffer, slot->cc.out_buffer_used);
+  }
+}
+
+static void ShutDown(Compiler *cc, Pool *pool) {
+  pthread_mutex_lock(&pool->mutex);
+  pool->parse_finished = true;
+  // Items left to be generated are dropped.
+  pool->num_taken = pool->num_parsed;
+  pthread_cond_broadcast(&pool->parsed);
+  pthread_mutex_unlock(&pool->mutex);
+
+  for (int i = 0; i < pool->num_threads; ++i) {
+    pthread_join(pool->threads[i], NULL);
+  }
+
+  for (int i = 0; i < pool->num_slots; ++i) {
+    ArenaAddStats(&cc->func_arena, &pool->slots[i].cc.func_arena);
+    cc->folded_nodes += pool->slots[i].cc.folded_nodes;
+    for (int r = 0; r < NUM_PEEPHOLE_RULES; ++r) {
+      cc->peephole_hits[r] += pool->slots[i].cc.peephole_hits[r];
+    }
+    ReleaseCompiler(&pool->slots[i].cc);
+  }
+  pthread_cond_destroy(&pool->generated);
+  pthread_cond_destroy(&pool->parsed);
+  pthread_mutex_destroy(&pool->mutex);
+  free(pool->threads);
+  free(pool->slots);
+  free(pool);
+}
+
+/*
+ * Parses and generates the code of all the items of the program
+ * on `cc->codegen_threads` threads, including the calling one.
+ */
+void GenerateInParallel(Compiler *cc) {
+  // On the heap, as it's modified after `setjmp`.
+  Pool *pool = calloc(1, sizeof(Pool));
+  if (!pool) {
+    ExitWithError(cc, "Out of memory.");
+  }
+  pool->num_slots = cc->codegen_threads * SLOTS_PER_THREAD;
+  pool->slots = calloc(pool->num_slots, sizeof(Slot));
+  pool->threads = calloc(cc->codegen_threads - 1, sizeof(pthread_t));
+  if (!pool->slots || !pool->threads) {
+    free(pool->slots);
+    free(pool->threads);
+    free(pool);
+    ExitWithError(cc, "Out of memory.");
+  }
+  for (int i = 0; i < pool->num_slots; ++i) {
+    InitCompiler(&pool->slots[i].cc);
+    CopyOptions(&pool->slots[i].cc, cc);
+    pool->slots[i].cc.stats_enabled = false;
+    pool->slots[i].cc.codegen_threads = 1;
+  }
+  pthread_mutex_init(&pool->mutex, NULL);
+  pthread_cond_init(&pool->parsed, NULL);
+  pthread_cond_init(&pool->generated, NULL);
+
+  while (pool->num_threads < cc->codegen_threads - 1 &&
+         !pthread_create(&pool->threads[pool->num_threads], NULL, Worker,
+                         pool)) {
+    ++pool->num_threads;
+  }
+
+  /*
+   * Errors are caught here to stop the threads first, and then passed
+   * on to the original `error_jmp`.
+   */
+  jmp_buf *outer_error_jmp = cc->error_jmp;
+  jmp_buf on_error;
+  cc->error_jmp = &on_error;
+  if (setjmp(on_error)) {
+    cc->error_jmp = outer_error_jmp;
+    ShutDown(cc, pool);
+    ExitWithSavedError(cc);
+  }
+
+  int num_items = 0;
+  for (;; ++num_items) {
+    EnterPhase(cc, PH_PARSE);
+    Node *item = ParseNextItem(cc);
+    LeavePhase(cc);
+    if (!item) break;
+
+    // The slot is free once the item parsed into it last time is written.
+    Slot *slot = SlotOf(pool, num_items);
+    if (num_items >= pool->num_slots) {
+      WaitGenerated(pool, num_items - pool->num_slots);
+      WriteGenerated(cc, pool, num_items - pool->num_slots);
+    }
+
+    /*
+     * The item moves to the slot with its arena. The parser gets
+     * the arena of the item written out, and resets it.
+     */
+    Arena ast_arena = cc->func_arena;
+    cc->func_arena = slot->cc.func_arena;
+    slot->cc.func_arena = ast_arena;
+    slot->item = item;
+    slot->index = num_items;
+    slot->done = false;
+
+    pthread_mutex_lock(&pool->mutex);
+    ++pool->num_parsed;
+    pthread_cond_signal(&pool->parsed);
+    pthread_mutex_unlock(&pool->mutex);
+  }
+
+  int first_unwritten =
+      num_items > pool->num_slots ? num_items - pool->num_slots : 0;
+  for (int i = first_unwritten; i < num_items; ++i) {
+    WaitGenerated(pool, i);
+    WriteGenerated(cc, pool, i);
+  }
+
+  cc->error_jmp = outer_error_jmp;
+  ShutDown(cc, pool);
+}
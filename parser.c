@@ -8,35 +8,42 @@
 
 #include "./jcc.h"
 
-#define PROGRAM_LEN 100
-
-Node *programs[PROGRAM_LEN];
-Node *current_scope;
-
-Node *globals;
-
 /*** token processor ***/
 // DEBUG
-// static void DebugToken(char *s) {
-//   printf("%s token: %.*s\n", s, token->len, token->str);
+// static void DebugToken(Compiler *cc, char *s) {
+//   printf("%s token: %.*s\n", s, Peek(cc, 0)->len, Peek(cc, 0)->str);
 // }
 
-static bool ReservedTokenMatches(char *op) {
-  return token->kind == TK_RESERVED &&
-    token->len == strlen(op) &&
-    StartsWith(token->str, op);
+/*
+ * Returns the token `k` tokens ahead of the current one.
+ * Peeking beyond the end of the program returns the TK_EOF token.
+ */
+Token *Peek(Compiler *cc, int k) {
+  int i = cc->token_pos + k;
+  if (i >= cc->num_tokens) i = cc->num_tokens - 1;
+  return &cc->tokens[i];
+}
+
+static bool IsReserved(Token *tok, char *op) {
+  return tok->kind == TK_RESERVED &&
+    tok->len == strlen(op) &&
+    StartsWith(tok->str, op);
 }
 
-static void ConsumeToken() {
-  token = token->next;
+static bool ReservedTokenMatches(Compiler *cc, char *op) {
+  return IsReserved(Peek(cc, 0), op);
 }
 
-static bool ConsumeIfReservedTokenMatches(char *op) {
-  if (!ReservedTokenMatches(op)) {
+static void ConsumeToken(Compiler *cc) {
+  if (Peek(cc, 0)->kind != TK_EOF) ++cc->token_pos;
+}
+
+static bool ConsumeIfReservedTokenMatches(Compiler *cc, char *op) {
+  if (!ReservedTokenMatches(cc, op)) {
     return false;
   }
 
-  ConsumeToken();
+  ConsumeToken(cc);
   return true;
 }
 
@@ -44,22 +51,22 @@ static bool ConsumeIfReservedTokenMatches(char *op) {
  * Consume a token only if the token is TK_IDENT.
  * Return the consumed identifier-token, but not the next generated token.
  */
-static Token *ConsumeAndGetIfIdent() {
-  if (token->kind != TK_IDENT) {
+static Token *ConsumeAndGetIfIdent(Compiler *cc) {
+  if (Peek(cc, 0)->kind != TK_IDENT) {
     return NULL;
   }
 
-  Token *ident_token = token;
-  ConsumeToken();
+  Token *ident_token = Peek(cc, 0);
+  ConsumeToken(cc);
   return ident_token;
 }
 
-static bool ConsumeIfKindMatches(TokenKind kind) {
-  if (token->kind != kind) {
+static bool ConsumeIfKindMatches(Compiler *cc, TokenKind kind) {
+  if (Peek(cc, 0)->kind != kind) {
     return false;
   }
 
-  ConsumeToken();
+  ConsumeToken(cc);
   return true;
 }
 
@@ -70,76 +77,98 @@ static bool ConsumeIfKindMatches(TokenKind kind) {
  */
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wreturn-type"
-static Token *ExpectIdentifier() {
-  Token *tok = ConsumeAndGetIfIdent();
+static Token *ExpectIdentifier(Compiler *cc) {
+  Token *tok = ConsumeAndGetIfIdent(cc);
   if (tok) return tok;
 
-  ExitWithErrorAt(user_input, token->str, "Expected identifier.");
+  ExitWithErrorAt(cc, Peek(cc, 0)->str, "Expected identifier.");
 }
 #pragma GCC diagnostic pop
 
-static void Expect(char *op) {
-  if (ConsumeIfReservedTokenMatches(op)) return;
+static void Expect(Compiler *cc, char *op) {
+  if (ConsumeIfReservedTokenMatches(cc, op)) return;
 
-  ExitWithErrorAt(user_input, token->str, "Expected `%c`.", *op);
+  ExitWithErrorAt(cc, Peek(cc, 0)->str, "Expected `%c`.", *op);
 }
 
-static bool IsNextTokenNumber() {
-  return token->kind == TK_NUM;
+static bool IsNextTokenNumber(Compiler *cc) {
+  return Peek(cc, 0)->kind == TK_NUM;
 }
 
-static int ExpectNumber() {
-  if (!IsNextTokenNumber()) {
-    ExitWithErrorAt(user_input, token->str, "Expected a number.");
+static int ExpectNumber(Compiler *cc) {
+  if (!IsNextTokenNumber(cc)) {
+    ExitWithErrorAt(cc, Peek(cc, 0)->str, "Expected a number.");
   }
 
-  int val = token->val;
-  token = token->next;
+  int val = Peek(cc, 0)->val;
+  ConsumeToken(cc);
   return val;
 }
 /*** token processor ***/
 
 
-static bool AtEOF() {
-  return token->kind == TK_EOF;
+static bool AtEOF(Compiler *cc) {
+  return Peek(cc, 0)->kind == TK_EOF;
 }
 
-static void ValidateTypeToken() {
-  if (IsTypeToken()) return;
+static void ValidateTypeToken(Compiler *cc) {
+  if (IsTypeToken(Peek(cc, 0))) return;
 
-  ExitWithErrorAt(user_input, token->str, "Expected a type token.");
+  ExitWithErrorAt(cc, Peek(cc, 0)->str, "Expected a type token.");
 }
 
+/*
+ * Returns true iff the tokens from the current one are
+ * "int" "*"* identifier "("
+ * i.e. the beginning of a function definition or prototype.
+ */
+static bool IsFuncDefinitionAhead(Compiler *cc) {
+  if (!IsTypeToken(Peek(cc, 0))) return false;
+
+  int k = 1;
+  while (IsReserved(Peek(cc, k), "*")) ++k;
+  return Peek(cc, k)->kind == TK_IDENT && IsReserved(Peek(cc, k + 1), "(");
+}
 
-static Node *NewNode(NodeKind kind) {
-  Node *node = calloc(1, sizeof(Node));
+
+/*
+ * Arena for objects being parsed. Everything inside a function
+ * is freed once the function is emitted, while global variables
+ * and the return types of functions live until the end.
+ */
+static Arena *ParseArena(Compiler *cc) {
+  return cc->current_func ? &cc->func_arena : &cc->arena;
+}
+
+static Node *NewNode(Compiler *cc, NodeKind kind) {
+  Node *node = ArenaAlloc(cc, ParseArena(cc), AR_NODE, sizeof(Node));
   node->kind = kind;
   return node;
 }
 
-static Node *NewNodeNumber(int val) {
-  Node *node = NewNode(ND_NUM);
+static Node *NewNodeNumber(Compiler *cc, int val) {
+  Node *node = NewNode(cc, ND_NUM);
   node->val = val;
   return node;
 }
 
-static Node *NewBinary(NodeKind kind, Node *lhs, Node *rhs) {
-  Node *node = NewNode(kind);
+static Node *NewBinary(Compiler *cc, NodeKind kind, Node *lhs, Node *rhs) {
+  Node *node = NewNode(cc, kind);
   node->lhs = lhs;
   node->rhs = rhs;
   return node;
 }
 
-static Node *NewUnary(NodeKind kind, Node *nd) {
-  Node *node = NewNode(kind);
+static Node *NewUnary(Compiler *cc, NodeKind kind, Node *nd) {
+  Node *node = NewNode(cc, kind);
   node->lhs = nd;
   return node;
 }
 
 
-int GetSize(Type *ty) {
+int GetSize(Compiler *cc, Type *ty) {
   if (!ty) {
-    ExitWithError("Type is not determined for this node.");
+    ExitWithError(cc, "Type is not determined for this node.");
     return 0;   // To make cpplint happy
   }
 
@@ -149,53 +178,58 @@ int GetSize(Type *ty) {
     case TY_INT:
       return 4;
     case TY_ARRAY:
-      return GetSize(ty->point_to) * (int)ty->array_size;
+      return GetSize(cc, ty->point_to) * (int)ty->array_size;
     default:
-      ExitWithError("\"sizeof\" this type is not defined.");
+      ExitWithError(cc, "\"sizeof\" this type is not defined.");
       return 0;   // To make cpplint happy
   }
 }
 
 
 /*** Variable declaration ***/
-static Node *GetDeclaredInScope(Node *scope, Token *tok) {
-  if (!scope) return NULL;
-
-  for (
-    Node *local = scope->variable_next;
-    local;
-    local = local->variable_next
-  ) {
-    if (local->var_name_len != tok->len) continue;
-    if (strncmp(local->var_name, tok->str, local->var_name_len)) continue;
-    return local;
-  }
-  return NULL;
+static void EnterScope(Compiler *cc, Scope *scope) {
+  *scope = (Scope){0};
+  scope->parent = cc->current_scope;
+  cc->current_scope = scope;
+}
+
+static void LeaveScope(Compiler *cc) {
+  Scope *scope = cc->current_scope;
+  cc->current_scope = scope->parent;
+  SymbolTableRelease(&scope->vars);
+}
+
+static Node *GetDeclaredInScope(Scope *scope, Token *tok) {
+  return SymbolTableGet(&scope->vars, tok->ident);
+}
+
+// Makes `lval` visible by its name in the innermost scope.
+static void DeclareInCurrentScope(Compiler *cc, Node *lval) {
+  SymbolTablePut(cc, &cc->current_scope->vars, lval->var_name, lval);
 }
 
 /*
  * Declares new local variable. `array_size` is used
  * only when the `type` is `TY_ARRAY`
  */
-static Node *NewLVal(Node *var_scope,
+static Node *NewLVal(Compiler *cc, Node *var_scope,
                      Token *ident,
                      Type *type,
                      size_t array_size) {
-  Node *lval = NewNode(ND_VAR_DCLR);
+  Node *lval = NewNode(cc, ND_VAR_DCLR);
 
   /*
    * When ident is NULL, it's a temporary variable
    * and ident->str and ident->len will be useless
    */
   if (ident) {
-    lval->var_name = ident->str;
-    lval->var_name_len = ident->len;
+    lval->var_name = ident->ident;
   }
 
   lval->type = type;
   if (lval->type->kind == TY_ARRAY) {
     if (!array_size) {
-      ExitWithErrorAt(user_input, ident->str,
+      ExitWithErrorAt(cc, ident->str,
                       "Array size must not be 0\n");
     }
     lval->type->array_size = array_size;
@@ -246,23 +280,27 @@ static Node *NewLVal(Node *var_scope,
 
 /*
  * Gets lval node from identifier and set offset for it,
- * then returns the node
+ * then returns the node.
+ * The innermost declaration of the name is used.
  */
-static Node *GetLValNodeFromIdent(Node *scope, Token *ident) {
-  if (!scope) return NULL;
-
-  NodeKind node_kind = ND_LOCAL_VAR;
-  if (globals && scope == globals) {
-    node_kind = ND_GLBL_VAR;
+static Node *GetLValNodeFromIdent(Compiler *cc, Token *ident) {
+  Scope *scope = cc->current_scope;
+  Node *local = NULL;
+  for (; scope; scope = scope->parent) {
+    local = GetDeclaredInScope(scope, ident);
+    if (local) break;
   }
 
-  Node *lval = NewNode(node_kind);
-  Node *local = GetDeclaredInScope(scope, ident);
   if (!local) {
     return NULL;
   }
 
-  lval->var_name_len = local->var_name_len;
+  NodeKind node_kind = ND_LOCAL_VAR;
+  if (scope == &cc->global_scope) {
+    node_kind = ND_GLBL_VAR;
+  }
+
+  Node *lval = NewNode(cc, node_kind);
   lval->var_name = local->var_name;
 
   lval->offset = local->offset;
@@ -274,40 +312,40 @@ static Node *GetLValNodeFromIdent(Node *scope, Token *ident) {
 
 /*** function call/definition ***/
 /*
- * Can be called with ND_FUNC_CALL or ND_FUNC_DEFINITION.
- * This function compares 2 nodes and return true iff
- * 2 nodes have the same function name.
+ * Registers the function declared by `nd_func`, or checks that
+ * it agrees with the previous declaration of the same name.
  */
-static bool FuncNamesMatch(Node *nd_a, Node *nd_b) {
-  assert(nd_a && nd_b);
-  assert(nd_a->kind == ND_FUNC_CALL || nd_a->kind == ND_FUNC_DEFINITION);
-  assert(nd_b->kind == ND_FUNC_CALL || nd_b->kind == ND_FUNC_DEFINITION);
+static Function *DeclareFunction(Compiler *cc, Node *nd_func, Token *name) {
+  Function *func = SymbolTableGet(&cc->functions, name->ident);
+  if (!func) {
+    func = ArenaAlloc(cc, &cc->arena, AR_FUNCTION, sizeof(Function));
+    func->name = name->ident;
+    func->ret_type = nd_func->ret_type;
+    func->num_parameters = nd_func->num_parameters;
+    SymbolTablePut(cc, &cc->functions, name->ident, func);
+    return func;
+  }
 
-  if (nd_a->func_name_len != nd_b->func_name_len) return false;
-  return !strncmp(nd_a->func_name, nd_b->func_name, nd_a->func_name_len);
+  if (func->num_parameters != nd_func->num_parameters ||
+      !IsSameType(func->ret_type, nd_func->ret_type)) {
+    ExitWithErrorAt(cc, name->str,
+      "Conflicting declaration of function \"%.*s\"",
+      name->len, name->str);
+  }
+  return func;
 }
 
 // Make sure one parameter name is used only once at most.
-static void ValidateParamName(Node *nd_func, Token *new_param) {
+static void ValidateParamName(Compiler *cc, Node *nd_func, Token *new_param) {
   assert(nd_func->kind == ND_FUNC_DEFINITION);
   assert(new_param->kind == TK_IDENT);
 
-  Node *param = nd_func->param_next;
-  while (param) {
-    if (new_param->len != param->var_name_len) {
-      param = param->param_next;
-      continue;
-    }
-
-    if (memcmp(new_param->str, param->var_name, new_param->len)) {
-      param = param->param_next;
-      continue;
-    }
+  // Parameters are declared in the function scope.
+  if (!GetDeclaredInScope(cc->current_scope, new_param)) return;
 
-    ExitWithErrorAt(user_input, new_param->str,
-      "This parameter name is used more than once: \"%.*s\"",
-      new_param->len, new_param->str);
-  }
+  ExitWithErrorAt(cc, new_param->str,
+    "This parameter name is used more than once: \"%.*s\"",
+    new_param->len, new_param->str);
 }
 
 /*
@@ -318,12 +356,14 @@ static void ValidateParamName(Node *nd_func, Token *new_param) {
  * actual arguments to the stack frame
  * when the function is called.
  */
-static void NewFuncParam(Node *nd_func, Token *ident, Type *type) {
+static void NewFuncParam(Compiler *cc, Node *nd_func, Token *ident,
+                         Type *type) {
   assert(nd_func->kind == ND_FUNC_DEFINITION);
 
   ++(nd_func->argc);
   ++(nd_func->num_parameters);
-  Node *local = NewLVal(nd_func, ident, type, 0);
+  Node *local = NewLVal(cc, nd_func, ident, type, 0);
+  DeclareInCurrentScope(cc, local);
 
   if (nd_func->argc > 6) {
     /*
@@ -346,8 +386,8 @@ static void NewFuncParam(Node *nd_func, Token *ident, Type *type) {
 
 static void NewArg(Node *nd_func_call, Node *new_arg) {
   // Add new argument at the head of linked list
-  new_arg->arg_next = nd_func_call->arg_next;
-  nd_func_call->arg_next = new_arg;
+  new_arg->arg_next = nd_func_call->args;
+  nd_func_call->args = new_arg;
 }
 /*** function call/definition ***/
 
@@ -360,17 +400,17 @@ static void NewArg(Node *nd_func_call, Node *new_arg) {
  */
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wreturn-type"
-Type *GetType() {
-  assert(IsTypeToken());
+Type *GetType(Compiler *cc) {
+  assert(IsTypeToken(Peek(cc, 0)));
 
   // TK_INT,
-  Token *base_type_token = token;
-  ConsumeToken();  // Skip base type token for now
+  Token *base_type_token = Peek(cc, 0);
+  ConsumeToken(cc);  // Skip base type token for now
 
-  Type *type = calloc(1, sizeof(Type));
+  Type *type = ArenaAlloc(cc, ParseArena(cc), AR_TYPE, sizeof(Type));
   Type *current = type;
-  while (ConsumeIfReservedTokenMatches("*")) {
-    Type *point_to = calloc(1, sizeof(Type));
+  while (ConsumeIfReservedTokenMatches(cc, "*")) {
+    Type *point_to = ArenaAlloc(cc, ParseArena(cc), AR_TYPE, sizeof(Type));
     current->kind = TY_PTR;
     current->point_to = point_to;
     current = point_to;
@@ -382,34 +422,41 @@ Type *GetType() {
     return type;
 
   default:
-    ExitWithErrorAt(user_input, base_type_token->str, "Unsupported type.");
+    ExitWithErrorAt(cc, base_type_token->str, "Unsupported type.");
   }
 }
 #pragma GCC diagnostic pop
 
-void BuildAST();
-static Node *Program();
-static Node *Statement();
-static Node *VariableDeclaration();
-static Node *Expression();
-static Node *Assignment();
-static Node *Equality();
-static Node *Relational();
-static Node *Add();
-static Node *MulDiv();
-static Node *Unary();
-static Node *Dereferenceable();
-static Node *LVal();
-static Node *Primary();
-
-void BuildAST() {
-  int i = 0;
-  while (!AtEOF()) {
-    if (i >= PROGRAM_LEN - 1)
-      ExitWithErrorAt(user_input, token->str, "Exceeds max length of program.");
-    programs[i++] = Program();
-  }
-  programs[i] = NULL;
+static Node *Program(Compiler *cc);
+static Node *Statement(Compiler *cc);
+static Node *FuncDefinition(Compiler *cc);
+static Node *VariableDeclaration(Compiler *cc);
+static Node *Expression(Compiler *cc);
+static Node *Assignment(Compiler *cc);
+static Node *Equality(Compiler *cc);
+static Node *Relational(Compiler *cc);
+static Node *Add(Compiler *cc);
+static Node *MulDiv(Compiler *cc);
+static Node *Unary(Compiler *cc);
+static Node *Dereferenceable(Compiler *cc);
+static Node *LVal(Compiler *cc);
+static Node *FuncCall(Compiler *cc);
+static Node *Primary(Compiler *cc);
+
+/*
+ * Parses the next top-level item, or returns NULL at the end of the
+ * program. The AST of the previous item is freed, so it must have
+ * been emitted before this is called.
+ */
+Node *ParseNextItem(Compiler *cc) {
+  ArenaReset(&cc->func_arena);
+
+  if (AtEOF(cc)) {
+    SymbolTableRelease(&cc->global_scope.vars);
+    SymbolTableRelease(&cc->functions);
+    return NULL;
+  }
+  return Program(cc);
 }
 
 /*
@@ -418,12 +465,12 @@ void BuildAST() {
  *   Expression ";"
  */
 
-static Node *Program() {
-  Node *program = Statement();
+static Node *Program(Compiler *cc) {
+  Node *program = Statement(cc);
   if (program) return program;
 
-  Node *expression = Expression();
-  Expect(";");
+  Node *expression = Expression(cc);
+  Expect(cc, ";");
   return expression;
 }
 
@@ -437,222 +484,264 @@ static Node *Program() {
  *  "while" "(" Expression ")" Program
  *  "for" "(" Expression? ";" Expression? ";" Expression? ")" Program |
  *  "{" Program* "}" |
- *  VariableDeclaration |
- *  "int" "*"* identifier "(" ( "int" "*"* identifier ("," "int" "*"* identifier )? ")" "{"
- *    Program*
- *  "}"
+ *  FuncDefinition |
+ *  VariableDeclaration
  *
  */
-static Node *Statement() {
-  if (ConsumeIfKindMatches(TK_RETURN)) {
-    Node *lhs = Expression();
-    Expect(";");
-    return NewUnary(ND_RETURN, lhs);
-  }
-
-  if (ConsumeIfKindMatches(TK_IF)) {
-    Node *if_node = NewNode(ND_IF);
-    Expect("(");
-    if_node->condition = Expression();
-    Expect(")");
-    if_node->body_program = Program();
-
-    if (ConsumeIfKindMatches(TK_ELSE)) {
-      if_node->else_program = Program();
+static Node *Statement(Compiler *cc) {
+  if (ConsumeIfKindMatches(cc, TK_RETURN)) {
+    Node *lhs = Expression(cc);
+    Expect(cc, ";");
+    return NewUnary(cc, ND_RETURN, lhs);
+  }
+
+  if (ConsumeIfKindMatches(cc, TK_IF)) {
+    Node *if_node = NewNode(cc, ND_IF);
+    Expect(cc, "(");
+    if_node->condition = Expression(cc);
+    Expect(cc, ")");
+    if_node->body_program = Program(cc);
+
+    if (ConsumeIfKindMatches(cc, TK_ELSE)) {
+      if_node->else_program = Program(cc);
     }
 
     return if_node;
   }
 
-  if (ConsumeIfKindMatches(TK_WHILE)) {
-    Expect("(");
-    Node *lhs = Expression();
-    Expect(")");
-    return NewBinary(ND_WHILE, lhs, Program());
+  if (ConsumeIfKindMatches(cc, TK_WHILE)) {
+    Expect(cc, "(");
+    Node *lhs = Expression(cc);
+    Expect(cc, ")");
+    return NewBinary(cc, ND_WHILE, lhs, Program(cc));
   }
 
-  if (ConsumeIfKindMatches(TK_FOR)) {
-    Node *for_node = NewNode(ND_FOR);
+  if (ConsumeIfKindMatches(cc, TK_FOR)) {
+    Node *for_node = NewNode(cc, ND_FOR);
 
-    Expect("(");
-    if (!ConsumeIfReservedTokenMatches(";")) {
-      for_node->initialization = Expression();
-      Expect(";");
+    Expect(cc, "(");
+    if (!ConsumeIfReservedTokenMatches(cc, ";")) {
+      for_node->initialization = Expression(cc);
+      Expect(cc, ";");
     }
-    if (!ConsumeIfReservedTokenMatches(";")) {
-      for_node->condition = Expression();
-      Expect(";");
+    if (!ConsumeIfReservedTokenMatches(cc, ";")) {
+      for_node->condition = Expression(cc);
+      Expect(cc, ";");
     }
-    if (!ReservedTokenMatches(")")) {
-      for_node->iteration = Expression();
+    if (!ReservedTokenMatches(cc, ")")) {
+      for_node->iteration = Expression(cc);
     }
-    Expect(")");
+    Expect(cc, ")");
 
-    for_node->body_program = Program();
+    for_node->body_program = Program(cc);
     return for_node;
   }
 
 
   //  "{" Program* "}"
-  if (ConsumeIfReservedTokenMatches("{")) {
-    Node *nd_block =  NewNode(ND_BLOCK);
-    Node *head = nd_block;
-    while (!ConsumeIfReservedTokenMatches("}")) {
-      nd_block->next_in_block = Program();
-      nd_block = nd_block->next_in_block;
+  if (ConsumeIfReservedTokenMatches(cc, "{")) {
+    Scope block_scope;
+    EnterScope(cc, &block_scope);
+
+    /*
+     * Statements are linked by `next_in_block` starting from
+     * `body_program`, as the block itself can be linked to
+     * the statements following it.
+     */
+    Node *nd_block = NewNode(cc, ND_BLOCK);
+    Node head = {0};
+    Node *cur = &head;
+    while (!ConsumeIfReservedTokenMatches(cc, "}")) {
+      cur->next_in_block = Program(cc);
+      cur = cur->next_in_block;
     }
-    return head;
+    nd_block->body_program = head.next_in_block;
+
+    LeaveScope(cc);
+    return nd_block;
+  }
+
+  if (IsFuncDefinitionAhead(cc)) {
+    return FuncDefinition(cc);
   }
 
   // VariableDeclaration
-  Node *var_dclr = VariableDeclaration();
-  if (var_dclr) return var_dclr;
+  return VariableDeclaration(cc);
+}
+
+/*
+ * Function definition or prototype.
+ *
+ * FuncDefinition =
+ *  "int" "*"* identifier "(" ( "int" "*"* identifier ("," "int" "*"* identifier )? ")"
+ *  (";" | "{" Program* "}")
+ */
+static Node *FuncDefinition(Compiler *cc) {
+  int first_token = cc->token_pos;
+  bool top_level = !cc->current_func;
+
+  // Parsed before `cc->current_func` is set, so the type outlives the body.
+  Type *ret_type = GetType(cc);
+  Token *func_name = ExpectIdentifier(cc);
+  Node *nd_func_define = ArenaAlloc(cc, &cc->func_arena, AR_NODE, sizeof(Node));
+  nd_func_define->kind = ND_FUNC_DEFINITION;
+  nd_func_define->func_name = func_name->ident;
+  nd_func_define->ret_type = ret_type;
+  cc->current_func = nd_func_define;
 
   /*
-   * "int" "*"* identifier "(" ( "int" "*"* identifier ("," "int" "*"* identifier) )? ")" "{"
-   *   Program*
-   * "}"
-   *
-   * Function declaration
-   * TODO(k1832): Check for multiple definition with same name
+   * Parameters and the variables declared directly in the body
+   * share this scope, so a variable can not redeclare a parameter.
    */
-  if (!IsTypeToken()) {
-    return NULL;
-  }
+  Scope func_scope;
+  EnterScope(cc, &func_scope);
 
-  Type *ret_type = GetType();
-  Token *func_name = ExpectIdentifier();
-  Node *nd_func_define = NewNode(ND_FUNC_DEFINITION);
-  nd_func_define->func_name = func_name->str;
-  nd_func_define->func_name_len = func_name->len;
-  nd_func_define->ret_type = ret_type;
-
-  Expect("(");
+  Expect(cc, "(");
 
-  while (IsTypeToken()) {
-    Type *param_type = GetType();
-    Token *ident_param = ExpectIdentifier();
-    ValidateParamName(nd_func_define, ident_param);
-    NewFuncParam(nd_func_define, ident_param, param_type);
+  while (IsTypeToken(Peek(cc, 0))) {
+    Type *param_type = GetType(cc);
+    Token *ident_param = ExpectIdentifier(cc);
+    ValidateParamName(cc, nd_func_define, ident_param);
+    NewFuncParam(cc, nd_func_define, ident_param, param_type);
 
-    if (!ConsumeIfReservedTokenMatches(",")) {
+    if (!ConsumeIfReservedTokenMatches(cc, ",")) {
       break;
     }
 
-    ValidateTypeToken();
+    ValidateTypeToken(cc);
   }
 
-  Expect(")");
+  Expect(cc, ")");
+
+  Function *func = DeclareFunction(cc, nd_func_define, func_name);
+  if (ConsumeIfReservedTokenMatches(cc, ";")) {
+    // Prototype
+    LeaveScope(cc);
+    cc->current_func = NULL;
+    nd_func_define->kind = ND_FUNC_DECLARATION;
+    return nd_func_define;
+  }
 
-  Expect("{");
-  current_scope = nd_func_define;
+  if (func->is_defined) {
+    ExitWithErrorAt(cc, func_name->str,
+      "Redefinition of function \"%.*s\"",
+      func_name->len, func_name->str);
+  }
+  // Registered before the body is parsed so that it can be recursive.
+  func->is_defined = true;
+
+  Expect(cc, "{");
+
+  if (cc->cache && top_level) {
+    nd_func_define->cache_entry =
+        LookUpFunction(cc, first_token, cc->token_pos - 1);
+    if (nd_func_define->cache_entry && nd_func_define->cache_entry->hit) {
+      // The body is already compiled. Its tokens are skipped.
+      Expect(cc, "}");
+      LeaveScope(cc);
+      cc->current_func = NULL;
+      return nd_func_define;
+    }
+  }
 
   Node *node_in_block = nd_func_define;
-  while (!ConsumeIfReservedTokenMatches("}")) {
-    node_in_block->next_in_block = Program();
+  while (!ConsumeIfReservedTokenMatches(cc, "}")) {
+    node_in_block->next_in_block = Program(cc);
     node_in_block = node_in_block->next_in_block;
   }
+
+  LeaveScope(cc);
   // Reset the node that's currently being processed function.
-  current_scope = NULL;
+  cc->current_func = NULL;
 
   return nd_func_define;
 }
 
 /*
  * Parses variable declaration.
- * If it's not variable declaration, it returns NULL.
+ * If the current token is not a type, it returns NULL.
  *
  * VariableDeclaration =
  *   "int" "*"* identifier ("[" number "]")? ";"
  */
-static Node *VariableDeclaration() {
-  if (!IsTypeToken()) {
+static Node *VariableDeclaration(Compiler *cc) {
+  if (!IsTypeToken(Peek(cc, 0))) {
     return NULL;
   }
 
-  Token *stashed_token = token;
-
-  Type *type = GetType();
+  Type *type = GetType(cc);
 
   // 0 if it's not array. Otherwise, array size.
   size_t array_size = 0;
 
-  Token *variable_or_func_name = ExpectIdentifier();
-  if (ConsumeIfReservedTokenMatches("[")) {
-    array_size = (size_t)ExpectNumber();
+  Token *variable_name = ExpectIdentifier(cc);
+  if (ConsumeIfReservedTokenMatches(cc, "[")) {
+    array_size = (size_t)ExpectNumber(cc);
 
     Type *point_to = type;
 
-    Type *array_type = calloc(1, sizeof(Type));
+    Type *array_type = ArenaAlloc(cc, ParseArena(cc), AR_TYPE, sizeof(Type));
     array_type->kind = TY_ARRAY;
     array_type->point_to = point_to;
 
     type = array_type;
 
-    Expect("]");
+    Expect(cc, "]");
   }
 
-  if (!ConsumeIfReservedTokenMatches(";")) {
-    // Not variable declaration
-    token = stashed_token;
-    return NULL;
-  }
+  Expect(cc, ";");
 
   /*
-   * `current_scope` should be either
-   * `NULL` for global scope, or
-   * not `NULL` for function scope
+   * `cc->current_func` should be either
+   * `NULL` for global variable, or
+   * not `NULL` for function-scope variable
    */
-  Node *prev_scope = NULL;
-  if (!current_scope) {
+  Node *var_owner = cc->current_func;
+  if (!cc->current_func) {
     // Global variable
-    if (!globals) {
+    if (!cc->globals) {
       // First global variable
-      globals = NewNode(ND_GLOBAL_VAR_LIST);
+      cc->globals = NewNode(cc, ND_GLOBAL_VAR_LIST);
     }
 
-    prev_scope = current_scope;
-    current_scope = globals;
+    var_owner = cc->globals;
   }
 
   Node *declared_node =
-    GetDeclaredInScope(current_scope, variable_or_func_name);
+    GetDeclaredInScope(cc->current_scope, variable_name);
 
   if (declared_node) {
-    ExitWithErrorAt(user_input, variable_or_func_name->str,
+    ExitWithErrorAt(cc, variable_name->str,
       "Redeclaration of \"%.*s\"",
-      variable_or_func_name->len,
-      variable_or_func_name->str);
+      variable_name->len,
+      variable_name->str);
   }
 
-  Node *lval = NewLVal(current_scope,
-                       variable_or_func_name,
+  Node *lval = NewLVal(cc, var_owner,
+                       variable_name,
                        type, array_size);
-
-  if (prev_scope) {
-    // Restore
-    current_scope = prev_scope;
-  }
+  DeclareInCurrentScope(cc, lval);
 
   return lval;
 }
 
 // Expression     = Assignment
-static Node *Expression() {
-  return Assignment();
+static Node *Expression(Compiler *cc) {
+  return Assignment(cc);
 }
 
 // Convert `lhs op= rhs` to `tmp = &lhs, *tmp = *tmp op rhs`
-static Node *ToAssign(NodeKind op_type, Node *lhs, Node *rhs) {
-  AddType(lhs);
-  AddType(rhs);
+static Node *ToAssign(Compiler *cc, NodeKind op_type, Node *lhs, Node *rhs) {
+  AddType(cc, lhs);
+  AddType(cc, rhs);
 
-  Type *ty_pointer_to_lhs = calloc(1, sizeof(Type));
+  Type *ty_pointer_to_lhs =
+      ArenaAlloc(cc, ParseArena(cc), AR_TYPE, sizeof(Type));
   ty_pointer_to_lhs->kind = TY_PTR;
   ty_pointer_to_lhs->point_to = lhs->type;
 
   // tmp
-  Node *tmp = NewLVal(current_scope,
+  Node *tmp = NewLVal(cc, cc->current_func,
                                  NULL, ty_pointer_to_lhs, 0);
 
   /*
@@ -670,18 +759,18 @@ static Node *ToAssign(NodeKind op_type, Node *lhs, Node *rhs) {
   tmp->kind = ND_LOCAL_VAR;
 
   // tmp = &lhs
-  Node *expr1 = NewBinary(ND_ASSIGN, tmp, NewUnary(ND_ADDR, lhs));
+  Node *expr1 = NewBinary(cc, ND_ASSIGN, tmp, NewUnary(cc, ND_ADDR, lhs));
 
   // *tmp = *tmp op rhs
   Node *expr2 =
-    NewBinary(ND_ASSIGN,
-               NewUnary(ND_DEREF, tmp),
-               NewBinary(op_type,
-                          NewUnary(ND_DEREF, tmp),
+    NewBinary(cc, ND_ASSIGN,
+               NewUnary(cc, ND_DEREF, tmp),
+               NewBinary(cc, op_type,
+                          NewUnary(cc, ND_DEREF, tmp),
                           rhs));
 
 
-  return NewBinary(ND_COMMA, expr1, expr2);
+  return NewBinary(cc, ND_COMMA, expr1, expr2);
 }
 
 /*
@@ -694,40 +783,40 @@ static Node *ToAssign(NodeKind op_type, Node *lhs, Node *rhs) {
  *  Equality "%=" Assignment |
  *  Equality
  */
-static Node *Assignment() {
-  Node *equality = Equality();
-  if (ConsumeIfReservedTokenMatches("="))
-    return NewBinary(ND_ASSIGN, equality, Assignment());
+static Node *Assignment(Compiler *cc) {
+  Node *equality = Equality(cc);
+  if (ConsumeIfReservedTokenMatches(cc, "="))
+    return NewBinary(cc, ND_ASSIGN, equality, Assignment(cc));
 
-  if (ConsumeIfReservedTokenMatches("+="))
-    return ToAssign(ND_ADD, equality, Assignment());
+  if (ConsumeIfReservedTokenMatches(cc, "+="))
+    return ToAssign(cc, ND_ADD, equality, Assignment(cc));
 
-  if (ConsumeIfReservedTokenMatches("-="))
-    return ToAssign(ND_SUB, equality, Assignment());
+  if (ConsumeIfReservedTokenMatches(cc, "-="))
+    return ToAssign(cc, ND_SUB, equality, Assignment(cc));
 
-  if (ConsumeIfReservedTokenMatches("*="))
-    return ToAssign(ND_MUL, equality, Assignment());
+  if (ConsumeIfReservedTokenMatches(cc, "*="))
+    return ToAssign(cc, ND_MUL, equality, Assignment(cc));
 
-  if (ConsumeIfReservedTokenMatches("/="))
-    return ToAssign(ND_DIV, equality, Assignment());
+  if (ConsumeIfReservedTokenMatches(cc, "/="))
+    return ToAssign(cc, ND_DIV, equality, Assignment(cc));
 
-  if (ConsumeIfReservedTokenMatches("%="))
-    return ToAssign(ND_MOD, equality, Assignment());
+  if (ConsumeIfReservedTokenMatches(cc, "%="))
+    return ToAssign(cc, ND_MOD, equality, Assignment(cc));
 
   return equality;
 }
 
 // Equality   = Relational ("==" Relational | "!=" Relational)*
-static Node *Equality() {
-    Node *node = Relational();
+static Node *Equality(Compiler *cc) {
+    Node *node = Relational(cc);
     for (;;) {
-      if (ConsumeIfReservedTokenMatches("==")) {
-        node = NewBinary(ND_EQ, node, Relational());
+      if (ConsumeIfReservedTokenMatches(cc, "==")) {
+        node = NewBinary(cc, ND_EQ, node, Relational(cc));
         continue;
       }
 
-      if (ConsumeIfReservedTokenMatches("!=")) {
-        node = NewBinary(ND_NEQ, node, Relational());
+      if (ConsumeIfReservedTokenMatches(cc, "!=")) {
+        node = NewBinary(cc, ND_NEQ, node, Relational(cc));
         continue;
       }
 
@@ -736,28 +825,28 @@ static Node *Equality() {
 }
 
 // Relational = Add ("<" Add | "<=" Add | ">" Add | ">=" Add)*
-static Node *Relational() {
-  Node *node = Add();
+static Node *Relational(Compiler *cc) {
+  Node *node = Add(cc);
   for (;;) {
-    if (ConsumeIfReservedTokenMatches("<")) {
-      node = NewBinary(ND_LT, node, Add());
+    if (ConsumeIfReservedTokenMatches(cc, "<")) {
+      node = NewBinary(cc, ND_LT, node, Add(cc));
       continue;
     }
 
-    if (ConsumeIfReservedTokenMatches(">")) {
+    if (ConsumeIfReservedTokenMatches(cc, ">")) {
       // (Add() < node) == (node > Add())
-      node = NewBinary(ND_LT, Add(), node);
+      node = NewBinary(cc, ND_LT, Add(cc), node);
       continue;
     }
 
-    if (ConsumeIfReservedTokenMatches("<=")) {
-      node = NewBinary(ND_NGT, node, Add());
+    if (ConsumeIfReservedTokenMatches(cc, "<=")) {
+      node = NewBinary(cc, ND_NGT, node, Add(cc));
       continue;
     }
 
-    if (ConsumeIfReservedTokenMatches(">=")) {
+    if (ConsumeIfReservedTokenMatches(cc, ">=")) {
       // (Add() <= node) == (node >= Add())
-      node = NewBinary(ND_NGT, Add(), node);
+      node = NewBinary(cc, ND_NGT, Add(cc), node);
       continue;
     }
 
@@ -771,20 +860,20 @@ static bool IsPointerLike(Type *ty) {
   return ty->kind == TY_ARRAY;
 }
 
-static Node *NewAdd(Node *lhs, Node *rhs) {
-  AddType(lhs);
-  AddType(rhs);
+static Node *NewAdd(Compiler *cc, Node *lhs, Node *rhs) {
+  AddType(cc, lhs);
+  AddType(cc, rhs);
 
   // Implicit type conversion
 
   // num + num
   if (lhs->type->kind == TY_INT && rhs->type->kind == TY_INT) {
-    return NewBinary(ND_ADD, lhs, rhs);
+    return NewBinary(cc, ND_ADD, lhs, rhs);
   }
 
   if (IsPointerLike(lhs->type) && IsPointerLike(rhs->type)) {
     // TODO(k1832): Add "Token" to each "Node" for better error message
-    ExitWithError("Invalid operands.");
+    ExitWithError(cc, "Invalid operands.");
   }
 
   // "num + ptr" -> "ptr + num"
@@ -797,8 +886,8 @@ static Node *NewAdd(Node *lhs, Node *rhs) {
 
   // (ptr + num) -> ptr + (sizeof(*ptr) * num)
   // TODO(k1832): Replace "8" with sizeof(*ptr)
-  rhs = NewBinary(ND_MUL, rhs, NewNodeNumber(8));
-  return NewBinary(ND_ADD, lhs, rhs);
+  rhs = NewBinary(cc, ND_MUL, rhs, NewNodeNumber(cc, 8));
+  return NewBinary(cc, ND_ADD, lhs, rhs);
 }
 
 /*
@@ -811,22 +900,22 @@ static Node *NewAdd(Node *lhs, Node *rhs) {
  */
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wreturn-type"
-static Node *NewSub(Node *lhs, Node *rhs) {
-  AddType(lhs);
-  AddType(rhs);
+static Node *NewSub(Compiler *cc, Node *lhs, Node *rhs) {
+  AddType(cc, lhs);
+  AddType(cc, rhs);
 
   // Implicit type conversion
 
   // num - num
   if (lhs->type->kind == TY_INT && rhs->type->kind == TY_INT) {
-    return NewBinary(ND_SUB, lhs, rhs);
+    return NewBinary(cc, ND_SUB, lhs, rhs);
   }
 
   // ptr - num
   if (IsPointerLike(lhs->type) && rhs->type->kind == TY_INT) {
     // "ptr - num" -> "ptr - sizeof(*ptr) * num"
-    rhs = NewBinary(ND_MUL, rhs, NewNodeNumber(8));
-    Node *node = NewBinary(ND_SUB, lhs, rhs);
+    rhs = NewBinary(cc, ND_MUL, rhs, NewNodeNumber(cc, 8));
+    Node *node = NewBinary(cc, ND_SUB, lhs, rhs);
     node->type = lhs->type;
     return node;
   }
@@ -844,27 +933,27 @@ static Node *NewSub(Node *lhs, Node *rhs) {
     * -> This will print "2".
     */
 
-    Node *node = NewBinary(ND_SUB, lhs, rhs);
+    Node *node = NewBinary(cc, ND_SUB, lhs, rhs);
     node->type = ty_int;
-    return NewBinary(ND_DIV, node, NewNodeNumber(8));
+    return NewBinary(cc, ND_DIV, node, NewNodeNumber(cc, 8));
   }
 
   // TODO(k1832): Add "Token" to each "Node" for better error message
-  ExitWithError("Invalid operands.");
+  ExitWithError(cc, "Invalid operands.");
 }
 #pragma GCC diagnostic pop
 
 // Add    = MulDiv ("+" MulDiv | "-" MulDiv)*
-static Node *Add() {
-  Node *node = MulDiv();
+static Node *Add(Compiler *cc) {
+  Node *node = MulDiv(cc);
   for (;;) {
-    if (ConsumeIfReservedTokenMatches("+")) {
-      node = NewAdd(node, MulDiv());
+    if (ConsumeIfReservedTokenMatches(cc, "+")) {
+      node = NewAdd(cc, node, MulDiv(cc));
       continue;
     }
 
-    if (ConsumeIfReservedTokenMatches("-")) {
-      node = NewSub(node, MulDiv());
+    if (ConsumeIfReservedTokenMatches(cc, "-")) {
+      node = NewSub(cc, node, MulDiv(cc));
       continue;
     }
 
@@ -873,21 +962,21 @@ static Node *Add() {
 }
 
 // MulDiv     = Unary ("*" Unary | "/" Unary | "%" Unary)*
-static Node *MulDiv() {
-  Node *node = Unary();
+static Node *MulDiv(Compiler *cc) {
+  Node *node = Unary(cc);
   for (;;) {
-    if (ConsumeIfReservedTokenMatches("*")) {
-      node = NewBinary(ND_MUL, node, Unary());
+    if (ConsumeIfReservedTokenMatches(cc, "*")) {
+      node = NewBinary(cc, ND_MUL, node, Unary(cc));
       continue;
     }
 
-    if (ConsumeIfReservedTokenMatches("/")) {
-      node = NewBinary(ND_DIV, node, Unary());
+    if (ConsumeIfReservedTokenMatches(cc, "/")) {
+      node = NewBinary(cc, ND_DIV, node, Unary(cc));
       continue;
     }
 
-    if (ConsumeIfReservedTokenMatches("%")) {
-      node = NewBinary(ND_MOD, node, Unary());
+    if (ConsumeIfReservedTokenMatches(cc, "%")) {
+      node = NewBinary(cc, ND_MOD, node, Unary(cc));
       continue;
     }
 
@@ -905,60 +994,60 @@ static Node *MulDiv() {
  *  LVal ("++" | "--")? |
  *  Primary
  */
-static Node *Unary() {
-  if (ConsumeIfReservedTokenMatches("sizeof")) {
-    Node *node = Unary();
-    AddType(node);
-    return NewNodeNumber(GetSize(node->type));
+static Node *Unary(Compiler *cc) {
+  if (ConsumeIfReservedTokenMatches(cc, "sizeof")) {
+    Node *node = Unary(cc);
+    AddType(cc, node);
+    return NewNodeNumber(cc, GetSize(cc, node->type));
   }
 
-  if (ConsumeIfReservedTokenMatches("+")) {
+  if (ConsumeIfReservedTokenMatches(cc, "+")) {
     // Just remove "+"
-    return Expression();
+    return Expression(cc);
   }
 
-  if (ConsumeIfReservedTokenMatches("-")) {
+  if (ConsumeIfReservedTokenMatches(cc, "-")) {
     // Replace with "0 - Node"
-    return NewBinary(ND_SUB, NewNodeNumber(0), Primary());
+    return NewBinary(cc, ND_SUB, NewNodeNumber(cc, 0), Primary(cc));
   }
 
-  if (ConsumeIfReservedTokenMatches("++")) {
+  if (ConsumeIfReservedTokenMatches(cc, "++")) {
     // "++i" -> "i += 1"
-    return ToAssign(ND_ADD, LVal(), NewNodeNumber(1));
+    return ToAssign(cc, ND_ADD, LVal(cc), NewNodeNumber(cc, 1));
   }
 
-  if (ConsumeIfReservedTokenMatches("--")) {
+  if (ConsumeIfReservedTokenMatches(cc, "--")) {
     // "--i" -> "i -= 1"
-    return ToAssign(ND_SUB, LVal(), NewNodeNumber(1));
+    return ToAssign(cc, ND_SUB, LVal(cc), NewNodeNumber(cc, 1));
   }
 
-  if (ConsumeIfReservedTokenMatches("*")) {
-    return NewUnary(ND_DEREF, Dereferenceable());
+  if (ConsumeIfReservedTokenMatches(cc, "*")) {
+    return NewUnary(cc, ND_DEREF, Dereferenceable(cc));
   }
 
   // "&" LVal
-  if (ConsumeIfReservedTokenMatches("&")) {
-    return NewUnary(ND_ADDR, LVal());
+  if (ConsumeIfReservedTokenMatches(cc, "&")) {
+    return NewUnary(cc, ND_ADDR, LVal(cc));
   }
 
-  Node *lval = LVal();
+  Node *lval = LVal(cc);
 
   if (!lval) {
-    return Primary();
+    return Primary(cc);
   }
 
   // LVal ("++" | "--") |
-  if (ConsumeIfReservedTokenMatches("++")) {
+  if (ConsumeIfReservedTokenMatches(cc, "++")) {
     // "i++" -> "(i+=1) - 1"
-    return NewBinary(ND_SUB,
-                      ToAssign(ND_ADD, lval, NewNodeNumber(1)),
-                      NewNodeNumber(1));
+    return NewBinary(cc, ND_SUB,
+                      ToAssign(cc, ND_ADD, lval, NewNodeNumber(cc, 1)),
+                      NewNodeNumber(cc, 1));
   }
-  if (ConsumeIfReservedTokenMatches("--")) {
+  if (ConsumeIfReservedTokenMatches(cc, "--")) {
     // "i--" -> "(i-=1) + 1"
-    return NewBinary(ND_ADD,
-                      ToAssign(ND_SUB, lval, NewNodeNumber(1)),
-                      NewNodeNumber(1));
+    return NewBinary(cc, ND_ADD,
+                      ToAssign(cc, ND_SUB, lval, NewNodeNumber(cc, 1)),
+                      NewNodeNumber(cc, 1));
   }
 
   return lval;
@@ -971,30 +1060,30 @@ static Node *Unary() {
  *  "(" Expression ")" |
  *  Lval
  */
-static Node *Dereferenceable() {
+static Node *Dereferenceable(Compiler *cc) {
   // "*" Dereferenceable
-  if (ConsumeIfReservedTokenMatches("*")) {
-    return NewUnary(ND_DEREF, Dereferenceable());
+  if (ConsumeIfReservedTokenMatches(cc, "*")) {
+    return NewUnary(cc, ND_DEREF, Dereferenceable(cc));
   }
 
   // "&" identifier
-  if (ConsumeIfReservedTokenMatches("&")) {
-    Node *lval = LVal();
+  if (ConsumeIfReservedTokenMatches(cc, "&")) {
+    Node *lval = LVal(cc);
     if (!lval) {
-      ExitWithErrorAt(user_input, token->str, "Undeclared variable");
+      ExitWithErrorAt(cc, Peek(cc, 0)->str, "Undeclared variable");
     }
-    return NewUnary(ND_ADDR, lval);
+    return NewUnary(cc, ND_ADDR, lval);
   }
 
-  if (ConsumeIfReservedTokenMatches("(")) {
-    Node *expression = Expression();
-    Expect(")");
+  if (ConsumeIfReservedTokenMatches(cc, "(")) {
+    Node *expression = Expression(cc);
+    Expect(cc, ")");
     return expression;
   }
 
-  Node *lval = LVal();
+  Node *lval = LVal(cc);
   if (!lval) {
-    ExitWithErrorAt(user_input, token->str, "Undeclared variable");
+    ExitWithErrorAt(cc, Peek(cc, 0)->str, "Undeclared variable");
   }
 
   return lval;
@@ -1003,54 +1092,78 @@ static Node *Dereferenceable() {
 /*
  * Parses tokens.
  * Returns LVal node on success, otherwise returns NULL.
- * Before returning NULL, the token is restored to its state
- * at the time the function was called.
+ * No token is consumed when NULL is returned.
  *
  * LVal =
  *  "*" Dereferenceable |
  *  identifier ("[" Expression "]")?
  */
-static Node *LVal() {
-  Token *stashed_token = token;
-
+static Node *LVal(Compiler *cc) {
   // "*" Dereferenceable |
-  if (ConsumeIfReservedTokenMatches("*")) {
-    return NewUnary(ND_DEREF, Dereferenceable());
+  if (ConsumeIfReservedTokenMatches(cc, "*")) {
+    return NewUnary(cc, ND_DEREF, Dereferenceable(cc));
   }
 
-  Token *ident = ConsumeAndGetIfIdent();
-  if (!ident) {
-    token = stashed_token;
+  Token *ident = Peek(cc, 0);
+  if (ident->kind != TK_IDENT) {
     return NULL;
   }
 
   /*
-   * Firstly look for declared variable in function scope.
-   * If the variable is not found in function scope,
-   * then look for in the global scope.
+   * Look for the declared variable from the innermost scope
+   * to the global scope.
    */
+  Node *nd_lval = GetLValNodeFromIdent(cc, ident);
+  if (!nd_lval) {
+    return NULL;
+  }
+  ConsumeToken(cc);
 
-  Node *scopes[2] = {current_scope, globals};
-  for (int i = 0; i < 2; ++i) {
-    Node *nd_lval = GetLValNodeFromIdent(scopes[i], ident);
-    if (!nd_lval) {
-      continue;
-    }
+  if (ConsumeIfReservedTokenMatches(cc, "[")) {
+    Node *expression = Expression(cc);
+    Expect(cc, "]");
 
-    if (ConsumeIfReservedTokenMatches("[")) {
-      Node *expression = Expression();
-      Expect("]");
+    // ptr[index] -> *(ptr + index)
+    return NewUnary(cc, ND_DEREF, NewAdd(cc, nd_lval, expression));
+  }
 
-      // ptr[index] -> *(ptr + index)
-      return NewUnary(ND_DEREF, NewAdd(nd_lval, expression));
-    }
+  return nd_lval;
+}
 
-    return nd_lval;
+/*
+ * FuncCall =
+ *  identifier "(" ( Expression ("," Expression)* )? ")"
+ */
+static Node *FuncCall(Compiler *cc) {
+  Token *tok = ExpectIdentifier(cc);
+  Expect(cc, "(");
+
+  Node *nd_func_call = NewNode(cc, ND_FUNC_CALL);
+  nd_func_call->func_name = tok->ident;
+  while (!ConsumeIfReservedTokenMatches(cc, ")")) {
+    ++(nd_func_call->argc);
+    NewArg(nd_func_call, Expression(cc));
+    ConsumeIfReservedTokenMatches(cc, ",");
+    /*
+     * TODO(k1832): Consider a behavior
+     * when there is no argument after a comma.
+     */
   }
 
-  token = stashed_token;
+  // The function must have been declared or defined before.
+  nd_func_call->func = SymbolTableGet(&cc->functions, tok->ident);
+  if (!nd_func_call->func) {
+    ExitWithErrorAt(cc, tok->str,
+                    "Undefined function: \"%.*s\"", tok->len, tok->str);
+  }
 
-  return NULL;
+  if (nd_func_call->argc != nd_func_call->func->num_parameters) {
+    ExitWithErrorAt(cc, tok->str,
+      "\"%.*s\" takes %d arguments, but %d given",
+      tok->len, tok->str,
+      nd_func_call->func->num_parameters, nd_func_call->argc);
+  }
+  return nd_func_call;
 }
 
 /*
@@ -1058,70 +1171,32 @@ static Node *LVal() {
  *
  * Primary =
  *  "(" Expression ")" |
- *  identifier "(" ( Expression ("," Expression)* )? ")" ) |
- *  LVal
+ *  FuncCall |
+ *  LVal |
  *  number
  */
-static Node *Primary() {
-  if (ConsumeIfReservedTokenMatches("(")) {
-    Node *node = Expression();
-    Expect(")");
+static Node *Primary(Compiler *cc) {
+  if (ConsumeIfReservedTokenMatches(cc, "(")) {
+    Node *node = Expression(cc);
+    Expect(cc, ")");
     return node;
   }
 
-  Token *stashed_token = token;
-  Token *tok = ConsumeAndGetIfIdent();
-  if (tok) {
-    // identifier
-    if (ConsumeIfReservedTokenMatches("(")) {
-      // Function call
-
-      Node *nd_func_call = NewNode(ND_FUNC_CALL);
-      nd_func_call->func_name = tok->str;
-      nd_func_call->func_name_len = tok->len;
-      while (!ConsumeIfReservedTokenMatches(")")) {
-        ++(nd_func_call->argc);
-        NewArg(nd_func_call, Expression());
-        ConsumeIfReservedTokenMatches(",");
-        /*
-         * TODO(k1832): Consider a behavior
-         * when there is no argument after a comma.
-         */
-      }
-
-      // Find the corresponding function definition
-      for (int i = 0; i < 100; ++i) {
-        Node *nd = programs[i];
-        if (!nd)
-          break;
-        if (nd->kind != ND_FUNC_DEFINITION)
-          continue;
-        if (!FuncNamesMatch(nd, nd_func_call))
-          continue;
-
-        nd_func_call->func_def = nd;
-        return nd_func_call;
-      }
-
-      // Also function that's currenly being declared is called (recursion)
-      if (FuncNamesMatch(current_scope, nd_func_call)) {
-        nd_func_call->func_def = current_scope;
-        return nd_func_call;
-      }
-    }
-    token = stashed_token;
+  // identifier "(" -> Function call
+  if (Peek(cc, 0)->kind == TK_IDENT && IsReserved(Peek(cc, 1), "(")) {
+    return FuncCall(cc);
   }
 
-  Node *node = LVal();
+  Node *node = LVal(cc);
   if (node) return node;
 
-  if (IsNextTokenNumber()) {
-    return NewNodeNumber(ExpectNumber());
+  if (IsNextTokenNumber(cc)) {
+    return NewNodeNumber(cc, ExpectNumber(cc));
   }
 
-  /*
-   * "token" should be restored such that
-   * "token" is same as the token before this function is called.
-   */
-  return NULL;
+  if (Peek(cc, 0)->kind == TK_IDENT) {
+    ExitWithErrorAt(cc, Peek(cc, 0)->str, "Undeclared variable");
+  }
+  ExitWithErrorAt(cc, Peek(cc, 0)->str, "Expected an expression.");
+  return NULL;  // To make cpplint happy
 }
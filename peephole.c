@@ -0,0 +1,196 @@
+/* Copyright 2022 Keita Morisaki. All rights reserved. */
+/*
+ * Peephole optimization of the instructions of an item, run by
+ * `FlushInsns` before they are printed or encoded.
+ *
+ * The stack machine of codegen.c pushes every value and pops it right
+ * away, e.g. "push rax" then "pop rdi", and computes the address of
+ * every variable from rbp. The instructions are copied
+ * down the list one by one, and after each one the rules of
+ * `rules` are tried on the last instructions copied. A rewrite can
+ * make another one match, like "push rdi; push 1; pop rdi; pop rax":
+ * "push 1; pop rdi" becomes "mov rdi, 1", then "push rdi; mov rdi, 1;
+ * pop rax" becomes "mov rax, rdi; mov rdi, 1".
+ *
+ * Comments are skipped over. A label ends the window, as it can be
+ * jumped to. No rule changes what the code computes: flags are only
+ * read by the jump or the set right after a "cmp", and nothing reads
+ * the stack below rsp.
+ */
+#include <stdbool.h>
+#include <string.h>
+
+#include "./jcc.h"
+
+#define WINDOW_SIZE 3
+
+typedef struct {
+  const char *name;
+  int window;   // instructions matched, the last one copied last
+  // Rewrites `w` and returns how many of them are kept, from w[0].
+  // Returns -1 if it doesn't match.
+  int (*apply)(Insn **w);
+} Rule;
+
+static bool IsReg(Operand *op, Register reg) {
+  return op->kind == OP_REG && op->reg == reg;
+}
+
+// Whether `op` refers to `reg`, as itself or as the base of memory
+static bool Mentions(Operand *op, Register reg) {
+  return (op->kind == OP_REG || op->kind == OP_MEM) && op->reg == reg;
+}
+
+// "push X; pop X" does nothing.
+static int PushPop(Insn **w) {
+  if (w[0]->kind != I_PUSH || w[1]->kind != I_POP) return -1;
+  if (w[0]->dst.kind != OP_REG || !IsReg(&w[1]->dst, w[0]->dst.reg)) {
+    return -1;
+  }
+  return 0;
+}
+
+// "push X; pop Y" to "mov Y, X"
+static int PushPopToMov(Insn **w) {
+  if (w[0]->kind != I_PUSH || w[1]->kind != I_POP) return -1;
+  Operand src = w[0]->dst;
+  Operand dst = w[1]->dst;
+  if (dst.kind != OP_REG || dst.reg == RSP || Mentions(&src, RSP)) return -1;
+  *w[0] = (Insn){.kind = I_MOV, .dst = dst, .src = src};
+  return 1;
+}
+
+/*
+ * "push X; I; pop Y" to "mov Y, X; I" if I doesn't use Y, otherwise to
+ * "I; mov Y, X" if I doesn't change X. I is a "mov" or "lea". The mov
+ * is left out if X is Y.
+ */
+static int PushMovPop(Insn **w) {
+  if (w[0]->kind != I_PUSH || w[2]->kind != I_POP) return -1;
+  if (w[1]->kind != I_MOV && w[1]->kind != I_LEA) return -1;
+  Operand x = w[0]->dst;
+  Register y = w[2]->dst.reg;
+  Insn between = *w[1];
+  if (Mentions(&x, RSP) || y == RSP || Mentions(&between.dst, RSP) ||
+      Mentions(&between.src, RSP)) {
+    return -1;
+  }
+
+  Insn mov = {.kind = I_MOV, .dst = Reg(y), .src = x};
+  if (!Mentions(&between.dst, y) && !Mentions(&between.src, y)) {
+    if (IsReg(&x, y)) {
+      *w[0] = between;
+      return 1;
+    }
+    *w[0] = mov;
+    *w[1] = between;
+    return 2;
+  }
+  bool changes_x = between.dst.kind == OP_REG ?
+                   Mentions(&x, between.dst.reg) :
+                   x.kind == OP_MEM;   // it may be the memory written
+  if (changes_x || Mentions(&x, y)) return -1;
+  *w[0] = between;
+  *w[1] = mov;
+  return 2;
+}
+
+// "mov R, rbp; sub R, N" to "lea R, [rbp-N]"
+static int SubToLea(Insn **w) {
+  if (w[0]->kind != I_MOV || w[1]->kind != I_SUB) return -1;
+  if (w[0]->dst.kind != OP_REG || !IsReg(&w[0]->src, RBP) ||
+      !IsReg(&w[1]->dst, w[0]->dst.reg) || w[1]->src.kind != OP_IMM) {
+    return -1;
+  }
+  *w[0] = (Insn){.kind = I_LEA, .dst = w[0]->dst,
+                 .src = Mem(RBP, -w[1]->src.imm)};
+  return 1;
+}
+
+// "mov R, R" does nothing.
+static int SelfMov(Insn **w) {
+  if (w[0]->kind != I_MOV || w[0]->dst.kind != OP_REG ||
+      !IsReg(&w[0]->src, w[0]->dst.reg)) {
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * "mov R, X; I" to "I" if I sets R without reading it. I is a "mov" or
+ * "lea". A load isn't dropped, in case it faults.
+ */
+static int OverwrittenMov(Insn **w) {
+  if (w[0]->kind != I_MOV || w[0]->dst.kind != OP_REG ||
+      w[0]->src.kind == OP_MEM) {
+    return -1;
+  }
+  if (w[1]->kind != I_MOV && w[1]->kind != I_LEA) return -1;
+  Register reg = w[0]->dst.reg;
+  if (!IsReg(&w[1]->dst, reg) || Mentions(&w[1]->src, reg)) return -1;
+  *w[0] = *w[1];
+  return 1;
+}
+
+// In the order they are tried
+static const Rule rules[NUM_PEEPHOLE_RULES] = {
+  {"push_pop", 2, PushPop},
+  {"push_pop_to_mov", 2, PushPopToMov},
+  {"push_mov_pop", 3, PushMovPop},
+  {"sub_to_lea", 2, SubToLea},
+  {"self_mov", 1, SelfMov},
+  {"overwritten_mov", 2, OverwrittenMov},
+};
+
+const char *PeepholeRuleName(int rule) {
+  return rules[rule].name;
+}
+
+/*
+ * Finds the last `n` instructions before `end`, skipping comments, and
+ * stores their indices into `at` from the earliest. Returns false if
+ * there aren't as many, or a label comes first.
+ */
+static bool FindWindow(Compiler *cc, int end, int n, int *at) {
+  int i = end;
+  for (int k = n - 1; k >= 0; --k) {
+    do {
+      if (--i < 0) return false;
+    } while (cc->insns[i].kind == I_COMMENT);
+    if (cc->insns[i].kind == I_LABEL) return false;
+    at[k] = i;
+  }
+  return true;
+}
+
+// Rewrites the instructions of `cc->insns` in place.
+void OptimizePeephole(Compiler *cc) {
+  int end = 0;  // instructions copied
+  for (int i = 0; i < cc->num_insns; ++i) {
+    cc->insns[end++] = cc->insns[i];
+
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (int r = 0; r < NUM_PEEPHOLE_RULES; ++r) {
+        int at[WINDOW_SIZE];
+        if (!FindWindow(cc, end, rules[r].window, at)) continue;
+        Insn *w[WINDOW_SIZE];
+        for (int k = 0; k < rules[r].window; ++k) w[k] = &cc->insns[at[k]];
+        int kept = rules[r].apply(w);
+        if (kept < 0) continue;
+
+        // Drop the rest of the window, keeping the comments among it.
+        for (int k = rules[r].window - 1; k >= kept; --k) {
+          memmove(&cc->insns[at[k]], &cc->insns[at[k] + 1],
+                  (end - at[k] - 1) * sizeof(Insn));
+          --end;
+        }
+        ++cc->peephole_hits[r];
+        changed = true;
+        break;
+      }
+    }
+  }
+  cc->num_insns = end;
+}
@@ -0,0 +1,315 @@
+/* Copyright 2022 Keita Morisaki. All rights reserved. */
+/*
+ * Linear-scan register allocation of the virtual registers of the IR.
+ *
+ * The instructions are numbered in the order of the blocks. The
+ * instruction i reads its operands at 2i and writes its result at
+ * 2i + 1, so a result can take the register of an operand read for
+ * the last time by the same instruction. The live range of a virtual
+ * register, found by the liveness of the blocks, is one interval from
+ * its first to its last point, including the loops it's live around.
+ *
+ * The intervals are scanned by their start. Each takes a free register
+ * or, when none is, the register of the active interval ending last,
+ * which is spilled to a slot of the stack frame for its whole range.
+ * An interval across a call can only take a callee-saved register.
+ *
+ * rax, rdx and r11 are left to the backend as scratch registers.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "./jcc.h"
+
+#define NUM_ALLOCATABLE 11
+#define NO_REGISTER -1
+
+// Preferred first. The callee-saved ones have to be saved once used.
+static const Register allocatable[NUM_ALLOCATABLE] = {
+  R10, R8, R9, RCX, RSI, RDI, RBX, R12, R13, R14, R15,
+};
+
+static bool IsCalleeSaved(Register reg) {
+  return reg == RBX || (R12 <= reg && reg <= R15);
+}
+
+typedef struct {
+  int vreg;
+  int start;
+  int end;
+  bool across_call;
+  int hint;           // register to take if it's free, or NO_REGISTER
+  int hint_vreg;      // virtual register whose register to take, or 0
+} Interval;
+
+typedef struct {
+  int words;          // per set
+  uint64_t *use;      // read before written in the block
+  uint64_t *def;
+  uint64_t *live_in;
+  uint64_t *live_out;
+} Liveness;
+
+static uint64_t *SetOf(Liveness *lv, uint64_t *sets, BasicBlock *block) {
+  return sets + block->id * lv->words;
+}
+
+static void AddToSet(uint64_t *set, int v) {
+  set[v / 64] |= 1ull << (v % 64);
+}
+
+static bool InSet(uint64_t *set, int v) {
+  return set[v / 64] >> (v % 64) & 1;
+}
+
+// Runs `body` with `v` set to each virtual register `insn` reads.
+#define FOR_EACH_USE(insn, v, body) \
+  do { \
+    if ((insn)->op == IR_CALL) { \
+      for (int arg_ = 0; arg_ < (insn)->num_args; ++arg_) { \
+        int v = (insn)->args[arg_]; \
+        body; \
+      } \
+    } \
+    if ((insn)->a) { \
+      int v = (insn)->a; \
+      body; \
+    } \
+    if ((insn)->b) { \
+      int v = (insn)->b; \
+      body; \
+    } \
+  } while (0)
+
+static void ComputeLiveness(Compiler *cc, IRFunction *fn, Liveness *lv) {
+  lv->words = fn->num_vregs / 64 + 1;
+  size_t size = fn->num_blocks * lv->words * sizeof(uint64_t);
+  lv->use = ArenaAlloc(cc, &cc->func_arena, AR_IR, size);
+  lv->def = ArenaAlloc(cc, &cc->func_arena, AR_IR, size);
+  lv->live_in = ArenaAlloc(cc, &cc->func_arena, AR_IR, size);
+  lv->live_out = ArenaAlloc(cc, &cc->func_arena, AR_IR, size);
+
+  for (BasicBlock *block = fn->blocks; block; block = block->next) {
+    uint64_t *use = SetOf(lv, lv->use, block);
+    uint64_t *def = SetOf(lv, lv->def, block);
+    for (IRInsn *insn = block->first; insn; insn = insn->next) {
+      FOR_EACH_USE(insn, v, if (!InSet(def, v)) AddToSet(use, v));
+      if (insn->dst) AddToSet(def, insn->dst);
+    }
+  }
+
+  // Until nothing changes, from the last block as liveness flows back.
+  BasicBlock **order = ArenaAlloc(cc, &cc->func_arena, AR_IR,
+                                  fn->num_blocks * sizeof(BasicBlock *));
+  for (BasicBlock *block = fn->blocks; block; block = block->next) {
+    order[block->id] = block;
+  }
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int i = fn->num_blocks - 1; i >= 0; --i) {
+      BasicBlock *block = order[i];
+      uint64_t *out = SetOf(lv, lv->live_out, block);
+      uint64_t *in = SetOf(lv, lv->live_in, block);
+      uint64_t *use = SetOf(lv, lv->use, block);
+      uint64_t *def = SetOf(lv, lv->def, block);
+
+      BasicBlock *succs[2];
+      int num_succs = Successors(block, succs);
+      for (int s = 0; s < num_succs; ++s) {
+        uint64_t *succ_in = SetOf(lv, lv->live_in, succs[s]);
+        for (int w = 0; w < lv->words; ++w) out[w] |= succ_in[w];
+      }
+      for (int w = 0; w < lv->words; ++w) {
+        uint64_t new_in = use[w] | (out[w] & ~def[w]);
+        if (new_in != in[w]) {
+          in[w] = new_in;
+          changed = true;
+        }
+      }
+    }
+  }
+}
+
+static void Extend(Interval *interval, int point) {
+  if (interval->start < 0 || point < interval->start) interval->start = point;
+  if (point > interval->end) interval->end = point;
+}
+
+static Interval *BuildIntervals(Compiler *cc, IRFunction *fn, Liveness *lv) {
+  Interval *intervals = ArenaAlloc(cc, &cc->func_arena, AR_IR,
+                                   (fn->num_vregs + 1) * sizeof(Interval));
+  for (int v = 0; v <= fn->num_vregs; ++v) {
+    intervals[v] = (Interval){v, -1, -1, false, NO_REGISTER, 0};
+  }
+
+  // Points of the calls, in order
+  int num_insns = 0;
+  for (BasicBlock *block = fn->blocks; block; block = block->next) {
+    for (IRInsn *insn = block->first; insn; insn = insn->next) ++num_insns;
+  }
+  int *calls = ArenaAlloc(cc, &cc->func_arena, AR_IR,
+                          (num_insns + 1) * sizeof(int));
+  int num_calls = 0;
+
+  int i = 0;
+  for (BasicBlock *block = fn->blocks; block; block = block->next) {
+    int block_start = 2 * i;
+    uint64_t *in = SetOf(lv, lv->live_in, block);
+    uint64_t *out = SetOf(lv, lv->live_out, block);
+    for (IRInsn *insn = block->first; insn; insn = insn->next, ++i) {
+      FOR_EACH_USE(insn, v, Extend(&intervals[v], 2 * i));
+      if (insn->dst) Extend(&intervals[insn->dst], 2 * i + 1);
+
+      switch (insn->op) {
+        case IR_PARAM:
+          intervals[insn->dst].hint = registers[insn->imm];
+          break;
+        case IR_CALL:
+          calls[num_calls++] = 2 * i;
+          for (int arg = 0; arg < insn->num_args && arg < 6; ++arg) {
+            Interval *interval = &intervals[insn->args[arg]];
+            if (interval->hint == NO_REGISTER) interval->hint = registers[arg];
+          }
+          break;
+        case IR_MOV:
+        case IR_ADD:
+        case IR_SUB:
+        case IR_MUL:
+          // "mov dst, a" is saved if `dst` is in the register of `a`.
+          intervals[insn->dst].hint_vreg = insn->a;
+          break;
+        default:
+          break;
+      }
+    }
+    int block_end = 2 * i - 1;
+    for (int v = 1; v <= fn->num_vregs; ++v) {
+      if (InSet(in, v)) Extend(&intervals[v], block_start);
+      if (InSet(out, v)) Extend(&intervals[v], block_end);
+    }
+  }
+
+  // A call at c crosses the interval if it's live before and after it.
+  for (int v = 1; v <= fn->num_vregs; ++v) {
+    Interval *interval = &intervals[v];
+    if (interval->start < 0) continue;
+    // Binary search of the first call after the start
+    int lo = 0;
+    int hi = num_calls;
+    while (lo < hi) {
+      int mid = (lo + hi) / 2;
+      if (calls[mid] > interval->start) {
+        hi = mid;
+      } else {
+        lo = mid + 1;
+      }
+    }
+    interval->across_call = lo < num_calls && calls[lo] + 1 < interval->end;
+  }
+  return intervals;
+}
+
+static int CompareStart(const void *a, const void *b) {
+  const Interval *x = *(Interval *const *)a;
+  const Interval *y = *(Interval *const *)b;
+  if (x->start != y->start) return x->start < y->start ? -1 : 1;
+  return x->vreg - y->vreg;
+}
+
+static bool Fits(Interval *interval, Register reg) {
+  return !interval->across_call || IsCalleeSaved(reg);
+}
+
+// The scratch registers, e.g. rdx hinted for the third argument, are not.
+static bool IsFree(Interval **holder, Interval *interval, int reg) {
+  if (reg == NO_REGISTER || reg == RAX || reg == RDX || reg == R11) {
+    return false;
+  }
+  return !holder[reg] && Fits(interval, reg);
+}
+
+/*
+ * Assigns a register or a stack slot to each virtual register of `fn`
+ * into `locs`. The slots are added to `fn->frame_size`, and the
+ * registers used are set in `fn->used_registers`.
+ */
+void AllocateRegisters(Compiler *cc, IRFunction *fn, Operand *locs) {
+  Liveness lv;
+  ComputeLiveness(cc, fn, &lv);
+  Interval *intervals = BuildIntervals(cc, fn, &lv);
+
+  Interval **sorted = ArenaAlloc(cc, &cc->func_arena, AR_IR,
+                                 (fn->num_vregs + 1) * sizeof(Interval *));
+  int num_intervals = 0;
+  for (int v = 1; v <= fn->num_vregs; ++v) {
+    if (intervals[v].start >= 0) {
+      sorted[num_intervals++] = &intervals[v];
+    } else {
+      // Only in the blocks removed as unreachable
+      locs[v] = Reg(RAX);
+    }
+  }
+  qsort(sorted, num_intervals, sizeof(Interval *), CompareStart);
+
+  Interval *active[NUM_ALLOCATABLE];
+  int num_active = 0;
+  // Interval holding each register, or NULL if it's free
+  Interval *holder[16] = {0};
+
+  for (int i = 0; i < num_intervals; ++i) {
+    Interval *cur = sorted[i];
+
+    for (int j = 0; j < num_active;) {
+      if (active[j]->end < cur->start) {
+        holder[locs[active[j]->vreg].reg] = NULL;
+        active[j] = active[--num_active];
+      } else {
+        ++j;
+      }
+    }
+
+    int reg = NO_REGISTER;
+    Operand *hinted = cur->hint_vreg ? &locs[cur->hint_vreg] : NULL;
+    if (hinted && hinted->kind == OP_REG &&
+        IsFree(holder, cur, hinted->reg)) {
+      reg = hinted->reg;
+    } else if (IsFree(holder, cur, cur->hint)) {
+      reg = cur->hint;
+    } else {
+      for (int r = 0; r < NUM_ALLOCATABLE; ++r) {
+        if (IsFree(holder, cur, allocatable[r])) {
+          reg = allocatable[r];
+          break;
+        }
+      }
+    }
+
+    if (reg == NO_REGISTER) {
+      // Spill the interval ending last, `cur` or an active one.
+      Interval *victim = cur;
+      int victim_index = -1;
+      for (int j = 0; j < num_active; ++j) {
+        if (active[j]->end > victim->end &&
+            Fits(cur, locs[active[j]->vreg].reg)) {
+          victim = active[j];
+          victim_index = j;
+        }
+      }
+      fn->frame_size += 8;
+      Operand slot = Mem(RBP, -fn->frame_size);
+      if (victim == cur) {
+        locs[cur->vreg] = slot;
+        continue;
+      }
+      reg = locs[victim->vreg].reg;
+      locs[victim->vreg] = slot;
+      active[victim_index] = active[--num_active];
+    }
+
+    locs[cur->vreg] = Reg(reg);
+    holder[reg] = cur;
+    active[num_active++] = cur;
+    fn->used_registers |= 1 << reg;
+  }
+}
@@ -0,0 +1,158 @@
+/* Copyright 2022 Keita Morisaki. All rights reserved. */
+/*
+ * Scanners for runs of whitespace, identifier characters and digits.
+ *
+ * Each scanner returns the first character at or after `p` that is
+ * NOT part of the run. The input must be NUL-terminated.
+ *
+ * The SIMD versions only issue aligned loads. An aligned load never
+ * crosses a page boundary, so reading the bytes around the terminating
+ * NUL can not fault even though they are outside of the string.
+ * They are still reads out of bounds to ASan and valgrind, which report
+ * them; run those with JCC_SCANNER=scalar.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./jcc.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define JCC_SIMD_SCAN 1
+#include <emmintrin.h>
+#endif
+
+/*** scalar ***/
+static inline bool InRange(char c, char lo, char hi) {
+  return (unsigned char)(c - lo) <= (unsigned char)(hi - lo);
+}
+
+static inline bool IsSpaceChar(char c) {
+  return c == ' ' || InRange(c, '\t', '\r');
+}
+
+static inline bool IsIdentChar(char c) {
+  return InRange(c | 0x20, 'a', 'z') || InRange(c, '0', '9') || c == '_';
+}
+
+static char *SkipSpacesScalar(char *p) {
+  while (IsSpaceChar(*p)) ++p;
+  return p;
+}
+
+static char *SkipIdentScalar(char *p) {
+  while (IsIdentChar(*p)) ++p;
+  return p;
+}
+
+static char *SkipDigitsScalar(char *p) {
+  while (InRange(*p, '0', '9')) ++p;
+  return p;
+}
+/*** scalar ***/
+
+
+#ifdef JCC_SIMD_SCAN
+/*
+ * Byte-wise "lo <= x <= hi" with signed compares only:
+ * shift the range so that it starts at -128, then compare
+ * against the shifted upper bound.
+ */
+#define SSE_IN_RANGE(x, lo, hi) \
+  _mm_cmplt_epi8(_mm_add_epi8((x), _mm_set1_epi8((char)(0x80 - (lo)))), \
+                 _mm_set1_epi8((char)(0x80 + (hi) - (lo) + 1)))
+
+/*** SSE2 ***/
+static inline __m128i SpaceMask16(__m128i x) {
+  return _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')),
+                      SSE_IN_RANGE(x, '\t', '\r'));
+}
+
+static inline __m128i IdentMask16(__m128i x) {
+  __m128i lower = _mm_or_si128(x, _mm_set1_epi8(0x20));
+  return _mm_or_si128(
+    _mm_or_si128(SSE_IN_RANGE(lower, 'a', 'z'), SSE_IN_RANGE(x, '0', '9')),
+    _mm_cmpeq_epi8(x, _mm_set1_epi8('_')));
+}
+
+static inline __m128i DigitMask16(__m128i x) {
+  return SSE_IN_RANGE(x, '0', '9');
+}
+
+/*
+ * Expands to the body of a SSE2 scanner. `mask_fn` marks the bytes
+ * that belong to the run; the first unmarked byte ends it.
+ */
+#define SSE_SCAN_BODY(p, mask_fn) \
+  do { \
+    uintptr_t misalign = (uintptr_t)(p) & 15; \
+    const __m128i *block = (const __m128i *)((p) - misalign); \
+    unsigned stop = \
+      ~_mm_movemask_epi8(mask_fn(_mm_load_si128(block))) & 0xFFFF; \
+    stop &= 0xFFFFu << misalign; \
+    while (!stop) { \
+      ++block; \
+      stop = ~_mm_movemask_epi8(mask_fn(_mm_load_si128(block))) & 0xFFFF; \
+    } \
+    return (char *)block + __builtin_ctz(stop); \
+  } while (0)
+
+static char *SkipSpacesSse2(char *p) {
+  SSE_SCAN_BODY(p, SpaceMask16);
+}
+
+static char *SkipIdentSse2(char *p) {
+  SSE_SCAN_BODY(p, IdentMask16);
+}
+
+static char *SkipDigitsSse2(char *p) {
+  SSE_SCAN_BODY(p, DigitMask16);
+}
+/*** SSE2 ***/
+#endif  // JCC_SIMD_SCAN
+
+
+/*
+ * SSE2 is part of x86-64, so it's chosen at compile time. Most runs are
+ * shorter than 16 bytes, so 32-byte loads of AVX2 measured no faster
+ * than SSE2 and aren't used.
+ */
+static const Scanner scanners[] = {
+#ifdef JCC_SIMD_SCAN
+  {"sse2", SkipSpacesSse2, SkipIdentSse2, SkipDigitsSse2},
+#endif
+  {"scalar", SkipSpacesScalar, SkipIdentScalar, SkipDigitsScalar},
+};
+
+#define NUM_SCANNERS (sizeof(scanners) / sizeof(scanners[0]))
+
+// The first of `scanners`
+Scanner scanner = {
+#ifdef JCC_SIMD_SCAN
+  "sse2", SkipSpacesSse2, SkipIdentSse2, SkipDigitsSse2,
+#else
+  "scalar", SkipSpacesScalar, SkipIdentScalar, SkipDigitsScalar,
+#endif
+};
+
+/*
+ * Selects the scanner named `name`. Returns false if the scanner
+ * does not exist.
+ */
+bool UseScanner(const char *name) {
+  for (size_t i = 0; i < NUM_SCANNERS; ++i) {
+    if (strcmp(scanners[i].name, name)) continue;
+
+    scanner = scanners[i];
+    return true;
+  }
+  return false;
+}
+
+// `JCC_SCANNER=<sse2|scalar>` overrides the scanner before `main` runs.
+__attribute__((constructor))
+static void SelectScanner() {
+  char *forced = getenv("JCC_SCANNER");
+  if (forced) UseScanner(forced);
+}
@@ -0,0 +1,126 @@
+/* Copyright 2022 Keita Morisaki. All rights reserved. */
+/*
+ * Compile statistics printed by --stats.
+ *
+ * Time is charged to the innermost phase that's running. So phases
+ * don't overlap, and they add up to the whole compilation.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include "./jcc.h"
+
+static const char *phase_names[PH_NUM_PHASES] = {
+  "input",
+  "tokenize",
+  "parse",
+  "add_type",
+  "fold",
+  "codegen",
+  "output",
+};
+
+static uint64_t NowNs(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Charges the time since the last phase switch to the innermost phase.
+static void ChargeInnermostPhase(Compiler *cc) {
+  uint64_t wall = NowNs(CLOCK_MONOTONIC);
+  uint64_t cpu = NowNs(CLOCK_THREAD_CPUTIME_ID);
+
+  if (cc->phase_depth) {
+    Phase phase = cc->phase_stack[cc->phase_depth - 1];
+    cc->phase_wall_ns[phase] += wall - cc->last_wall_ns;
+    cc->phase_cpu_ns[phase] += cpu - cc->last_cpu_ns;
+  }
+  cc->last_wall_ns = wall;
+  cc->last_cpu_ns = cpu;
+}
+
+// Does nothing unless --stats is given.
+void EnterPhase(Compiler *cc, Phase phase) {
+  if (!cc->stats_enabled) return;
+
+  assert(cc->phase_depth < MAX_PHASE_DEPTH);
+  ChargeInnermostPhase(cc);
+  cc->phase_stack[cc->phase_depth++] = phase;
+}
+
+// Resumes the phase that was running before the last `EnterPhase`.
+void LeavePhase(Compiler *cc) {
+  if (!cc->stats_enabled) return;
+
+  assert(cc->phase_depth > 0);
+  ChargeInnermostPhase(cc);
+  --cc->phase_depth;
+}
+
+static void PrintTime(FILE *out, const char *name,
+                      uint64_t wall, uint64_t cpu, bool last) {
+  fprintf(out, "    \"%s\": {\"wall_ms\": %.3f, \"cpu_ms\": %.3f}%s\n",
+          name, wall / 1e6, cpu / 1e6, last ? "" : ",");
+}
+
+// Prints the hits of each peephole rule as a member of an object.
+void PrintPeepholeHits(FILE *out, const int *hits) {
+  fprintf(out, "  \"peephole\": {");
+  for (int i = 0; i < NUM_PEEPHOLE_RULES; ++i) {
+    fprintf(out, "%s\"%s\": %d", i ? ", " : "", PeepholeRuleName(i), hits[i]);
+  }
+  fprintf(out, "},\n");
+}
+
+// Prints the statistics as a JSON object.
+void PrintStats(Compiler *cc, FILE *out) {
+  uint64_t total_wall = 0;
+  uint64_t total_cpu = 0;
+
+  fprintf(out, "{\n");
+  fprintf(out, "  \"phases\": {\n");
+  for (int i = 0; i < PH_NUM_PHASES; ++i) {
+    PrintTime(out, phase_names[i], cc->phase_wall_ns[i], cc->phase_cpu_ns[i],
+              false);
+    total_wall += cc->phase_wall_ns[i];
+    total_cpu += cc->phase_cpu_ns[i];
+  }
+  PrintTime(out, "total", total_wall, total_cpu, true);
+  fprintf(out, "  },\n");
+
+  fprintf(out, "  \"counts\": {\n");
+  fprintf(out, "    \"token\": %d,\n", cc->num_tokens);
+  for (int i = 0; i < AR_NUM_KINDS; ++i) {
+    fprintf(out, "    \"%s\": %zu%s\n", ArenaKindName(i),
+            cc->arena.objects[i] + cc->func_arena.objects[i],
+            i == AR_NUM_KINDS - 1 ? "" : ",");
+  }
+  fprintf(out, "  },\n");
+
+  fprintf(out, "  \"bytes\": {\n");
+  fprintf(out, "    \"token\": %zu,\n", cc->num_tokens * sizeof(Token));
+  for (int i = 0; i < AR_NUM_KINDS; ++i) {
+    fprintf(out, "    \"%s\": %zu,\n", ArenaKindName(i),
+            cc->arena.bytes[i] + cc->func_arena.bytes[i]);
+  }
+  fprintf(out, "    \"arena_reserved\": %zu,\n", cc->arena.peak_reserved_bytes);
+  fprintf(out, "    \"function_arena_reserved\": %zu\n",
+          cc->func_arena.peak_reserved_bytes);
+  fprintf(out, "  },\n");
+
+  fprintf(out, "  \"cache\": {\"hits\": %d, \"misses\": %d},\n",
+          cc->cache_hits, cc->cache_misses);
+  fprintf(out, "  \"fold\": {\"removed_nodes\": %d},\n", cc->folded_nodes);
+  PrintPeepholeHits(out, cc->peephole_hits);
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  // ru_maxrss is in kilobytes on Linux
+  fprintf(out, "  \"peak_rss_bytes\": %ld\n", usage.ru_maxrss * 1024);
+  fprintf(out, "}\n");
+}
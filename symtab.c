@@ -0,0 +1,79 @@
+/* Copyright 2022 Keita Morisaki. All rights reserved. */
+/*
+ * Hash table from interned identifiers to arbitrary values.
+ * Keys are compared by pointer, as `Ident`s are unique per spelling.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "./jcc.h"
+
+// Open addressing. The capacity is always 0 or a power of 2.
+#define SYMTAB_MIN_CAPACITY 8
+
+static void GrowSymbolTable(Compiler *cc, SymbolTable *table) {
+  int new_capacity =
+    table->capacity ? table->capacity * 2 : SYMTAB_MIN_CAPACITY;
+  SymbolTableEntry *new_entries =
+    calloc(new_capacity, sizeof(SymbolTableEntry));
+  if (!new_entries) {
+    ExitWithError(cc, "Out of memory.");
+  }
+
+  for (int i = 0; i < table->capacity; ++i) {
+    SymbolTableEntry *entry = &table->entries[i];
+    if (!entry->key) continue;
+
+    uint32_t j = entry->key->hash & (new_capacity - 1);
+    while (new_entries[j].key) j = (j + 1) & (new_capacity - 1);
+    new_entries[j] = *entry;
+  }
+
+  free(table->entries);
+  table->entries = new_entries;
+  table->capacity = new_capacity;
+}
+
+// Returns the value for `key`, or NULL if `key` is not in `table`.
+void *SymbolTableGet(SymbolTable *table, Ident *key) {
+  if (!table->count) return NULL;
+
+  uint32_t i = key->hash & (table->capacity - 1);
+  for (;;) {
+    SymbolTableEntry *entry = &table->entries[i];
+    if (entry->key == key) return entry->value;
+    if (!entry->key) return NULL;
+    i = (i + 1) & (table->capacity - 1);
+  }
+}
+
+// Sets the value for `key`, overwriting the old one if any.
+void SymbolTablePut(Compiler *cc, SymbolTable *table, Ident *key,
+                    void *value) {
+  // Keep the load factor at most 3/4.
+  if (4 * (table->count + 1) > 3 * table->capacity) {
+    GrowSymbolTable(cc, table);
+  }
+
+  uint32_t i = key->hash & (table->capacity - 1);
+  for (;;) {
+    SymbolTableEntry *entry = &table->entries[i];
+    if (entry->key == key) {
+      entry->value = value;
+      return;
+    }
+
+    if (!entry->key) {
+      entry->key = key;
+      entry->value = value;
+      ++(table->count);
+      return;
+    }
+    i = (i + 1) & (table->capacity - 1);
+  }
+}
+
+void SymbolTableRelease(SymbolTable *table) {
+  free(table->entries);
+  *table = (SymbolTable){0};
+}
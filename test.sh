@@ -3,15 +3,31 @@ assert() {
   expected="$1"
   input="$2"
 
-  ./jcc "$input" > tmp.s
+  ./jcc $JCCFLAGS "$input" > tmp.s
   cc -o tmp tmp.s
   ./tmp
   actual="$?"
 
-  if [ "$actual" = "$expected" ]; then
+  # The object encoded by jcc itself, without the assembler
+  ./jcc -c $JCCFLAGS -o tmp.o "$input" && cc -o tmp tmp.o && ./tmp
+  actual_object="$?"
+  ./jcc --run $JCCFLAGS "$input"
+  actual_run="$?"
+
+  # Through the IR
+  ./jcc -O1 $JCCFLAGS "$input" > tmp.s && cc -o tmp tmp.s && ./tmp
+  actual_ir="$?"
+  ./jcc --run -O1 $JCCFLAGS "$input"
+  actual_ir_run="$?"
+
+  if [ "$actual" = "$expected" ] && [ "$actual_object" = "$expected" ] &&
+      [ "$actual_run" = "$expected" ] && [ "$actual_ir" = "$expected" ] &&
+      [ "$actual_ir_run" = "$expected" ]; then
     echo "$input => $actual"
   else
-    echo "$input => $expected expected, but got $actual"
+    echo "$input => $expected expected, but got $actual" \
+      "($actual_object with -c, $actual_run with --run," \
+      "$actual_ir with -O1, $actual_ir_run with --run -O1)"
     exit 1
   fi
 }
@@ -40,6 +56,18 @@ expect_compile_err "int my_sum(int a, int b, ) {return a+b;} int main() {return
 expect_compile_err "int my_sum(int a, int b) {5=a; return a + b;} int main() {return my_sum(2, 3);}"
 # Array size must not be 0
 expect_compile_err "int main() {int a[0]; return 10;}"
+# Call of undefined function
+expect_compile_err "int main() {return foo(1, 2);}"
+# Number literal out of range
+expect_compile_err "int main() {return 99999999999999999999;}"
+# Function defined twice, prototype not matching, wrong number of arguments
+expect_compile_err "int f() {return 1;} int f() {return 2;} int main() {return f();}"
+expect_compile_err "int f(int a); int f(int a, int b) {return a+b;} int main() {return f(1, 2);}"
+expect_compile_err "int f(int a, int b) {return a+b;} int main() {return f(1);}"
+# Missing operand
+expect_compile_err "int main() {int a; a = 1 +; return a;}"
+# Variable declared in a block is not visible outside of it
+expect_compile_err "int main() {{int b; b=1;} return b;}"
 
 # return the inputted number
 assert 0 "int main() {0;}"
@@ -129,6 +157,33 @@ assert 120 "int combination(int n, int r) {if(n==r) return 1; if(r==0) return 1;
 assert 21 "int ten_sum(int a, int b, int c, int d, int e, int f) {return a+b+c+d+e+f;} int main() {return ten_sum(1,2,3,4,5,6);}"
 assert 15 "int ten_sum(int a, int b, int c, int d, int e, int f, int g, int h, int i) {return a+b+c+d+e+f-g-h+i;} int main() {return ten_sum(1,2,3,4,5,6,7,8,9);}"
 assert 25 "int ten_sum(int a, int b, int c, int d, int e, int f, int g, int h, int i, int j) {return a+b+c+d+e+f-g-h+i+j;} int main() {return ten_sum(1,2,3,4,5,6,7,8,9,10);}"
+assert 38 "int eight(int a, int b, int c, int d, int e, int f, int g, int h) {return a+h;} int main() {int x; x=0; x = eight(x,2,3,4,5,6,7,8); x = eight(x,2,3,4,5,6,7,30); return x;}"
+
+# Registers: swapped arguments, rdx as an argument, values across calls
+# and more values than registers
+assert 21 "int f(int a, int b) {return a*10+b;} int g(int a, int b) {return f(b, a);} int main() {return g(1, 2);}"
+assert 10 "int f(int a, int b, int c) {return a+b+c;} int main() {int x; int y; int z; x = 7; y = x%5; z = x/2; return f(z, z, y) + x/3;}"
+assert 36 "int f(int x) {return x;} int main() {return f(1)+(f(2)+(f(3)+(f(4)+(f(5)+(f(6)+(f(7)+f(8)))))));}"
+assert 120 "int main() {int a; a=1; return a*1+(a*2+(a*3+(a*4+(a*5+(a*6+(a*7+(a*8+(a*9+(a*10+(a*11+(a*12+(a*13+(a*14+a*15)))))))))))));}"
+
+# Variables in registers and in memory
+assert 9 "int main() {int x; int *p; p=&x; *p=3; x+=1; x*=2; return x+*p-7;}"
+assert 12 "int f(int a, int b, int c, int d, int e, int f, int g, int h) {g+=h; int *p; p=&h; *p=1; return g+h;} int main() {return f(1, 2, 3, 4, 5, 6, 7, 4);}"
+assert 5 "int main() {int a[2]; int i; int s; s=0; for (i=0; i<2; i++) a[i]=i+2; for (i=0; i<2; i++) s+=a[i]; s--; return s+1;}"
+
+# Constant folding
+assert 64 "int main() {return (2147483647+1)/33554432;}"
+assert 7 "int main() {int x; x=5; return (x+1)+4-3+0*x + x*1/1 - (2*x-x) - -1 - 1;}"
+assert 5 "int main() {int i; i=5; i++;}"
+assert 7 "int main() {int i; i=5; i++; i--; i++; ++i; return i;}"
+assert 4 "int main() {int a[3]; a[0]=1; a[1]=2; a[2]=3; int *p; p=a+2; return *(p-1) + *(a+0) + *(p+1-1-1-1);}"
+assert 1 "int main() {return (1<2)+(2<=1)*4+(3==3)*0+(3!=3);}"
+assert 0 "int g[10]; int f0() { { int b; return 0 * g[8]; } } int main() {g[8]=3; return f0();}"
+assert 8 "int main() {int x; x=2; {int b; b=3; if (x) {int c; c=1; return 2*b + x*1 + 0*c;}} return 0;}"
+assert 21 "int g(int a) {return a;} int f(int a, int b) {return a*10+b;} int main() {return f(2, g(1)*1);}"
+assert 3 "int g(int a) {return a;} int f(int a, int b) {return a+b;} int main() {return f(g(1)+0, 2);}"
+assert 4 "int k(int a) {return a;} int main() {int v; v=1; return k(2*(v+v));}"
+assert 0 "int k(int a) {return a;} int main() {int v; v=1; return k(2==(v<3));}"
 
 # mod (%)
 assert 0 "int main() {10%5;}"
@@ -240,4 +295,215 @@ assert 28 "int a[10]; int main() { a[2] = 28; return a[2]; }"
 assert 28 "int a[10]; int main() { a[7] = 28; return a[7]; }"
 assert 0 "int a[10]; int main() { a[9] = 28; return a[0]; }"
 
+# Block scope
+assert 3 "int main() {int a; a=1; {int a; a=2;} {int b; b=2; a=a+b;} return a;}"
+assert 7 "int a; int main() {a=3; {int a; a=4; {int a; a=5;} return a+3;}}"
+assert 5 "int main() {int i; int s; s=0; for (i=0; i<5; ++i) {int t; t=1; s+=t;} return s;}"
+
+# Loops don't leave values on the stack
+assert 192 "int main() {int i; int s; s=0; for (i=0; i<3000000; ++i) s=s+1; while (i>0) i=i-1; return s;}"
+
+# Stack frame large enough for many locals
+assert 28 "int clear() {int b[40]; int i; for (i=0; i<40; ++i) b[i]=0; return 0;} int main() {int a[40]; int i; for (i=0; i<40; ++i) a[i]=7; clear(); int s; s=0; for (i=0; i<40; ++i) s+=a[i]; return s/10;}"
+
+# Prototype
+assert 5 "int f(int a, int b); int main() {return f(2, 3);} int f(int a, int b) {return a+b;}"
+assert 8 "int *g(int *p); int main() {int a; int *b; a=8; b=g(&a); return *b;} int *g(int *p) {return p;}"
+assert 13 "int odd(int n); int even(int n) {if (n==0) return 1; return odd(n-1);} int odd(int n) {if (n==0) return 0; return even(n-1);} int main() {return even(10)+12;}"
+
+# More than 100 top-level items
+many_funcs=""
+for i in $(seq 1 150); do
+  many_funcs="$many_funcs int f$i(int a) {return a+$i;}"
+done
+assert 151 "$many_funcs int g; int main() {g=1; return f150(g);}"
+
+# Debug comments don't change the program
+JCCFLAGS="-fverbose-asm"
+assert 42 "int main() {int a; a=3; if (a==3) {return 42;} return 0;}"
+JCCFLAGS=""
+
+# Output file
+rm -f tmp.s
+./jcc -o tmp.s "int main() {return 7;}" > /dev/null
+cc -o tmp tmp.s && ./tmp
+if [ $? -ne 7 ]; then
+  echo "-o => Didn't write the assembly to the file"
+  exit 1
+fi
+./jcc -o tmp.s "int main() {return foo();}" 2> /dev/null
+if [ -e tmp.s ]; then
+  echo "-o => Output file is left after an error"
+  exit 1
+fi
+
+# Source file bigger than a command line argument can be
+rm -f tmp.c
+for i in $(seq 1 4000); do
+  echo "int f$i(int a) {int b; b=a+$i; return b;}" >> tmp.c
+done
+echo "int main() {return f4000(2)-3960;}" >> tmp.c
+./jcc -o tmp.s tmp.c && cc -o tmp tmp.s && ./tmp
+if [ $? -ne 42 ]; then
+  echo "tmp.c => 42 expected"
+  exit 1
+fi
+
+# Code generated on threads is the same as on one thread
+rm -f tmp.c
+for i in $(seq 1 300); do
+  echo "int g$i(int a) {int i; for (i = 0; i < $i; ++i) if (a > i) a = a - 1;"\
+    "while (a < $i) a = a + 2; return a;}" >> tmp.c
+done
+echo "int main() {return g300(7) - 259;}" >> tmp.c
+./jcc -o tmp.s tmp.c && ./jcc -j 3 -o tmp_j.s tmp.c && cmp -s tmp.s tmp_j.s \
+  && cc -o tmp tmp_j.s && ./tmp
+if [ $? -ne 42 ]; then
+  echo "-j 3 tmp.c => 42 and the same code as without -j expected"
+  exit 1
+fi
+
+# Running in memory calls libc
+program="int putchar(int c); int main() {putchar(79); putchar(75); return 3;}"
+output=$(./jcc --run "$program")
+if [ $? -ne 3 ] || [ "$output" != "OK" ]; then
+  echo "--run => \"OK\" printed and 3 expected"
+  exit 1
+fi
+./jcc --run "int toupper(int c); int main() {return toupper(97);}"
+if [ $? -ne 65 ]; then
+  echo "--run => 65 expected from toupper found by dlsym"
+  exit 1
+fi
+if ./jcc --run "int f(); int main() {return f();}" 2> /dev/null; then
+  echo "--run => Error expected for an undefined function"
+  exit 1
+fi
+
+# IR, and objects through it
+program="int f(int a) {return a*2;} int main() {int i; for (i=0; i<3; ++i) f(i);}"
+if ! ./jcc --dump-ir "$program" | grep -q "^  v[0-9]* = call f(v[0-9]*)$" ||
+    ! ./jcc --dump-ir "$program" | grep -q "^  br v[0-9]*, B[0-9]*, B[0-9]*$"
+then
+  echo "--dump-ir => A call and a branch expected in the IR"
+  exit 1
+fi
+# Variables without their address taken don't live in memory.
+program="int main() {int i; int s; s=0; for (i=0; i<10; i++) s+=i; return s;}"
+if ./jcc --dump-ir "$program" | grep -q "load\|store"; then
+  echo "--dump-ir => i and s expected in registers"
+  exit 1
+fi
+./jcc -O1 -c -o tmp.o "int main() {int a; a=3; return (a!=3)+(a!=4)*2;}" \
+  && cc -o tmp tmp.o && ./tmp
+if [ $? -ne 2 ]; then
+  echo "-O1 -c => 2 expected"
+  exit 1
+fi
+
+# Source from stdin
+printf "int main() {\n  return 6;\n}\n" | ./jcc - > tmp.s
+cc -o tmp tmp.s && ./tmp
+if [ $? -ne 6 ]; then
+  echo "stdin => 6 expected"
+  exit 1
+fi
+
+# Error location is reported as line:column
+printf "int main() {\n  int a;\n  a = 1 +;\n}\n" > tmp.c
+if ! ./jcc tmp.c 2>&1 >/dev/null | grep -q "^tmp.c:3:10: "; then
+  echo "tmp.c => Error location \"tmp.c:3:10\" expected"
+  exit 1
+fi
+
+# Statistics
+if ! ./jcc --stats "int main() {return 0;}" 2>&1 >/dev/null \
+    | grep -q '"peak_rss_bytes": [0-9]'; then
+  echo "--stats => Didn't print the statistics"
+  exit 1
+fi
+if ! ./jcc --stats "int main() {return 2*3+4;}" 2>&1 >/dev/null \
+    | grep -q '"fold": {"removed_nodes": 4}'; then
+  echo "--stats => 4 nodes expected to be folded"
+  exit 1
+fi
+if ! ./jcc --stats "int main() {int a; a=3; return a;}" 2>&1 >/dev/null \
+    | grep -q '"peephole": {"push_pop": [1-9]'; then
+  echo "--stats => Didn't count the peephole rewrites"
+  exit 1
+fi
+
+# Peephole optimization, also with the comments of -fverbose-asm around
+program="int main() {int a; int b; a=3; b=a*2+1; return b-a;}"
+if ./jcc "$program" | grep -q "push [0-9]\|sub rax, [0-9]"; then
+  echo "peephole => Pushed constants or sub rax left in main"
+  exit 1
+fi
+./jcc -fverbose-asm "$program" > tmp.s && cc -o tmp tmp.s && ./tmp
+if [ $? -ne 4 ]; then
+  echo "-fverbose-asm => 4 expected"
+  exit 1
+fi
+
+# Several files on threads, each as if compiled alone
+tmp_dir=$(mktemp -d)
+echo "int f(int x) {return x * 2;} int main() {return f(21);}" > "$tmp_dir/a.c"
+echo "int g[10]; int main() {g[3] = 7; return g[3];}" > "$tmp_dir/b.c"
+echo "int main() {return b;}" > "$tmp_dir/bad.c"
+mkdir "$tmp_dir/out"
+./jcc -j 2 -o "$tmp_dir/out" "$tmp_dir/a.c" "$tmp_dir/bad.c" "$tmp_dir/b.c" \
+  2> "$tmp_dir/err"
+status=$?
+for name in a b; do
+  if ! ./jcc "$tmp_dir/$name.c" | cmp -s - "$tmp_dir/out/$name.s"; then
+    echo "-j 2 => $name.s differs from compiling $name.c alone"
+    exit 1
+  fi
+done
+if [ $status -eq 0 ] || [ -e "$tmp_dir/out/bad.s" ] ||
+    ! grep -q "bad.c:1:20: " "$tmp_dir/err"; then
+  echo "-j 2 => Error in bad.c expected only for bad.c"
+  exit 1
+fi
+./jcc -c -j 2 -o "$tmp_dir/out" "$tmp_dir/a.c" "$tmp_dir/b.c" \
+  && cc -o "$tmp_dir/a" "$tmp_dir/out/a.o" && "$tmp_dir/a"
+if [ $? -ne 42 ] || [ ! -e "$tmp_dir/out/b.o" ]; then
+  echo "-c -j 2 => a.o and b.o expected, a.o returning 42"
+  exit 1
+fi
+rm -rf "$tmp_dir"
+
+# Cached code is the same as generated, and used only for unchanged functions
+tmp_dir=$(mktemp -d)
+echo "int f(int x) {if (x) return x * 2; return 1;}" \
+  "int g[4]; int h(int x) {g[1] = x; return f(g[1]);}" \
+  "int main() {return h(21);}" > tmp.c
+./jcc -o tmp.s tmp.c
+for run in 1 2; do
+  ./jcc --cache-dir "$tmp_dir/cache" --stats -o tmp_j.s tmp.c 2> "$tmp_dir/stats"
+  if ! cmp -s tmp.s tmp_j.s; then
+    echo "--cache-dir (run $run) => Code differs from compiling without cache"
+    exit 1
+  fi
+done
+if ! grep -q '"cache": {"hits": 3, "misses": 0}' "$tmp_dir/stats"; then
+  echo "--cache-dir => 3 hits expected on the second run"
+  exit 1
+fi
+sed -i "s/x \* 2/x * 2 + 1/" tmp.c
+./jcc --cache-dir "$tmp_dir/cache" --stats -o tmp_j.s tmp.c 2> "$tmp_dir/stats"
+cc -o tmp tmp_j.s && ./tmp
+if [ $? -ne 43 ] || \
+    ! grep -q '"cache": {"hits": 2, "misses": 1}' "$tmp_dir/stats"; then
+  echo "--cache-dir => 43 and only f compiled again expected after changing f"
+  exit 1
+fi
+rm -rf "$tmp_dir"
+
+# Compiling in-process with libjcc, including errors, without leaking
+if ! ./bench/lib 5000 > /dev/null; then
+  echo "bench/lib => Failed"
+  exit 1
+fi
+
 echo OK
@@ -0,0 +1 @@
+int f(int x) {if (x) return x * 2 + 1; return 1;} int g[4]; int h(int x) {g[1] = x; return f(g[1]);} int main() {return h(21);}
@@ -0,0 +1,75 @@
+.intel_syntax noprefix
+.globl main
+f:
+  push rbp
+  mov rbp, rsp
+  sub rsp, 16
+  lea rax, [rbp-8]
+  mov [rax], rdi
+  lea rax, [rbp-8]
+  mov rdi, [rax]
+  mov rax, rdi
+  cmp rax, 0
+  je .Lf_0
+  lea rax, [rbp-8]
+  mov rdi, [rax]
+  mov rax, rdi
+  mov rdi, 2
+  imul rax, rdi
+  mov rdi, 1
+  add rax, rdi
+  mov rsp, rbp
+  pop rbp
+  ret
+  jmp .Lf_1
+.Lf_0:
+.Lf_1:
+  mov rax, 1
+  mov rsp, rbp
+  pop rbp
+  ret
+  mov rsp, rbp
+  pop rbp
+  ret
+h:
+  push rbp
+  mov rbp, rsp
+  sub rsp, 16
+  lea rax, [rbp-8]
+  mov [rax], rdi
+  lea rax, g[rip]
+  mov rdi, 8
+  add rax, rdi
+  push rax
+  lea rax, [rbp-8]
+  mov rdi, [rax]
+  pop rax
+  mov [rax], rdi
+  lea rax, g[rip]
+  mov rdi, 8
+  add rax, rdi
+  mov rax, [rax]
+  mov rdi, rax
+  call f
+  mov rsp, rbp
+  pop rbp
+  ret
+  mov rsp, rbp
+  pop rbp
+  ret
+main:
+  push rbp
+  mov rbp, rsp
+  sub rsp, 0
+  mov rdi, 21
+  call h
+  mov rsp, rbp
+  pop rbp
+  ret
+  mov rsp, rbp
+  pop rbp
+  ret
+
+.data
+g:
+  .zero 32
@@ -1,140 +1,164 @@
 /* Copyright 2021 Keita Morisaki. All rights reserved. */
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
 #include <stdbool.h>
 
 #include "./jcc.h"
 
-Token *token;       // token currently processed
-char *user_input;   // whole program
-
 /*** tokenizer ***/
-static Token *ConnectAndGetNewToken(
-    TokenKind kind, Token *current, char *str, int len
-  ) {
-  Token *new_token = calloc(1, sizeof(Token));
+static Token *NewToken(Compiler *cc, TokenKind kind, char *str, int len) {
+  if (cc->num_tokens == cc->tokens_capacity) {
+    cc->tokens_capacity = cc->tokens_capacity ? cc->tokens_capacity * 2 : 1024;
+    cc->tokens = realloc(cc->tokens, cc->tokens_capacity * sizeof(Token));
+    if (!cc->tokens) {
+      ExitWithError(cc, "Out of memory.");
+    }
+  }
+
+  Token *new_token = &cc->tokens[cc->num_tokens++];
+  *new_token = (Token){0};
   new_token->kind = kind;
   new_token->str = str;
   new_token->len = len;
-
-  current->next = new_token;
   return new_token;
 }
 
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wuninitialized"
-// Handling global variables that are pointers.
-// They are not necessarily initialized in this function.
-void Tokenize() {
-  char *char_pointer = user_input;
-  Token *head = calloc(1, sizeof(Token));
-  head->next = NULL;
-  Token *cur = head;
-
-  while (*char_pointer) {
-    if (isspace(*char_pointer)) {
-      ++char_pointer;
-      continue;
-    }
-
-    if (StartsWith(char_pointer, "sizeof") &&
-      !IsAlnumOrUnderscore(char_pointer[6])) {
-      cur = ConnectAndGetNewToken(TK_RESERVED, cur, char_pointer, 6);
-      char_pointer += 6;
-      continue;
-    }
-
-    if (StartsWith(char_pointer, "return") &&
-      !IsAlnumOrUnderscore(char_pointer[6])) {
-      cur = ConnectAndGetNewToken(TK_RETURN, cur, char_pointer, 6);
-      char_pointer += 6;
-      continue;
-    }
-
-    if (StartsWith(char_pointer, "if") &&
-      !IsAlnumOrUnderscore(char_pointer[2])) {
-      cur = ConnectAndGetNewToken(TK_IF, cur, char_pointer, 2);
-      char_pointer += 2;
-      continue;
-    }
-
-    if (StartsWith(char_pointer, "else") &&
-      !IsAlnumOrUnderscore(char_pointer[4])) {
-      cur = ConnectAndGetNewToken(TK_ELSE, cur, char_pointer, 4);
-      char_pointer += 4;
-      continue;
-    }
+/*
+ * Character classes of the first character of a token.
+ * Every byte is classified with one table lookup instead of
+ * a chain of comparisons. The rest of a run (identifier, number,
+ * whitespace) is consumed by `scanner`.
+ */
+enum {
+  CH_SPACE = 1 << 0,
+  CH_IDENT_HEAD = 1 << 1,     // can start an identifier
+  CH_DIGIT = 1 << 2,
+  CH_PUNCT = 1 << 3,          // one-character punctuator
+  CH_PUNCT_EQ = 1 << 4,       // can be followed by "=" (e.g. "<=", "+=")
+  CH_PUNCT_TWICE = 1 << 5,    // can be doubled (e.g. "++")
+};
+
+static const unsigned char char_class[256] = {
+  [' '] = CH_SPACE, ['\t'] = CH_SPACE, ['\n'] = CH_SPACE,
+  ['\v'] = CH_SPACE, ['\f'] = CH_SPACE, ['\r'] = CH_SPACE,
+
+  ['a' ... 'z'] = CH_IDENT_HEAD,
+  ['A' ... 'Z'] = CH_IDENT_HEAD,
+  ['0' ... '9'] = CH_DIGIT,
+
+  [';'] = CH_PUNCT, ['('] = CH_PUNCT, [')'] = CH_PUNCT,
+  ['{'] = CH_PUNCT, ['}'] = CH_PUNCT, ['['] = CH_PUNCT,
+  [']'] = CH_PUNCT, [','] = CH_PUNCT, ['&'] = CH_PUNCT,
+  ['!'] = CH_PUNCT_EQ,
+  ['='] = CH_PUNCT | CH_PUNCT_EQ,
+  ['<'] = CH_PUNCT | CH_PUNCT_EQ,
+  ['>'] = CH_PUNCT | CH_PUNCT_EQ,
+  ['*'] = CH_PUNCT | CH_PUNCT_EQ,
+  ['/'] = CH_PUNCT | CH_PUNCT_EQ,
+  ['%'] = CH_PUNCT | CH_PUNCT_EQ,
+  ['+'] = CH_PUNCT | CH_PUNCT_EQ | CH_PUNCT_TWICE,
+  ['-'] = CH_PUNCT | CH_PUNCT_EQ | CH_PUNCT_TWICE,
+};
+
+/*
+ * Returns the kind of a keyword, or TK_IDENT if the identifier
+ * is not a keyword. Called only after a whole identifier is scanned,
+ * so that identifiers pay for at most one memcmp.
+ */
+static TokenKind KeywordKind(char *str, int len) {
+  switch (len) {
+    case 2:
+      if (!memcmp(str, "if", 2)) return TK_IF;
+      break;
+    case 3:
+      if (!memcmp(str, "for", 3)) return TK_FOR;
+      if (!memcmp(str, "int", 3)) return TK_INT;
+      break;
+    case 4:
+      if (!memcmp(str, "else", 4)) return TK_ELSE;
+      break;
+    case 5:
+      if (!memcmp(str, "while", 5)) return TK_WHILE;
+      break;
+    case 6:
+      if (!memcmp(str, "return", 6)) return TK_RETURN;
+      // "sizeof" is handled as an operator by the parser
+      if (!memcmp(str, "sizeof", 6)) return TK_RESERVED;
+      break;
+  }
+  return TK_IDENT;
+}
 
-    if (StartsWith(char_pointer, "while") &&
-      !IsAlnumOrUnderscore(char_pointer[5])) {
-      cur = ConnectAndGetNewToken(TK_WHILE, cur, char_pointer, 5);
-      char_pointer += 5;
-      continue;
-    }
+// Returns the length of the punctuator at `p`, or 0 if there is none.
+static int PunctuatorLength(char *p) {
+  unsigned char cls = char_class[(unsigned char)*p];
+  if ((cls & CH_PUNCT_EQ) && p[1] == '=') return 2;
+  if ((cls & CH_PUNCT_TWICE) && p[1] == *p) return 2;
+  if (cls & CH_PUNCT) return 1;
+  return 0;
+}
 
-    if (StartsWith(char_pointer, "for") &&
-      !IsAlnumOrUnderscore(char_pointer[3])) {
-      cur = ConnectAndGetNewToken(TK_FOR, cur, char_pointer, 3);
-      char_pointer += 3;
-      continue;
-    }
+void Tokenize(Compiler *cc) {
+  char *char_pointer = cc->user_input;
+  cc->num_tokens = 0;
 
-    if (StartsWith(char_pointer, "int") &&
-      !IsAlnumOrUnderscore(char_pointer[3])) {
-      cur = ConnectAndGetNewToken(TK_INT, cur, char_pointer, 3);
-      char_pointer += 3;
-      continue;
-    }
+  while (*char_pointer) {
+    unsigned char cls = char_class[(unsigned char)*char_pointer];
 
-    if (StartsWith(char_pointer, "==") ||
-      StartsWith(char_pointer, "!=") ||
-      StartsWith(char_pointer, "<=") ||
-      StartsWith(char_pointer, ">=") ||
-      StartsWith(char_pointer, "++") ||
-      StartsWith(char_pointer, "--") ||
-      StartsWith(char_pointer, "+=") ||
-      StartsWith(char_pointer, "-=") ||
-      StartsWith(char_pointer, "*=") ||
-      StartsWith(char_pointer, "/=") ||
-      StartsWith(char_pointer, "%=")) {
-      cur = ConnectAndGetNewToken(TK_RESERVED, cur, char_pointer, 2);
-      char_pointer += 2;
+    if (cls & CH_SPACE) {
+      char_pointer = scanner.skip_spaces(char_pointer + 1);
       continue;
     }
 
-    if (('a' <= *char_pointer && *char_pointer <= 'z') ||
-      ('A' <= *char_pointer && *char_pointer <= 'Z')) {
+    if (cls & CH_IDENT_HEAD) {
       char *start_at = char_pointer;
-      while (IsAlnumOrUnderscore(*char_pointer)) {
-        ++char_pointer;
+      char_pointer = scanner.skip_ident(char_pointer + 1);
+      int len = char_pointer - start_at;
+      Token *tok = NewToken(cc, KeywordKind(start_at, len), start_at, len);
+      if (tok->kind == TK_IDENT) {
+        tok->ident = Intern(cc, start_at, len);
       }
-      cur = ConnectAndGetNewToken(
-        TK_IDENT, cur, start_at, char_pointer-start_at);
       continue;
     }
 
-    if (strchr(";=+-*/()><{}[],%&", *char_pointer)) {
-      cur = ConnectAndGetNewToken(TK_RESERVED, cur, char_pointer++, 1);
-      continue;
-    }
-
-    if (isdigit(*char_pointer)) {
+    if (cls & CH_DIGIT) {
       // len is temporarily set to 0
-      cur = ConnectAndGetNewToken(TK_NUM, cur, char_pointer, 0);
+      Token *num = NewToken(cc, TK_NUM, char_pointer, 0);
 
       char *num_start = char_pointer;
-      cur->val = strtol(char_pointer, &char_pointer, 10);
-      cur->len = char_pointer - num_start;
+      char_pointer = scanner.skip_digits(char_pointer + 1);
+      long val = 0;
+      for (char *digit = num_start; digit < char_pointer; ++digit) {
+        int d = *digit - '0';
+        if (val > (LONG_MAX - d) / 10) {
+          ExitWithErrorAt(cc, num_start, "Number too large.");
+        }
+        val = val * 10 + d;
+      }
+      num->val = val;
+      num->len = char_pointer - num_start;
       continue;
     }
 
-    ExitWithErrorAt(user_input, char_pointer, "Invalid token.");
+    int punct_len = PunctuatorLength(char_pointer);
+    if (punct_len) {
+      NewToken(cc, TK_RESERVED, char_pointer, punct_len);
+      char_pointer += punct_len;
+      continue;
+    }
+
+    ExitWithErrorAt(cc, char_pointer, "Invalid token.");
   }
 
-  ConnectAndGetNewToken(TK_EOF, cur, char_pointer, 1);
-  token = head->next;
+  NewToken(cc, TK_EOF, char_pointer, 1);
+}
+
+void ReleaseTokens(Compiler *cc) {
+  free(cc->tokens);
+  cc->tokens = NULL;
+  cc->num_tokens = 0;
+  cc->tokens_capacity = 0;
 }
-#pragma GCC diagnostic pop
 /*** tokenizer ***/
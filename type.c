@@ -7,8 +7,8 @@
 
 Type *ty_int = &(Type){TY_INT};   // NOLINT(readability/braces)
 
-bool IsTypeToken() {
-  switch (token->kind) {
+bool IsTypeToken(Token *tok) {
+  switch (tok->kind) {
   case TK_INT:
     return true;
 
@@ -20,32 +20,56 @@ bool IsTypeToken() {
 /*
  * Get "Type *" pointing to "point_to"
  */
-Type *PointTo(Type *point_to) {
-  Type *ty = calloc(1, sizeof(Type));
+Type *PointTo(Compiler *cc, Type *point_to) {
+  // Only expressions get their type this way, so it's local to a function.
+  Type *ty = ArenaAlloc(cc, &cc->func_arena, AR_TYPE, sizeof(Type));
   ty->kind = TY_PTR;
   ty->point_to = point_to;
   return ty;
 }
 
-void AddType(Node *node) {
+bool IsSameType(Type *a, Type *b) {
+  if (a == b) return true;
+  if (a->kind != b->kind) return false;
+  if (a->kind == TY_ARRAY && a->array_size != b->array_size) return false;
+  if (a->kind == TY_INT) return true;
+  return IsSameType(a->point_to, b->point_to);
+}
+
+static void AddTypeRecursively(Compiler *cc, Node *node);
+
+/*
+ * Types the statements linked by `next_in_block` from `first`. The walk
+ * is done here rather than from each statement, as a statement typed
+ * already, like a declaration, would stop it.
+ */
+static void AddTypeToStatements(Compiler *cc, Node *first) {
+  for (Node *nd = first; nd; nd = nd->next_in_block) {
+    AddTypeRecursively(cc, nd);
+  }
+}
+
+static void AddTypeRecursively(Compiler *cc, Node *node) {
   if (!node || node->type) {
     return;
   }
 
-  AddType(node->lhs);
-  AddType(node->rhs);
-  AddType(node->condition);
-  AddType(node->body_program);
-  AddType(node->else_program);
-  AddType(node->initialization);
-  AddType(node->iteration);
+  AddTypeRecursively(cc, node->lhs);
+  AddTypeRecursively(cc, node->rhs);
+  AddTypeRecursively(cc, node->condition);
+  AddTypeToStatements(cc, node->body_program);
+  AddTypeRecursively(cc, node->else_program);
+  AddTypeRecursively(cc, node->initialization);
+  AddTypeRecursively(cc, node->iteration);
 
-  for (Node *nd = node->next_in_block; nd; nd=nd->next_in_block) {
-    AddType(nd);
+  if (node->kind == ND_FUNC_DEFINITION) {
+    AddTypeToStatements(cc, node->next_in_block);
+  }
+  // Each argument, as one typed already would stop a walk through them
+  for (Node *arg = node->args; arg; arg = arg->arg_next) {
+    AddTypeRecursively(cc, arg);
   }
 
-  Type *ty_int = calloc(1, sizeof(Type));
-  ty_int->kind = TY_INT;
   switch (node->kind) {
     case ND_LOCAL_VAR:
     case ND_GLBL_VAR:
@@ -66,10 +90,10 @@ void AddType(Node *node) {
       node->type = ty_int;
       return;
     case ND_FUNC_CALL:
-      node->type = node->func_def->ret_type;
+      node->type = node->func->ret_type;
       return;
     case ND_ADDR:
-      node->type = PointTo(node->lhs->type);
+      node->type = PointTo(cc, node->lhs->type);
       return;
     case ND_DEREF:
       if (node->lhs->type->kind == TY_PTR)
@@ -85,3 +109,15 @@ void AddType(Node *node) {
       return;
   }
 }
+
+// Sets `type` of `node` and of the nodes under it.
+void AddType(Compiler *cc, Node *node) {
+  // Most calls find the type already set. Don't time those.
+  if (!node || node->type) {
+    return;
+  }
+
+  EnterPhase(cc, PH_ADD_TYPE);
+  AddTypeRecursively(cc, node);
+  LeavePhase(cc);
+}
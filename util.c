@@ -1,32 +1,96 @@
 /* Copyright 2021 Keita Morisaki. All rights reserved. */
+#define _POSIX_C_SOURCE 200809L
+#include <setjmp.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
+
+#include "./jcc.h"
 
 /*** error ***/
-void ExitWithErrorAt(char *input, char *loc, char *fmt, ...) {
+/*
+ * An error ends the compilation. It's printed to stderr and the process
+ * exits, or if `cc->error_jmp` is set, it's written to
+ * `cc->error_message` and the compilation returns to `cc->error_jmp`.
+ */
+static FILE *OpenErrorStream(Compiler *cc) {
+  if (!cc->error_jmp) return stderr;
+
+  // Leave the last byte for NUL, as the message may be truncated.
+  memset(cc->error_message, 0, sizeof(cc->error_message));
+  return fmemopen(cc->error_message, sizeof(cc->error_message) - 1, "w");
+}
+
+static _Noreturn void EndCompilation(Compiler *cc, FILE *err) {
+  if (!cc->error_jmp) exit(1);
+
+  if (err) {
+    fclose(err);
+  } else {
+    snprintf(cc->error_message, sizeof(cc->error_message), "Out of memory.");
+  }
+
+  // Scopes of the blocks being parsed live in the frames to be unwound.
+  while (cc->current_scope && cc->current_scope != &cc->global_scope) {
+    Scope *scope = cc->current_scope;
+    cc->current_scope = scope->parent;
+    SymbolTableRelease(&scope->vars);
+  }
+  longjmp(*cc->error_jmp, 1);
+}
+
+// Ends the compilation with the error already in `cc->error_message`.
+_Noreturn void ExitWithSavedError(Compiler *cc) {
+  if (!cc->error_jmp) {
+    fputs(cc->error_message, stderr);
+    exit(1);
+  }
+  longjmp(*cc->error_jmp, 1);
+}
+
+/*
+ * Reports an error at `loc` as "<input name>:<line>:<column>: <message>",
+ * followed by the line containing `loc` and a marker under it.
+ */
+_Noreturn void ExitWithErrorAt(Compiler *cc, char *loc, char *fmt, ...) {
   va_list ap;
   va_start(ap, fmt);
 
-  int padding_len = loc - input;
-  char marker[] = "^ ";
-  int marker_len = (int) strlen(marker);
-  fprintf(stderr, "%s\n", input);
-  fprintf(stderr, "%*s", padding_len + marker_len, marker);
-  vfprintf(stderr, fmt, ap);
-  fprintf(stderr, "\n");
-  exit(1);
+  int line_num = 1;
+  char *line = cc->user_input;
+  for (char *p = cc->user_input; p < loc; ++p) {
+    if (*p == '\n') {
+      ++line_num;
+      line = p + 1;
+    }
+  }
+  char *line_end = line;
+  while (*line_end && *line_end != '\n') ++line_end;
+  int column = loc - line + 1;
+
+  FILE *err = OpenErrorStream(cc);
+  if (err) {
+    fprintf(err, "%s:%d:%d: ", cc->input_name, line_num, column);
+    vfprintf(err, fmt, ap);
+    fprintf(err, "\n%.*s\n", (int)(line_end - line), line);
+    fprintf(err, "%*s^\n", column - 1, "");
+  }
+  va_end(ap);
+  EndCompilation(cc, err);
 }
 
-void ExitWithError(char *fmt, ...) {
+_Noreturn void ExitWithError(Compiler *cc, char *fmt, ...) {
   va_list ap;
   va_start(ap, fmt);
-  vfprintf(stderr, fmt, ap);
-  fprintf(stderr, "\n");
-  exit(1);
+  FILE *err = OpenErrorStream(cc);
+  if (err) {
+    vfprintf(err, fmt, ap);
+    fprintf(err, "\n");
+  }
+  va_end(ap);
+  EndCompilation(cc, err);
 }
 /*** error ***/
 
@@ -34,6 +98,8 @@ bool StartsWith(char *p, char *possible_prefix) {
   return !memcmp(p, possible_prefix, strlen(possible_prefix));
 }
 
-bool IsAlnumOrUnderscore(char c) {
-  return isalnum(c) || c == '_';
+bool EndsWith(char *str, char *suffix) {
+  size_t len = strlen(str);
+  size_t suffix_len = strlen(suffix);
+  return len >= suffix_len && !strcmp(str + len - suffix_len, suffix);
 }